@@ -3,13 +3,116 @@
 #include "co/fs.h"
 #include "co/flag.h"
 #include "co/cout.h"
+#include "co/rpc.h"
 
 DEF_bool(cpp, false, "generate code for C++");
 DEF_bool(go, false, "generate code for golang"); 
- 
+
+// a field of a message: [repeated] type name [= id]
+struct Field {
+    fastring type; // type in the proto file
+    fastring name;
+    uint32 id;
+    bool repeated;
+};
+
+struct Message {
+    fastring name;
+    co::vector<Field> fields;
+};
+
+// a method, req and res are empty if it takes Json
+struct Method {
+    fastring name;
+    fastring req;
+    fastring res;
+};
+
+// C++ type of a type in the proto file, or an empty string for messages
+fastring scalar_type(const fastring& t) {
+    if (t == "bool" || t == "double") return t;
+    if (t == "int32" || t == "int64" || t == "uint32" || t == "uint64") return t;
+    if (t == "string") return "fastring";
+    return fastring();
+}
+
+fastring cpp_type(const Field& f) {
+    fastring t = scalar_type(f.type);
+    if (t.empty()) t = f.type;
+    return f.repeated ? "co::vector<" + t + ">" : t;
+}
+
+void gen_message(fs::fstream& fs, const Message& m) {
+    const fastring s4(' ', 4), s8(' ', 8), s12(' ', 12), s14(' ', 14), s16(' ', 16);
+    fs << "struct " << m.name << " {\n";
+
+    // initialize scalar fields
+    fastring init;
+    for (size_t i = 0; i < m.fields.size(); ++i) {
+        const Field& f = m.fields[i];
+        const fastring t = scalar_type(f.type);
+        if (f.repeated || t.empty() || t == "fastring") continue;
+        if (!init.empty()) init << ", ";
+        init << f.name << '(' << (t == "bool" ? "false" : "0") << ')';
+    }
+    if (!init.empty()) fs << s4 << m.name << "() : " << init << " {}\n\n";
+
+    for (size_t i = 0; i < m.fields.size(); ++i) {
+        const Field& f = m.fields[i];
+        fs << s4 << cpp_type(f) << ' ' << f.name << ";\n";
+    }
+    if (!m.fields.empty()) fs << '\n';
+
+    // void encode(rpc::Writer& w) const
+    fs << s4 << "void encode(rpc::Writer& w) const {\n";
+    for (size_t i = 0; i < m.fields.size(); ++i) {
+        const Field& f = m.fields[i];
+        fs << s8 << "w.put(" << f.id << ", this->" << f.name << ");\n";
+    }
+    fs << s4 << "}\n\n";
+
+    // bool decode(rpc::Reader& r)
+    fs << s4 << "bool decode(rpc::Reader& r) {\n"
+       << s8 << "uint32 id, t;\n"
+       << s8 << "while (r.next(&id, &t)) {\n"
+       << s12 << "switch (id) {\n";
+    for (size_t i = 0; i < m.fields.size(); ++i) {
+        const Field& f = m.fields[i];
+        fs << s14 << "case " << f.id << ":\n"
+           << s16 << "if (!r.get(t, this->" << f.name << ")) return false;\n"
+           << s16 << "break;\n";
+    }
+    fs << s14 << "default:\n"
+       << s16 << "if (!r.skip(t)) return false;\n"
+       << s12 << "}\n"
+       << s8 << "}\n"
+       << s8 << "return r.ok();\n"
+       << s4 << "}\n\n";
+
+    // void to_json(Json& j) const
+    fs << s4 << "void to_json(Json& j) const {\n";
+    for (size_t i = 0; i < m.fields.size(); ++i) {
+        const Field& f = m.fields[i];
+        fs << s8 << "rpc::xx::to_json(j, \"" << f.name << "\", this->" << f.name << ");\n";
+    }
+    fs << s4 << "}\n\n";
+
+    // bool from_json(const Json& j)
+    fs << s4 << "bool from_json(const Json& j) {\n";
+    if (m.fields.empty()) fs << s8 << "return true;\n";
+    for (size_t i = 0; i < m.fields.size(); ++i) {
+        const Field& f = m.fields[i];
+        fs << (i == 0 ? s8 + "return " : s12)
+           << "rpc::xx::from_json(j, \"" << f.name << "\", this->" << f.name << ")"
+           << (i + 1 < m.fields.size() ? " &&\n" : ";\n");
+    }
+    fs << s4 << "}\n";
+    fs << "};\n\n";
+}
+
 void gen_cpp(
     const fastring& gen_file, const fastring& pkg, const fastring& serv, 
-    const co::vector<fastring>& methods
+    const co::vector<Message>& msgs, const co::vector<Method>& methods
 ) {
     fs::fstream fs(gen_file.c_str(), 'w');
     if (!fs) {
@@ -39,18 +142,49 @@ void gen_cpp(
     }
     if (!pkgs.empty()) fs << "\n";
 
+    // structs for messages
+    for (size_t i = 0; i < msgs.size(); ++i) gen_message(fs, msgs[i]);
+
+    bool typed = false;
+    for (size_t i = 0; i < methods.size(); ++i) {
+        if (!methods[i].req.empty()) typed = true;
+    }
+
     // class for service
     fs << "class " << serv << " : public rpc::Service {\n";
     fs << "  public:\n";
     fs << fastring(' ', 4) << "typedef std::function<void(Json&, Json&)> Fun;\n\n";
 
+    // ids of typed methods, for calls in the binary encoding
+    if (typed) {
+        fs << fastring(' ', 4) << "// ids of methods, see rpc::method_id()\n"
+           << fastring(' ', 4) << "struct Id {\n"
+           << fastring(' ', 8) << "enum : uint32 {\n";
+        for (size_t i = 0; i < methods.size(); ++i) {
+            const Method& m = methods[i];
+            if (m.req.empty()) continue;
+            fastring api(serv);
+            api << '.' << m.name;
+            fs << fastring(' ', 12) << m.name << " = " << rpc::method_id(api.c_str()) << "u,\n";
+        }
+        fs << fastring(' ', 8) << "};\n"
+           << fastring(' ', 4) << "};\n\n";
+    }
+
+    // lambdas are called directly by std::function, unlike std::bind
     do {
         fs << fastring(' ', 4) << serv << "() {\n";
-        fs << fastring(' ', 8) << "using std::placeholders::_1;\n";
-        fs << fastring(' ', 8) << "using std::placeholders::_2;\n";
         for (size_t i = 0; i < methods.size(); ++i) {
-            fs << fastring(' ', 8) << "_methods[\"" << serv << '.' << methods[i] << "\"] = "
-               << "std::bind(&" << serv << "::" << methods[i] << ", this, _1, _2);\n";
+            const Method& m = methods[i];
+            if (m.req.empty()) {
+                fs << fastring(' ', 8) << "_methods[\"" << serv << '.' << m.name << "\"] = "
+                   << "[this](Json& req, Json& res) { this->" << m.name << "(req, res); };\n";
+            } else {
+                fs << fastring(' ', 8) << "_methods[\"" << serv << '.' << m.name << "\"] = "
+                   << "[this](Json& req, Json& res) { this->json_" << m.name << "(req, res); };\n";
+                fs << fastring(' ', 8) << "_bin_methods[\"" << serv << '.' << m.name << "\"] = "
+                   << "[this](rpc::Reader& req, rpc::Writer& res) { return this->bin_" << m.name << "(req, res); };\n";
+            }
         }
         fs << fastring(' ', 4) << "}\n\n";
 
@@ -66,13 +200,53 @@ void gen_cpp(
        << fastring(' ', 8) << "return _methods;\n"
        << fastring(' ', 4) << "}\n\n";
 
+    if (typed) {
+        fs << fastring(' ', 4) << "virtual const co::map<const char*, BinFun>* bin_methods() const {\n"
+           << fastring(' ', 8) << "return &_bin_methods;\n"
+           << fastring(' ', 4) << "}\n\n";
+    }
+
     // virtual void xxx(Json& req, Json& res)
+    // virtual void xxx(const XReq& req, XRes& res)
     for (size_t i = 0; i < methods.size(); ++i) {
-        fs << fastring(' ', 4) << "virtual void " << methods[i] << "(Json& req, Json& res) = 0;\n\n";
+        const Method& m = methods[i];
+        if (m.req.empty()) {
+            fs << fastring(' ', 4) << "virtual void " << m.name << "(Json& req, Json& res) = 0;\n\n";
+        } else {
+            fs << fastring(' ', 4) << "virtual void " << m.name << "(const " << m.req
+               << "& req, " << m.res << "& res) = 0;\n\n";
+        }
     }
 
     fs << "  private:\n";
+
+    // typed methods called with Json or the binary encoding
+    for (size_t i = 0; i < methods.size(); ++i) {
+        const Method& m = methods[i];
+        if (m.req.empty()) continue;
+        fs << fastring(' ', 4) << "void json_" << m.name << "(Json& req, Json& res) {\n"
+           << fastring(' ', 8) << m.req << " a;\n"
+           << fastring(' ', 8) << m.res << " b;\n"
+           << fastring(' ', 8) << "if (!a.from_json(req)) {\n"
+           << fastring(' ', 12) << "res.add_member(\"error\", \"bad req\");\n"
+           << fastring(' ', 12) << "return;\n"
+           << fastring(' ', 8) << "}\n"
+           << fastring(' ', 8) << "this->" << m.name << "(a, b);\n"
+           << fastring(' ', 8) << "b.to_json(res);\n"
+           << fastring(' ', 4) << "}\n\n";
+
+        fs << fastring(' ', 4) << "bool bin_" << m.name << "(rpc::Reader& req, rpc::Writer& res) {\n"
+           << fastring(' ', 8) << m.req << " a;\n"
+           << fastring(' ', 8) << m.res << " b;\n"
+           << fastring(' ', 8) << "if (!a.decode(req)) return false;\n"
+           << fastring(' ', 8) << "this->" << m.name << "(a, b);\n"
+           << fastring(' ', 8) << "b.encode(res);\n"
+           << fastring(' ', 8) << "return true;\n"
+           << fastring(' ', 4) << "}\n\n";
+    }
+
     fs << "    co::map<const char*, Fun> _methods;\n";
+    if (typed) fs << "    co::map<const char*, BinFun> _bin_methods;\n";
     fs << "};\n";
 
     if (!pkgs.empty()) fs << '\n';
@@ -88,10 +262,87 @@ void gen_cpp(
 // todo: support golang
 void gen_go(
     const fastring& gen_file, const fastring& pkg, const fastring& serv, 
-    const co::vector<fastring>& methods
+    const co::vector<Message>& msgs, const co::vector<Method>& methods
 ) {
 }
 
+const Message* find_message(const co::vector<Message>& msgs, const fastring& name) {
+    for (size_t i = 0; i < msgs.size(); ++i) {
+        if (msgs[i].name == name) return &msgs[i];
+    }
+    return 0;
+}
+
+// parse a field: "[repeated] type name [= id]"
+void parse_field(const fastring& line, const co::vector<Message>& msgs, Message& m) {
+    fastring x = str::replace(line, "=", " ");
+    auto v = str::split(x, ' ');
+    co::vector<fastring> t;
+    for (size_t i = 0; i < v.size(); ++i) {
+        auto s = str::strip(v[i]);
+        if (!s.empty()) t.push_back(s);
+    }
+
+    Field f;
+    f.repeated = !t.empty() && t[0] == "repeated";
+    if (f.repeated) t.erase(t.begin());
+    if (t.size() != 2 && t.size() != 3) {
+        COUT << "invalid field in message " << m.name << ": " << line;
+        exit(-1);
+    }
+
+    f.type = t[0];
+    f.name = t[1];
+    if (scalar_type(f.type).empty() && !find_message(msgs, f.type)) {
+        COUT << "unknown type of field " << m.name << '.' << f.name << ": " << f.type
+             << ", a message MUST be defined before it is used";
+        exit(-1);
+    }
+
+    const uint32 last = m.fields.empty() ? 0 : m.fields.back().id;
+    f.id = t.size() == 3 ? str::to_uint32(t[2].c_str()) : last + 1;
+    if (f.id == 0) {
+        COUT << "invalid field id in message " << m.name << ": " << line;
+        exit(-1);
+    }
+    for (size_t i = 0; i < m.fields.size(); ++i) {
+        if (m.fields[i].id == f.id || m.fields[i].name == f.name) {
+            COUT << "duplicate field in message " << m.name << ": " << line;
+            exit(-1);
+        }
+    }
+    m.fields.push_back(f);
+}
+
+// parse a method: "name" or "name(XReq) returns (XRes)"
+void parse_method(const fastring& line, const co::vector<Message>& msgs, co::vector<Method>& methods) {
+    Method m;
+    const size_t p = line.find('(');
+    if (p == line.npos) {
+        m.name = line;
+        methods.push_back(m);
+        return;
+    }
+
+    m.name = str::strip(line.substr(0, p));
+    const size_t q = line.find(')', p);
+    const size_t r = q != line.npos ? line.find("returns", q) : line.npos;
+    const size_t a = r != line.npos ? line.find('(', r) : line.npos;
+    const size_t b = a != line.npos ? line.find(')', a) : line.npos;
+    if (b == line.npos) {
+        COUT << "invalid method: " << line << ", it should be: name(XReq) returns (XRes)";
+        exit(-1);
+    }
+
+    m.req = str::strip(line.substr(p + 1, q - p - 1));
+    m.res = str::strip(line.substr(a + 1, b - a - 1));
+    if (!find_message(msgs, m.req) || !find_message(msgs, m.res)) {
+        COUT << "unknown message in method: " << line;
+        exit(-1);
+    }
+    methods.push_back(m);
+}
+
 void parse(const char* path) {
     fs::file f;
     if (!f.open(path, 'r')) {
@@ -112,7 +363,8 @@ void parse(const char* path) {
     fastring gen_file(fastring(b, e - b) + ".h");
     fastring pkg;
     fastring serv;
-    co::vector<fastring> methods;
+    co::vector<Message> msgs;
+    co::vector<Method> methods;
 
     auto s = f.read(fs::fsize(path));
     char c = '\n';
@@ -138,6 +390,36 @@ void parse(const char* path) {
             continue;
         }
 
+        if (x.starts_with("message ")) {
+            const char* p = strstr(x.c_str(), "//");
+            if (p) x.resize(p - x.data());
+            Message m;
+            m.name = str::strip(x.c_str() + 8, " \t\r\n{");
+            if (!scalar_type(m.name).empty() || find_message(msgs, m.name)) {
+                COUT << "invalid or duplicate message: " << m.name;
+                exit(-1);
+            }
+
+            size_t k = i + 1;
+            for (; k < l.size(); ++k) {
+                const char* p = strstr(l[k].c_str(), "//");
+                if (p) l[k].resize(p - l[k].data());
+
+                const bool end = l[k].find('}') != l[k].npos;
+                auto y = str::strip(l[k], " \t\r\n,;{}");
+                if (!y.empty()) parse_field(y, msgs, m);
+                if (end) break;
+            }
+
+            if (k == l.size()) {
+                COUT << "ending '}' not found for message: " << m.name;
+                exit(-1);
+            }
+            msgs.push_back(m);
+            i = k;
+            continue;
+        }
+
         if (x.starts_with("service ")) {
             if (!serv.empty()) {
                 COUT << "find multiple service in file: " << path;
@@ -155,19 +437,19 @@ void parse(const char* path) {
 
                 if (l[k].find('}') != l[k].npos) {
                     auto m = str::strip(l[k], " \t\r\n,;{}");
-                    if (!m.empty()) methods.push_back(m);
+                    if (!m.empty()) parse_method(m, msgs, methods);
                     if (methods.empty()) {
                         COUT << "no method found in service: " << serv;
                         exit(-1);
                     }
 
                     if (!FLG_cpp && !FLG_go) FLG_cpp = true; // gen cpp by default
-                    if (FLG_cpp) gen_cpp(gen_file, pkg, serv, methods);
-                    if (FLG_go) gen_go(gen_file, pkg, serv, methods);
+                    if (FLG_cpp) gen_cpp(gen_file, pkg, serv, msgs, methods);
+                    if (FLG_go) gen_go(gen_file, pkg, serv, msgs, methods);
                     return;
                 } else {
                     auto m = str::strip(l[k], " \t\r\n,;{");
-                    if (!m.empty()) methods.push_back(m);
+                    if (!m.empty()) parse_method(m, msgs, methods);
                 }
             }
 
@@ -6,12 +6,16 @@
 #include "log.h"
 #include "stl.h"
 #include "./co/sock.h"
+#include "./co/dns.h"
 #include "./co/event.h"
 #include "./co/mutex.h"
 #include "./co/pool.h"
 #include "./co/chan.h"
+#include "./co/select.h"
 #include "./co/io_event.h"
 #include "./co/wait_group.h"
+#include "./co/async.h"
+#include "./co/prof.h"
 
 namespace co {
 
@@ -193,6 +197,49 @@ __coapi int scheduler_id();
  */
 __coapi int coroutine_id();
 
+/**
+ * get wakeup counters of all schedulers 
+ *   - A wakeup is issued when a task is added to a scheduler that may be blocking 
+ *     on epoll wait. Otherwise it is suppressed, as the scheduler is awake and it 
+ *     will check its task queues anyway. 
+ *   - Suppressed wakeups are counted by the threads that add the tasks, so they 
+ *     are only available as a total of all schedulers. 
+ * 
+ * @param issued      number of wakeups that signaled the epoll, may be NULL.
+ * @param suppressed  number of wakeups that were skipped, may be NULL.
+ */
+__coapi void wakeup_stats(uint64* issued, uint64* suppressed);
+
+/**
+ * runtime statistics of a scheduler 
+ *   - Counters are cumulative since the scheduler started. They are written by the 
+ *     scheduler thread and read without locks, so a snapshot may be a bit stale. 
+ */
+struct sched_stats_t {
+    uint32 id;                 // scheduler id
+    uint32 coroutines;         // live coroutines, created and not finished yet
+    uint32 timers;             // pending timers
+    uint32 ready;              // new and ready tasks taken from the queues in the last round
+    uint32 max_ready;          // peak of ready
+    uint32 deferred;           // coroutines waiting in the low priority lane
+    uint64 switches;           // context switches into coroutines
+    uint64 stack_saved;        // bytes of stack data saved for suspended coroutines
+    uint64 polls;              // calls of epoll wait
+    uint64 io_events;          // IO events returned by epoll wait
+    uint64 wakeups_issued;     // see wakeup_stats()
+    uint64 wait_us;            // time blocking on epoll wait, in microseconds
+    uint64 run_us;             // time running coroutines and handling events, in microseconds
+};
+
+/**
+ * get a snapshot of runtime statistics of all schedulers 
+ *   - It is useful for tuning co_sched_num and co_stack_size, and for finding 
+ *     imbalance between the schedulers. 
+ * 
+ * @return  statistics indexed by scheduler id.
+ */
+__coapi co::vector<sched_stats_t> sched_stats();
+
 /**
  * add a timer for the current coroutine 
  *   - It MUST be called in a coroutine.
@@ -237,6 +284,42 @@ __coapi void del_io_event(sock_t fd);
  */
 __coapi void yield();
 
+/**
+ * yield if the current coroutine has used up its time slice 
+ *   - It does nothing if not called in a coroutine. 
+ *   - It is cheap, and can be called in loops of CPU-bound jobs. When the coroutine 
+ *     has been running longer than co_time_slice_ms without being suspended, it 
+ *     is suspended and resumed after other ready coroutines in the scheduler. 
+ *   - Time slices are checked by the watchdog thread, which is started on the 
+ *     first call. 
+ */
+__coapi void maybe_yield();
+
+enum prio_t {
+    prio_normal = 0, // the default priority
+    prio_low = 1,    // for background jobs
+};
+
+/**
+ * set priority of the current coroutine 
+ *   - It MUST be called in a coroutine. 
+ *   - A coroutine starts with prio_normal. 
+ *   - In each round of the scheduler loop, coroutines with prio_low are resumed 
+ *     after the others, and no more than co_low_budget_us is spent on them. The 
+ *     rest are left to the next round. This protects latency of request handlers 
+ *     from background jobs like compaction or reporting in the same scheduler. 
+ *   - Lowering the priority suspends the coroutine, and it continues in the low 
+ *     priority lane. A low priority coroutine running a long time without being 
+ *     suspended still blocks the scheduler. 
+ */
+__coapi void set_priority(prio_t p);
+
+/**
+ * get priority of the current coroutine 
+ *   - It MUST be called in a coroutine. 
+ */
+__coapi prio_t priority();
+
 /**
  * resume the coroutine
  *   - It is thread safe and can be called anywhere.
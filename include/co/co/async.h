@@ -0,0 +1,181 @@
+#pragma once
+
+#include "../def.h"
+#include "../mem.h"
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace co {
+namespace xx {
+
+// a task and its result, allocated on heap, as the stack of a suspended
+// coroutine may be used by other coroutines.
+template <typename F, typename R>
+struct AsyncTask {
+    template <typename X>
+    explicit AsyncTask(X&& x) : f(std::forward<X>(x)) {}
+
+    static void run(void* p) {
+        AsyncTask* t = (AsyncTask*)p;
+        new (t->r) R(t->f());
+    }
+
+    R take() {
+        R& x = *(R*)r;
+        R v(std::move(x));
+        x.~R();
+        return v;
+    }
+
+    F f;
+    alignas(R) char r[sizeof(R)];
+};
+
+template <typename F>
+struct AsyncTask<F, void> {
+    template <typename X>
+    explicit AsyncTask(X&& x) : f(std::forward<X>(x)) {}
+
+    static void run(void* p) {
+        ((AsyncTask*)p)->f();
+    }
+
+    void take() {}
+
+    F f;
+};
+
+// index sequence for unpacking the arguments, std::index_sequence is C++14
+template <size_t... I> struct Seq {};
+template <size_t N, size_t... I> struct MakeSeq : MakeSeq<N - 1, N - 1, I...> {};
+template <size_t... I> struct MakeSeq<0, I...> { typedef Seq<I...> type; };
+
+// f and the decay-copied arguments, they are moved into f when it is called, 
+// as a task is called only once.
+template <typename F, typename... A>
+struct AsyncCall {
+    typedef decltype(std::declval<F&>()(std::declval<A>()...)) R;
+
+    template <typename X, typename... Y>
+    AsyncCall(X&& x, Y&&... y) : f(std::forward<X>(x)), a(std::forward<Y>(y)...) {}
+
+    R operator()() { return this->call(typename MakeSeq<sizeof...(A)>::type()); }
+
+    template <size_t... I>
+    R call(Seq<I...>) { return f(std::move(std::get<I>(a))...); }
+
+    F f;
+    std::tuple<A...> a;
+};
+
+template <typename F, typename... A>
+using async_call_t = AsyncCall<typename std::decay<F>::type, typename std::decay<A>::type...>;
+
+} // xx
+
+/**
+ * AsyncPool runs blocking calls in a fixed number of threads
+ *   - It is for work that is not hooked and would stall a scheduler, like file
+ *     I/O with fs::file, fsync, compression or crypto.
+ *   - run() parks the calling coroutine until the task is done in the pool, other
+ *     coroutines in the same scheduler keep running meanwhile. It can also be
+ *     called from non-coroutine threads, and blocks the thread then.
+ *   - As each caller waits for its own task, the queue is bounded by the number
+ *     of waiting callers, while the number of threads is fixed.
+ *   - Threads are created on the first call of run().
+ *
+ *   - NOTE: The task runs in another thread while the coroutine is suspended. If
+ *     the coroutines are not running on dedicated stacks (co_dedicated_stack), the
+ *     stack of the coroutine may be used by other coroutines meanwhile, and the
+ *     task MUST NOT refer to variables on it. Pass them as arguments instead, they
+ *     are copied or moved into the task like std::thread, or capture by value and
+ *     return the result.
+ *
+ * e.g.
+ *   fastring s = co::async_run([path]() { return read_file(path); });
+ *   co::async_run([](fs::file* f, const fastring& s) { f->write(s); }, pf, buf);
+ */
+class __coapi AsyncPool {
+  public:
+    struct stats_t {
+        uint32 threads;    // number of threads
+        uint32 busy;       // threads running a task
+        uint32 queued;     // tasks waiting in the queue
+        uint32 max_queued; // peak of the queue depth
+        uint64 done;       // tasks done
+        uint64 wait_us;    // total time tasks spent in the queue, in microseconds
+        uint64 run_us;     // total time tasks spent running, in microseconds
+    };
+
+    // @threads: number of threads, os::cpunum() if it is 0.
+    explicit AsyncPool(uint32 threads=0);
+
+    // wait for the queued tasks, and stop the threads
+    ~AsyncPool();
+
+    AsyncPool(AsyncPool&& p) : _p(p._p) { p._p = 0; }
+
+    void operator=(const AsyncPool&) = delete;
+
+    /**
+     * run f() in the pool and wait for it
+     *   - f is moved or copied into a task allocated on heap.
+     *
+     * @return  the result of f(), moved out of the task.
+     */
+    template <typename F>
+    auto run(F&& f) -> decltype(f()) {
+        typedef xx::AsyncTask<typename std::decay<F>::type, decltype(f())> T;
+        struct G {
+            ~G() { co::del(t); }
+            T* t;
+        } g = { co::make<T>(std::forward<F>(f)) };
+        this->submit(&T::run, g.t);
+        return g.t->take();
+    }
+
+    /**
+     * run f(a, b...) in the pool and wait for it
+     *   - The arguments are decay-copied into the task, and moved into f when it is
+     *     called. Use std::ref() to pass a reference that is safe to use in another 
+     *     thread.
+     */
+    template <typename F, typename A, typename... B>
+    auto run(F&& f, A&& a, B&&... b) -> typename xx::async_call_t<F, A, B...>::R {
+        return this->run(xx::async_call_t<F, A, B...>(
+            std::forward<F>(f), std::forward<A>(a), std::forward<B>(b)...
+        ));
+    }
+
+    // get a snapshot of the counters of this pool
+    stats_t stats() const;
+
+  private:
+    // run f(arg) in the pool, and wait until it is done
+    void submit(void (*f)(void*), void* arg);
+    void* _p;
+};
+
+/**
+ * get the default pool of co::async_run()
+ *   - Number of threads in the pool is set by co_async_threads.
+ */
+__coapi AsyncPool& async_pool();
+
+/**
+ * run a blocking call in the default pool, and wait for it
+ *   - See details in AsyncPool.
+ */
+template <typename F>
+inline auto async_run(F&& f) -> decltype(f()) {
+    return async_pool().run(std::forward<F>(f));
+}
+
+template <typename F, typename A, typename... B>
+inline auto async_run(F&& f, A&& a, B&&... b) -> typename xx::async_call_t<F, A, B...>::R {
+    return async_pool().run(std::forward<F>(f), std::forward<A>(a), std::forward<B>(b)...);
+}
+
+} // co
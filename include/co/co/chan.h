@@ -3,13 +3,30 @@
 #include "../def.h"
 #include "../god.h"
 #include "../atomic.h"
+#include <new>
+#include <type_traits>
+#include <utility>
 
 namespace co {
+
+class Select;
+
 namespace xx {
 
 class __coapi Pipe {
   public:
-    Pipe(uint32 buf_size, uint32 blk_size, uint32 ms);
+    // operations on blocks for types that are not trivially copyable
+    enum {
+        op_copy = 0,    // copy construct dst from src
+        op_move = 1,    // move construct dst from src
+        op_assign = 2,  // move assign src to dst
+        op_destroy = 3, // destroy dst
+    };
+
+    // @op: one of the operations above, blocks are copied with memcpy if it is NULL.
+    typedef void (*op_t)(void* dst, void* src, int op);
+
+    Pipe(uint32 buf_size, uint32 blk_size, uint32 ms, op_t op=0);
     ~Pipe();
 
     Pipe(Pipe&& p) : _p(p._p) {
@@ -23,19 +40,78 @@ class __coapi Pipe {
 
     void operator=(const Pipe&) = delete;
 
-    // read a block
-    void read(void* p) const;
+    // read a block, return false on timeout, or if the pipe is closed and empty
+    bool read(void* p) const;
+
+    // read a block with a timeout in milliseconds instead of the default one
+    bool read(void* p, uint32 ms) const;
+
+    // write a block, @o is op_copy or op_move, return false on timeout or if closed
+    bool write(const void* p, int o=op_copy) const;
+
+    // read a block without waiting, return false if the pipe is empty
+    bool try_read(void* p) const;
+
+    // write a block without waiting, return false if the pipe is full or closed
+    bool try_write(const void* p, int o=op_copy) const;
+
+    // close the pipe and wake up all the waiting coroutines
+    void close() const;
+
+    bool is_closed() const;
 
-    // write a block
-    void write(const void* p) const;
-  
   private:
+    friend class co::Select;
     uint32* _p;
 };
 
-} // xx
+template <typename T, god::enable_if_t<std::is_copy_constructible<T>::value, int> = 0>
+inline void pipe_copy(void* dst, const void* src) {
+    new (dst) T(*(const T*)src);
+}
+
+// never called, Chan does not copy move-only types
+template <typename T, god::enable_if_t<!std::is_copy_constructible<T>::value, int> = 0>
+inline void pipe_copy(void*, const void*) {}
+
+template <typename T>
+inline void pipe_op(void* dst, void* src, int op) {
+    switch (op) {
+      case Pipe::op_copy:
+        pipe_copy<T>(dst, src);
+        break;
+      case Pipe::op_move:
+        new (dst) T(std::move(*(T*)src));
+        break;
+      case Pipe::op_assign:
+        *(T*)dst = std::move(*(T*)src);
+        break;
+      default:
+        ((T*)dst)->~T();
+    }
+}
 
 template <typename T, god::enable_if_t<god::is_trivially_copyable<T>(), int> = 0>
+inline Pipe::op_t pipe_op_of() { return 0; }
+
+template <typename T, god::enable_if_t<!god::is_trivially_copyable<T>(), int> = 0>
+inline Pipe::op_t pipe_op_of() { return &pipe_op<T>; }
+
+} // xx
+
+/**
+ * Chan is a bounded MPMC channel for coroutines.
+ *   - Trivially copyable types are copied with memcpy. Other types, like fastring
+ *     or std::unique_ptr, are moved into and out of the channel in place. Their
+ *     move constructor and move assignment should not throw.
+ *
+ *   - Reading from a closed channel succeeds until the channel is empty, while
+ *     writing to a closed channel always fails.
+ *
+ *   - When a blocking operation fails, co::timeout() tells whether it is caused
+ *     by a timeout or the channel being closed.
+ */
+template <typename T>
 class Chan {
   public:
     /**
@@ -43,7 +119,7 @@ class Chan {
      * @param ms   default timeout in milliseconds, -1 by default.
      */
     explicit Chan(uint32 cap=1, uint32 ms=(uint32)-1)
-        : _p(cap * sizeof(T), sizeof(T), ms) {
+        : _p(cap * sizeof(T), sizeof(T), ms, xx::pipe_op_of<T>()) {
     }
 
     ~Chan() = default;
@@ -55,14 +131,51 @@ class Chan {
     void operator=(const Chan&) = delete;
 
     void operator<<(const T& x) const {
+        static_assert(std::is_copy_constructible<T>::value, "T is not copyable");
         _p.write(&x);
     }
 
+    void operator<<(T&& x) const {
+        _p.write(&x, xx::Pipe::op_move);
+    }
+
     void operator>>(T& x) const {
         _p.read(&x);
     }
 
+    // write an element, return false on timeout or if the channel is closed
+    bool send(const T& x) const {
+        static_assert(std::is_copy_constructible<T>::value, "T is not copyable");
+        return _p.write(&x);
+    }
+
+    // move an element into the channel, @x is left untouched on failure
+    bool send(T&& x) const { return _p.write(&x, xx::Pipe::op_move); }
+
+    // read an element, return false on timeout, or if closed and empty
+    bool recv(T& x) const { return _p.read(&x); }
+
+    // read an element with a timeout in milliseconds
+    bool recv(T& x, uint32 ms) const { return _p.read(&x, ms); }
+
+    // return false at once if the channel is full or closed
+    bool try_send(const T& x) const {
+        static_assert(std::is_copy_constructible<T>::value, "T is not copyable");
+        return _p.try_write(&x);
+    }
+
+    bool try_send(T&& x) const { return _p.try_write(&x, xx::Pipe::op_move); }
+
+    // return false at once if the channel is empty
+    bool try_recv(T& x) const { return _p.try_read(&x); }
+
+    // close the channel, waiting readers and writers will be woken up
+    void close() const { _p.close(); }
+
+    bool is_closed() const { return _p.is_closed(); }
+
   private:
+    friend class Select;
     xx::Pipe _p;
 };
 
@@ -0,0 +1,62 @@
+#pragma once
+
+#ifndef _WIN32
+#include "../def.h"
+#include "../stl.h"
+#include "sock.h"
+
+namespace co {
+namespace dns {
+
+// an IPv4 or IPv6 address in network byte order
+struct addr_t {
+    int family; // AF_INET or AF_INET6
+    union {
+        struct in_addr v4;
+        struct in6_addr v6;
+    };
+};
+
+/**
+ * resolve a host name to IP addresses
+ *   - It MUST be called in a coroutine.
+ *   - IP literals are returned as they are, and names in the hosts file
+ *     (co_dns_hosts) are checked before querying the DNS servers.
+ *   - Queries are sent over UDP to the servers in co_dns_servers, or in
+ *     resolv.conf (co_dns_resolv_conf) if co_dns_servers is empty. The
+ *     coroutine is suspended while waiting for the response, so it will not
+ *     block other coroutines in the same scheduler.
+ *   - Answers are cached according to their TTL, and failed lookups are also
+ *     cached for a while.
+ *
+ * @param name    the host name.
+ * @param family  AF_INET, AF_INET6, or AF_UNSPEC for both.
+ * @param res     addresses found will be appended to it, IPv4 addresses first.
+ *
+ * @return        0 on success, otherwise an error code of getaddrinfo():
+ *                EAI_NONAME if the host was not found, EAI_AGAIN if the servers
+ *                did not respond, EAI_FAMILY if the family is not supported,
+ *                EAI_SYSTEM if a socket could not be created.
+ */
+__coapi int resolve(const char* name, int family, co::vector<addr_t>& res);
+
+/**
+ * find the host name of an IP address
+ *   - It MUST be called in a coroutine.
+ *   - The hosts file is checked first, then a PTR query is sent to the servers.
+ *
+ * @param a     the address.
+ * @param name  the host name found will be placed in it.
+ *
+ * @return      0 on success, EAI_NONAME if not found, EAI_AGAIN if the servers
+ *              did not respond, or EAI_SYSTEM if a socket could not be created.
+ */
+__coapi int reverse(const addr_t& a, fastring& name);
+
+// clear the cache, and reload the hosts file and resolv.conf on the next lookup
+__coapi void clear_cache();
+
+} // dns
+} // co
+
+#endif
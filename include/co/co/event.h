@@ -5,6 +5,8 @@
 
 namespace co {
 
+class Select;
+
 /**
  * co::Event is for communications between coroutines
  *   - It is similar to SyncEvent for threads.
@@ -57,6 +59,7 @@ class __coapi Event {
     void reset() const;
 
   private:
+    friend class Select;
     uint32* _p;
 };
 
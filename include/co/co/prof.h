@@ -0,0 +1,44 @@
+#pragma once
+
+#include "../def.h"
+#include "../fastring.h"
+
+namespace co {
+namespace prof {
+
+/**
+ * start the CPU profiler
+ *   - Each scheduler thread samples itself by a timer on its CPU time, a sample
+ *     is taken in the SIGPROF handler. Samples taken in a coroutine are grouped
+ *     by the go() call that created the coroutine, others are taken in the
+ *     scheduler itself.
+ *   - Only threads of the schedulers are sampled. It is supported on linux only,
+ *     and the SIGPROF handler installed by others will be replaced.
+ *   - Schedulers may see the change at the beginning of the next round of the
+ *     loop, so it takes effect asynchronously.
+ *   - Samples of the last run are cleared.
+ *
+ * @param hz  number of samples per second of CPU time, co_prof_hz if it is 0.
+ *
+ * @return    true if the profiler is running, false if it is not supported.
+ */
+__coapi bool start(uint32 hz=0);
+
+// stop the CPU profiler, samples are kept until the next start()
+__coapi void stop();
+
+/**
+ * get samples in the folded format of flamegraph.pl
+ *   - Each line is a call stack and the number of samples, frames are separated
+ *     by ';' from the root: "go@f() a.cc:12;f();g() 42". The root frame is the
+ *     go() call that created the coroutine, or "[scheduler]" for samples not in
+ *     coroutines.
+ *   - It can be called while the profiler is running.
+ */
+__coapi fastring folded();
+
+// write folded() to a file, return false if the file can not be written
+__coapi bool dump(const char* path);
+
+} // prof
+} // co
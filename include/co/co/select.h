@@ -0,0 +1,66 @@
+#pragma once
+
+#include "../def.h"
+#include "chan.h"
+#include "event.h"
+
+namespace co {
+
+/**
+ * Select waits on multiple channels and events at once
+ *   - Cases are added with recv() and event(), and their indexes start from 0 in
+ *     the order they were added.
+ *   - select() parks the coroutine on all the sources, and it is resumed only
+ *     once, by the first source that becomes ready, or by the timeout.
+ *   - The channels and events MUST be alive when select() is being called.
+ *   - A Select object can be reused, as the cases are kept between calls.
+ *
+ * e.g.
+ *   co::Select s;
+ *   s.recv(ch, x).event(ev);
+ *   int r = s.select(100); // 0: x was read from ch, 1: ev was signaled, -1: timeout
+ */
+class __coapi Select {
+  public:
+    Select();
+    ~Select();
+
+    Select(Select&& s) : _p(s._p) {
+        s._p = 0;
+    }
+
+    void operator=(const Select&) = delete;
+
+    /**
+     * add a case that reads an element from a channel
+     *
+     * @param x   the element read will be moved to x.
+     * @param ok  if not NULL, it will be set to false when the case is selected
+     *            as the channel is closed and empty, otherwise true.
+     */
+    template <typename T>
+    Select& recv(const Chan<T>& c, T& x, bool* ok=0) {
+        this->add_recv(c._p, &x, ok);
+        return *this;
+    }
+
+    // add a case that waits for a signal on an event
+    Select& event(const Event& ev);
+
+    /**
+     * wait until one of the cases is ready
+     *   - It MUST be called in a coroutine.
+     *   - If more than one case is ready at once, the first one wins.
+     *
+     * @param ms  timeout in milliseconds, if ms is -1, never timed out.
+     *
+     * @return    index of the case selected, or -1 on timeout.
+     */
+    int select(uint32 ms=(uint32)-1) const;
+
+  private:
+    void add_recv(const xx::Pipe& p, void* x, bool* ok);
+    void* _p;
+};
+
+} // co
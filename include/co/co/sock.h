@@ -90,6 +90,8 @@ __coapi int close(sock_t fd, int ms = 0);
 /**
  * shutdown a socket 
  *   - It is better to call shutdown() in the same thread that performed the I/O operation. 
+ *   - On linux and mac, coroutines waiting for I/O on the socket are woken up, and 
+ *     recv() returns 0 after it was shut down for reading. 
  * 
  * @param fd  a non-blocking (also overlapped on windows) socket.
  * @param c   'r' for SHUT_RD, 'w' for SHUT_WR, 'b' for SHUT_RDWR. 
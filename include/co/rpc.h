@@ -2,11 +2,341 @@
 
 #include "json.h"
 #include "stl.h"
+#include "fastream.h"
+#include "hash/murmur_hash.h"
 #include <memory>
 #include <functional>
 
 namespace rpc {
 
+// wire types in the binary encoding
+enum {
+    kVarint = 0,
+    kFixed64 = 1,
+    kBytes = 2,
+    kFixed32 = 5,
+};
+
+/**
+ * Writer encodes a message in the binary encoding
+ *   - It is tag-based like protobuf. A field is a varint tag (id << 3 | wire type)
+ *     followed by the value. bool and unsigned integers are varints, signed
+ *     integers are zigzag varints, double is 8 bytes in little endian, strings
+ *     and messages are length-delimited.
+ *   - put() omits fields with default values (0, false, empty string). Elements
+ *     of a repeated field are written as fields with the same id.
+ *   - Messages are structs generated by gen, with encode(Writer&) and
+ *     decode(Reader&).
+ */
+class Writer {
+  public:
+    explicit Writer(fastream& s) : _s(s) {}
+
+    void put(uint32 id, bool v)    { if (v) this->value(id, v); }
+    void put(uint32 id, int32 v)   { if (v) this->value(id, v); }
+    void put(uint32 id, uint32 v)  { if (v) this->value(id, v); }
+    void put(uint32 id, int64 v)   { if (v) this->value(id, v); }
+    void put(uint32 id, uint64 v)  { if (v) this->value(id, v); }
+    void put(uint32 id, double v)  { if (v != 0) this->value(id, v); }
+    void put(uint32 id, const fastring& v) { if (!v.empty()) this->value(id, v); }
+
+    template <typename T>
+    void put(uint32 id, const co::vector<T>& v) {
+        for (const T& x : v) this->value(id, x);
+    }
+
+    template <typename T>
+    void put(uint32 id, const T& v) { this->value(id, v); }
+
+    void value(uint32 id, bool v)   { this->tag(id, kVarint); _s.append((char)v); }
+    void value(uint32 id, int32 v)  { this->value(id, (int64)v); }
+    void value(uint32 id, uint32 v) { this->value(id, (uint64)v); }
+    void value(uint32 id, uint64 v) { this->tag(id, kVarint); this->varint(v); }
+
+    void value(uint32 id, int64 v) {
+        this->tag(id, kVarint);
+        this->varint(((uint64)v << 1) ^ (uint64)(v >> 63));
+    }
+
+    void value(uint32 id, double v) {
+        uint64 x;
+        memcpy(&x, &v, 8);
+        char b[8];
+        for (int i = 0; i < 8; ++i) b[i] = (char)(x >> (i << 3));
+        this->tag(id, kFixed64);
+        _s.append(b, 8);
+    }
+
+    void value(uint32 id, const fastring& v) {
+        this->tag(id, kBytes);
+        this->varint(v.size());
+        _s.append(v);
+    }
+
+    // the length of a message is inserted before it once it is encoded
+    template <typename T>
+    void value(uint32 id, const T& v) {
+        this->tag(id, kBytes);
+        const size_t pos = _s.size();
+        v.encode(*this);
+
+        char b[10];
+        const size_t n = _s.size() - pos;
+        const size_t k = varint(b, n);
+        _s.resize(_s.size() + k);
+        char* const p = (char*)_s.data() + pos;
+        memmove(p + k, p, n);
+        memcpy(p, b, k);
+    }
+
+    void tag(uint32 id, uint32 type) { this->varint(((uint64)id << 3) | type); }
+
+    void varint(uint64 v) {
+        char b[10];
+        _s.append(b, varint(b, v));
+    }
+
+    static size_t varint(char* b, uint64 v) {
+        size_t n = 0;
+        for (; v >= 0x80; v >>= 7) b[n++] = (char)(v | 0x80);
+        b[n++] = (char)v;
+        return n;
+    }
+
+  private:
+    fastream& _s;
+};
+
+/**
+ * Reader decodes a message in the binary encoding
+ *   - Fields are read in order by next(). Unknown fields are skipped by skip(),
+ *     so fields can be added to a message without breaking the peers.
+ *   - get() returns false if the wire type does not match or the data is
+ *     truncated. Elements of a repeated field are appended to the vector.
+ */
+class Reader {
+  public:
+    Reader(const char* p, size_t n) : _p(p), _e(p + n), _ok(true) {}
+
+    // read the tag of the next field, return false at the end or on error
+    bool next(uint32* id, uint32* type) {
+        if (_p >= _e) return false;
+        uint64 x;
+        if (!this->varint(&x) || (x >> 3) == 0 || (x >> 3) > 0xffffffffu) return _ok = false;
+        *id = (uint32)(x >> 3);
+        *type = (uint32)(x & 7);
+        return true;
+    }
+
+    // false if next() stopped on an error
+    bool ok() const { return _ok; }
+
+    bool get(uint32 type, bool& v) {
+        uint64 x;
+        if (type != kVarint || !this->varint(&x)) return false;
+        v = x != 0;
+        return true;
+    }
+
+    bool get(uint32 type, uint64& v) {
+        return type == kVarint && this->varint(&v);
+    }
+
+    bool get(uint32 type, uint32& v) {
+        uint64 x;
+        if (!this->get(type, x)) return false;
+        v = (uint32)x;
+        return true;
+    }
+
+    bool get(uint32 type, int64& v) {
+        uint64 x;
+        if (!this->get(type, x)) return false;
+        v = (int64)(x >> 1) ^ -(int64)(x & 1);
+        return true;
+    }
+
+    bool get(uint32 type, int32& v) {
+        int64 x;
+        if (!this->get(type, x)) return false;
+        v = (int32)x;
+        return true;
+    }
+
+    bool get(uint32 type, double& v) {
+        if (type != kFixed64 || _e - _p < 8) return false;
+        uint64 x = 0;
+        for (int i = 0; i < 8; ++i) x |= (uint64)(uint8)_p[i] << (i << 3);
+        memcpy(&v, &x, 8);
+        _p += 8;
+        return true;
+    }
+
+    bool get(uint32 type, fastring& v) {
+        const char* p;
+        size_t n;
+        if (type != kBytes || !this->bytes(&p, &n)) return false;
+        v.assign(p, n);
+        return true;
+    }
+
+    template <typename T>
+    bool get(uint32 type, co::vector<T>& v) {
+        T x;
+        if (!this->get(type, x)) return false;
+        v.push_back(std::move(x));
+        return true;
+    }
+
+    template <typename T>
+    bool get(uint32 type, T& v) {
+        const char* p;
+        size_t n;
+        if (type != kBytes || !this->bytes(&p, &n)) return false;
+        Reader r(p, n);
+        return v.decode(r);
+    }
+
+    // skip the value of an unknown field
+    bool skip(uint32 type) {
+        uint64 x;
+        const char* p;
+        size_t n;
+        switch (type) {
+          case kVarint:  return this->varint(&x);
+          case kBytes:   return this->bytes(&p, &n);
+          case kFixed64: return _e - _p >= 8 ? (_p += 8, true) : false;
+          case kFixed32: return _e - _p >= 4 ? (_p += 4, true) : false;
+          default:       return false;
+        }
+    }
+
+    bool varint(uint64* v) {
+        uint64 x = 0;
+        for (int s = 0; _p < _e && s < 64; s += 7) {
+            const uint8 c = (uint8)*_p++;
+            x |= (uint64)(c & 0x7f) << s;
+            if (c < 0x80) { *v = x; return true; }
+        }
+        return false;
+    }
+
+    bool bytes(const char** p, size_t* n) {
+        uint64 x;
+        if (!this->varint(&x) || x > (uint64)(_e - _p)) return false;
+        *p = _p;
+        *n = (size_t)x;
+        _p += x;
+        return true;
+    }
+
+  private:
+    const char* _p;
+    const char* _e;
+    bool _ok;
+};
+
+namespace xx {
+
+// conversions between fields of generated messages and Json, a message that can
+// be converted has to_json(Json&) and from_json(const Json&)
+template <typename T> Json json_value(const T& v);
+template <typename T> bool json_get(const Json& x, T& v);
+
+inline Json json_value(bool v) { return Json(v); }
+inline Json json_value(int32 v) { return Json(v); }
+inline Json json_value(uint32 v) { return Json(v); }
+inline Json json_value(int64 v) { return Json(v); }
+inline Json json_value(uint64 v) { return Json(v); }
+inline Json json_value(double v) { return Json(v); }
+inline Json json_value(const fastring& v) { return Json(v); }
+
+template <typename T>
+inline Json json_value(const co::vector<T>& v) {
+    Json a = json::array();
+    for (const T& x : v) a.push_back(json_value(x));
+    return a;
+}
+
+template <typename T>
+inline Json json_value(const T& v) {
+    Json o = json::object();
+    v.to_json(o);
+    return o;
+}
+
+inline bool json_get(const Json& x, bool& v) {
+    if (!x.is_bool()) return false;
+    v = x.as_bool();
+    return true;
+}
+
+template <typename T>
+inline bool json_int(const Json& x, T& v) {
+    if (!x.is_int()) return false;
+    v = (T)x.as_int64();
+    return true;
+}
+
+inline bool json_get(const Json& x, int32& v)  { return json_int(x, v); }
+inline bool json_get(const Json& x, uint32& v) { return json_int(x, v); }
+inline bool json_get(const Json& x, int64& v)  { return json_int(x, v); }
+inline bool json_get(const Json& x, uint64& v) { return json_int(x, v); }
+
+inline bool json_get(const Json& x, double& v) {
+    if (!x.is_double() && !x.is_int()) return false;
+    v = x.as_double();
+    return true;
+}
+
+inline bool json_get(const Json& x, fastring& v) {
+    if (!x.is_string()) return false;
+    v.assign(x.as_c_str(), x.string_size());
+    return true;
+}
+
+template <typename T>
+inline bool json_get(const Json& x, co::vector<T>& v) {
+    if (!x.is_array()) return false;
+    for (uint32 i = 0; i < x.array_size(); ++i) {
+        T e;
+        if (!json_get(x.get(i), e)) return false;
+        v.push_back(std::move(e));
+    }
+    return true;
+}
+
+template <typename T>
+inline bool json_get(const Json& x, T& v) {
+    return x.is_object() && v.from_json(x);
+}
+
+// add a field to @j
+template <typename T>
+inline void to_json(Json& j, const char* key, const T& v) {
+    j.add_member(key, json_value(v));
+}
+
+// get a field from @j, a missing field keeps its default value
+template <typename T>
+inline bool from_json(const Json& j, const char* key, T& v) {
+    const Json& x = j.get(key);
+    return x.is_null() || json_get(x, v);
+}
+
+} // xx
+
+/**
+ * id of a method for calls in the binary encoding
+ *   - It is computed from the full name of the method, "Service.method", and is
+ *     the same on all platforms. gen generates ids of methods with typed request
+ *     and response in Service::Id.
+ *   - A call by id saves the lookup by name on the server.
+ */
+inline uint32 method_id(const char* name) {
+    return (uint32) murmur_hash64(name, strlen(name), 0);
+}
+
 class Service {
   public:
     Service() = default;
@@ -14,8 +344,17 @@ class Service {
 
     typedef std::function<void(Json&, Json&)> Fun;
 
+    // a method that takes requests in the binary encoding, it decodes the request
+    // from @req and encodes the response to @res, or returns false if the request
+    // can not be decoded.
+    typedef std::function<bool(Reader& req, Writer& res)> BinFun;
+
     virtual const char* name() const = 0;
     virtual const co::map<const char*, Fun>& methods() const = 0;
+
+    // methods that also take the binary encoding, they are generated by gen for
+    // methods with typed request and response.
+    virtual const co::map<const char*, BinFun>* bin_methods() const { return 0; }
 };
 
 class __coapi Server {
@@ -39,6 +378,11 @@ class __coapi Server {
     /**
      * start the rpc server 
      *   - By default, key and ca are NULL, and ssl is disabled.
+     *   - Requests of a connection are processed one by one. If rpc_max_inflight
+     *     is not 0, requests with ids (see MuxClient) are processed concurrently,
+     *     each in its own coroutine in the scheduler of the connection, and at
+     *     most rpc_max_inflight of them at a time. Responses are sent in the
+     *     order they are done.
      * 
      * @param ip    server ip, either an ipv4 or ipv6 address.
      * @param port  server port
@@ -74,6 +418,32 @@ class __coapi Client {
     // perform a rpc request
     void call(const Json& req, Json& res);
 
+    /**
+     * perform a rpc request in the binary encoding
+     *   - Req and Res are messages generated by gen. The server replies in the
+     *     encoding of the request, so JSON and binary calls can be mixed on the
+     *     same connection.
+     *   - Servers before the binary encoding do not support it.
+     *
+     * @param api  name of the method, "Service.method".
+     *
+     * @return     true on success, false on any error, which is logged.
+     */
+    template <typename Req, typename Res>
+    bool call(const char* api, const Req& req, Res& res) {
+        return this->call_bin(this->buffer(api), req, res);
+    }
+
+    /**
+     * perform a rpc request in the binary encoding, the method is specified by
+     * its id, see method_id().
+     *   - Servers before method ids reply "api not found".
+     */
+    template <typename Req, typename Res>
+    bool call(uint32 method, const Req& req, Res& res) {
+        return this->call_bin(this->buffer(method), req, res);
+    }
+
     // send a heartbeat
     void ping();
 
@@ -81,6 +451,107 @@ class __coapi Client {
     void close();
 
   private:
+    // the buffer with the header and name of the method of a binary request
+    fastream& buffer(const char* api);
+
+    // the buffer with the header and id of the method of a binary request
+    fastream& buffer(uint32 method);
+
+    // send the binary request in the buffer, and receive the response into it
+    bool call();
+
+    template <typename Req, typename Res>
+    bool call_bin(fastream& s, const Req& req, Res& res) {
+        Writer w(s);
+        req.encode(w);
+        if (!this->call()) return false;
+        Reader r(s.data(), s.size());
+        res = Res();
+        return res.decode(r);
+    }
+
+    void* _p;
+};
+
+/**
+ * MuxClient multiplexes calls of many coroutines on one connection
+ *   - Each request carries an id, and the response is matched by the id, so the
+ *     server may send responses in any order. Calls do not wait for each other,
+ *     and requests queued by concurrent calls are sent in a batch.
+ *   - A reader and a writer coroutine run on the connection, in the scheduler
+ *     where the first call is made. The connection is made on the first call,
+ *     and made again by the next call after it is broken.
+ *   - It is coroutine-safe, and can be shared by coroutines in any scheduler,
+ *     or by non-coroutine threads. It MUST NOT be destroyed while calls are in
+ *     flight.
+ *   - Servers before request ids are not supported. The server processes the
+ *     requests concurrently if rpc_max_inflight is set there.
+ */
+class __coapi MuxClient {
+  public:
+    MuxClient(const char* ip, int port, bool use_ssl=false);
+
+    // close the connection
+    ~MuxClient();
+
+    MuxClient(const MuxClient&) = delete;
+    void operator=(const MuxClient&) = delete;
+
+    /**
+     * perform a rpc request in JSON
+     *
+     * @return  true on success, false on any error, which is logged.
+     */
+    bool call(const Json& req, Json& res);
+
+    /**
+     * perform a rpc request in the binary encoding, see Client::call().
+     */
+    template <typename Req, typename Res>
+    bool call(const char* api, const Req& req, Res& res) {
+        fastream s(128);
+        this->begin(s, api);
+        return this->call_bin(s, req, res);
+    }
+
+    /**
+     * perform a rpc request in the binary encoding, the method is specified by
+     * its id, see method_id().
+     */
+    template <typename Req, typename Res>
+    bool call(uint32 method, const Req& req, Res& res) {
+        fastream s(128);
+        this->begin(s, method);
+        return this->call_bin(s, req, res);
+    }
+
+    /**
+     * close the connection
+     *   - Calls in flight fail, and later calls fail at once. It waits until the
+     *     reader and writer coroutines exit.
+     */
+    void close();
+
+  private:
+    // reserve room for the header, and add name of the method of a binary request
+    void begin(fastream& s, const char* api);
+
+    // reserve room for the header, and add id of the method of a binary request
+    void begin(fastream& s, uint32 method);
+
+    // send the request in @s, and receive the body of the response into it
+    bool call(fastream& s, bool bin);
+
+    template <typename Req, typename Res>
+    bool call_bin(fastream& s, const Req& req, Res& res) {
+        Writer w(s);
+        req.encode(w);
+        if (!this->call(s, true)) return false;
+        Reader r(s.data(), s.size());
+        res = Res();
+        return res.decode(r);
+    }
+
     void* _p;
 };
 
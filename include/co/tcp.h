@@ -111,6 +111,22 @@ class __coapi Server final {
     // set a callback to call when the server exits
     Server& on_exit(std::function<void()>&& cb);
 
+    /**
+     * accept connections in every scheduler 
+     *   - It MUST be called before start(). 
+     *   - Each scheduler has its own listening socket with SO_REUSEPORT, and the 
+     *     kernel spreads new connections among them. A connection is handled in 
+     *     the scheduler that accepted it, instead of being passed round-robin. 
+     *   - It is supported on linux only, the server falls back to a single 
+     *     listening socket on other platforms. 
+     * 
+     * @param steer  if true, a connection is delivered to the socket of scheduler 
+     *               (cpu % sched_num), where cpu is the CPU that received it. It 
+     *               keeps connections on the CPU handling their packets, if 
+     *               scheduler i is pinned to CPU i (see co_sched_cpus). 
+     */
+    Server& reuse_port(bool steer=false);
+
     // return number of connections
     uint32 conn_num() const;
 
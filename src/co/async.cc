@@ -0,0 +1,170 @@
+#include "scheduler.h"
+#include "co/os.h"
+
+DEF_uint32(co_async_threads, 0, ">>#1 number of threads in the pool of co::async_run(), os::cpunum() if 0");
+
+namespace co {
+
+// a task in the queue of AsyncPool
+struct asyncx_t {
+    co::clink link;
+    void (*f)(void*);
+    void* arg;
+    Coroutine* co;  // the waiting coroutine, or NULL if the caller is a thread
+    SyncEvent* ev;  // for the waiting thread
+    int64 us;       // time the task was queued
+};
+
+class AsyncPoolImpl {
+  public:
+    explicit AsyncPoolImpl(uint32 n)
+        : _n(n > 0 ? n : (uint32)os::cpunum()), _started(false), _stop(false),
+          _queued(0), _max_queued(0), _busy(0), _done(0), _wait_us(0), _run_us(0) {
+        co::xx::cond_init(&_cond);
+    }
+
+    ~AsyncPoolImpl();
+
+    void submit(void (*f)(void*), void* arg);
+
+    AsyncPool::stats_t stats();
+
+  private:
+    void push(asyncx_t* x);
+    void loop();
+
+    ::Mutex _m;
+    co::xx::cond_t _cond;
+    co::clist _q;
+    co::vector<Thread*> _threads;
+    const uint32 _n;
+    bool _started;
+    bool _stop;
+    uint32 _queued;
+    uint32 _max_queued;
+    uint32 _busy;
+    uint64 _done;
+    uint64 _wait_us;
+    uint64 _run_us;
+};
+
+AsyncPoolImpl::~AsyncPoolImpl() {
+    {
+        ::MutexGuard g(_m);
+        _stop = true;
+        co::xx::cond_notify_all(&_cond);
+    }
+    for (size_t i = 0; i < _threads.size(); ++i) co::del(_threads[i]);
+    co::xx::cond_destroy(&_cond);
+}
+
+void AsyncPoolImpl::push(asyncx_t* x) {
+    x->us = now::us();
+    ::MutexGuard g(_m);
+    if (!_started) {
+        _started = true;
+        for (uint32 i = 0; i < _n; ++i) {
+            _threads.push_back(co::make<Thread>(&AsyncPoolImpl::loop, this));
+        }
+    }
+    _q.push_back(&x->link);
+    if (++_queued > _max_queued) _max_queued = _queued;
+    co::xx::cond_notify_one(&_cond);
+}
+
+void AsyncPoolImpl::loop() {
+    for (;;) {
+        asyncx_t* x;
+        {
+            ::MutexGuard g(_m);
+            while (_q.empty() && !_stop) co::xx::cond_wait(&_cond, _m.mutex());
+            if (_q.empty()) return; // stopped, and all tasks are done
+            x = (asyncx_t*) _q.front();
+            _q.erase(&x->link);
+            --_queued;
+            ++_busy;
+        }
+
+        const int64 t = now::us();
+        x->f(x->arg);
+        const int64 e = now::us();
+        {
+            ::MutexGuard g(_m);
+            --_busy;
+            ++_done;
+            _wait_us += t - x->us;
+            _run_us += e - t;
+        }
+
+        // x may be freed once the caller is woken up
+        if (x->co) {
+            Coroutine* co = x->co;
+            ((SchedulerImpl*)co->s)->add_ready_task(co);
+        } else {
+            x->ev->signal();
+        }
+    }
+}
+
+void AsyncPoolImpl::submit(void (*f)(void*), void* arg) {
+    auto s = gSched;
+    if (s) { /* in coroutine */
+        Coroutine* co = s->running();
+        if (co->s != s) co->s = s;
+        asyncx_t* x = co::make<asyncx_t>();
+        x->f = f;
+        x->arg = arg;
+        x->co = co;
+        this->push(x);
+        s->yield();
+        co::del(x);
+    } else { /* not in coroutine */
+        SyncEvent ev;
+        asyncx_t x;
+        x.f = f;
+        x.arg = arg;
+        x.co = 0;
+        x.ev = &ev;
+        this->push(&x);
+        ev.wait();
+    }
+}
+
+AsyncPool::stats_t AsyncPoolImpl::stats() {
+    AsyncPool::stats_t r;
+    ::MutexGuard g(_m);
+    r.threads = _n;
+    r.busy = _busy;
+    r.queued = _queued;
+    r.max_queued = _max_queued;
+    r.done = _done;
+    r.wait_us = _wait_us;
+    r.run_us = _run_us;
+    return r;
+}
+
+AsyncPool::AsyncPool(uint32 threads) {
+    _p = co::make<AsyncPoolImpl>(threads);
+}
+
+AsyncPool::~AsyncPool() {
+    if (_p) {
+        co::del((AsyncPoolImpl*)_p);
+        _p = 0;
+    }
+}
+
+void AsyncPool::submit(void (*f)(void*), void* arg) {
+    ((AsyncPoolImpl*)_p)->submit(f, arg);
+}
+
+AsyncPool::stats_t AsyncPool::stats() const {
+    return ((AsyncPoolImpl*)_p)->stats();
+}
+
+AsyncPool& async_pool() {
+    static auto p = co::static_new<AsyncPool>(FLG_co_async_threads);
+    return *p;
+}
+
+} // co
@@ -1,8 +1,17 @@
 #include "scheduler.h"
 #include "co/stl.h"
+#include <algorithm>
 
 namespace co {
 
+// a coroutine waiting for an event in co::select()
+struct sel_eventx {
+    co::clink link;
+    co::selectx_t* sel;
+    int idx;     // case index
+    bool queued; // whether it is in the waiting list
+};
+
 class EventImpl {
   public:
     EventImpl(bool manual_reset, bool signaled)
@@ -16,10 +25,23 @@ class EventImpl {
 
     void reset();
 
+    // take the signal if present, without waiting
+    bool try_wait();
+
+    // for co::select(), the following methods MUST be called with the lock held
+    ::Mutex& mutex() { return _mtx; }
+
+    // take the signal if present, otherwise put @e in the waiting list if not NULL
+    bool add_select(sel_eventx* e);
+
+    // remove @e from the waiting list, @selected is true if woken up by this event
+    void del_select(sel_eventx* e, bool selected);
+
   private:
     ::Mutex _mtx;
     co::xx::cond_t _cond;
     co::hash_set<co::waitx_t*> _co_wait;
+    co::clist _sel_wait; // coroutines waiting in co::select()
     union {
         uint64 _count;
         struct {
@@ -93,9 +115,22 @@ bool EventImpl::wait(uint32 ms) {
 
 void EventImpl::signal() {
     co::hash_set<co::waitx_t*> co_wait;
+    co::clist sel;
     {
         ::MutexGuard g(_mtx);
         if (!_co_wait.empty()) _co_wait.swap(co_wait);
+
+        // The selectx may be released once the coroutine is resumed by another 
+        // source, so coroutines in co::select() are checked with the lock held.
+        while (!_sel_wait.empty()) {
+            sel_eventx* e = (sel_eventx*) _sel_wait.front();
+            _sel_wait.erase(&e->link);
+            e->queued = false;
+            if (atomic_bool_cas(&e->sel->state, st_wait, st_ready, mo_relaxed, mo_relaxed)) {
+                e->sel->idx = e->idx;
+                sel.push_back(&e->link);
+            }
+        }
         if (!_signaled) {
             _signaled = true;
             if (_wait.nth > 0) {
@@ -116,6 +151,12 @@ void EventImpl::signal() {
             co::free(w, sizeof(*w));
         }
     }
+
+    for (co::clink* x = sel.front(); x;) {
+        co::Coroutine* co = ((sel_eventx*)x)->sel->co;
+        x = x->next;
+        ((SchedulerImpl*)(co->s))->add_ready_task(co);
+    }
 }
 
 inline void EventImpl::reset() {
@@ -123,6 +164,33 @@ inline void EventImpl::reset() {
     _signaled = false;
 }
 
+bool EventImpl::try_wait() {
+    ::MutexGuard g(_mtx);
+    return this->add_select(0);
+}
+
+bool EventImpl::add_select(sel_eventx* e) {
+    if (_signaled) {
+        if (!_manual_reset && _count == 0) _signaled = false;
+        return true;
+    }
+    if (e) {
+        ++_wait.nco;
+        e->queued = true;
+        _sel_wait.push_back(&e->link);
+    }
+    return false;
+}
+
+void EventImpl::del_select(sel_eventx* e, bool selected) {
+    --_wait.nco;
+    if (e->queued) {
+        _sel_wait.erase(&e->link);
+        e->queued = false;
+    }
+    if (selected && !_manual_reset && _count == 0) _signaled = false;
+}
+
 // memory: |4(refn)|4|EventImpl|
 Event::Event(bool manual_reset, bool signaled) {
     _p = (uint32*) co::alloc(sizeof(EventImpl) + 8);
@@ -406,20 +474,70 @@ size_t Pool::size() const {
 
 namespace xx {
 
+/**
+ * PipeImpl is a bounded MPMC queue of fixed-size blocks.
+ *   - Blocks are stored in a ring with a sequence number for each slot. The slot 
+ *     for position pos is free if its sequence is 2 * pos, and it is filled if 
+ *     the sequence is 2 * pos + 1. Readers and writers claim positions with CAS, so 
+ *     no lock is needed when the ring is neither empty nor full. 
+ * 
+ *   - A coroutine parks itself in a waiting list only when the ring is empty (for 
+ *     readers) or full (for writers). The number of waiters is checked after a 
+ *     successful read or write, and the lock is only taken when there are waiters. 
+ *     The notifier reads a block for the waiting reader, or writes the block of 
+ *     the waiting writer, before waking it up. If it fails, as other coroutines 
+ *     took the block or slot first, the woken coroutine will try again. 
+ * 
+ *   - A writer hands its block to a waiting reader directly with the lock held, 
+ *     without going through the ring, so a message to a parked reader costs no 
+ *     more than in a lock-based pipe. 
+ * 
+ *   - Small rings (less than kLockFreeCap blocks, Chan is 1 by default) are mostly 
+ *     empty or full, and coroutines park on nearly every message. The atomics of 
+ *     the lock-free protocol only add cost there, so all operations on them are 
+ *     done with the lock held, and positions are plain counters. 
+ * 
+ *   - Waiting coroutines remove their waitx from the list on timeout, and always 
+ *     release it by themselves, so waitx objects can be cached per thread.
+ * 
+ *   - If _op is not NULL, blocks are objects constructed in the slots by _op, and 
+ *     they are destroyed once moved out. Otherwise blocks are copied with memcpy.
+ * 
+ *   - close() sets the closed flag and wakes up all waiting coroutines with the 
+ *     lock held, and waiters check the flag with the lock held before parking, 
+ *     so no one will wait on a closed pipe.
+ */
 class PipeImpl {
   public:
-    PipeImpl(uint32 buf_size, uint32 blk_size, uint32 ms)
-        : _buf_size(buf_size), _blk_size(blk_size), 
-          _rx(0), _wx(0), _ms(ms), _full(false) {
-        _buf = (char*) co::alloc(_buf_size);
+    enum { kLockFreeCap = 64 };
+
+    PipeImpl(uint32 buf_size, uint32 blk_size, uint32 ms, Pipe::op_t op)
+        : _op(op), _blk_size(blk_size), _cap(buf_size / blk_size), _ms(ms), 
+          _locked(_cap < kLockFreeCap), _rx(0), _wx(0), _nr(0), _nw(0), _closed(false) {
+        assert(_cap > 0);
+        _mask = (_cap & (_cap - 1)) == 0 ? _cap - 1 : 0;
+        _buf = (char*) co::alloc(buf_size);
+        _seq = (uint64*) co::alloc(_cap * sizeof(uint64));
+        for (uint32 i = 0; i < _cap; ++i) _seq[i] = (uint64)i << 1;
     }
 
     ~PipeImpl() {
-        co::free(_buf, _buf_size);
+        if (_op) {
+            for (uint64 pos = _rx; pos != _wx; ++pos) {
+                _op(_buf + this->slot(pos) * _blk_size, 0, Pipe::op_destroy);
+            }
+        }
+        co::free(_seq, _cap * sizeof(uint64));
+        co::free(_buf, _cap * _blk_size);
     }
 
-    void read(void* p);
-    void write(const void* p);
+    bool read(void* p) { return this->read(p, _ms); }
+    bool read(void* p, uint32 ms);
+    bool write(const void* p, int o);
+    bool try_read(void* p);
+    bool try_write(const void* p, int o);
+    void close();
+    bool is_closed() const { return atomic_load(&_closed, mo_relaxed); }
 
     struct waitx {
         co::Coroutine* co;
@@ -427,162 +545,498 @@ class PipeImpl {
             int state;
             void* dummy;
         };
-        void* buf;
-        size_t len; // total length of the memory
+        co::clink link;
+        void* buf;     // the block to read or write
+        alignas(16) char data[64]; // for blocks on the shared stack, aligned as co::alloc()
+        int o;         // operation to move the block from or into buf
+        bool queued;   // whether it is in the waiting list
+        bool done;     // the block was read or written by the notifier
+        co::selectx_t* sel; // not NULL if waiting in co::select()
+        int idx;       // case index in co::select()
     };
 
-    waitx* create_waitx(co::Coroutine* co, void* buf) {
-        waitx* w;
-        const bool on_stack = gSched->on_stack(buf);
-        if (on_stack) {
-            w = (waitx*) co::alloc(sizeof(waitx) + _blk_size);
-            w->buf = (char*)w + sizeof(waitx);
-            w->len = sizeof(waitx) + _blk_size;
-        } else {
-            w = (waitx*) co::alloc(sizeof(waitx));
-            w->buf = buf;
-            w->len = sizeof(waitx);
+    // for co::select(), add_select() and del_select() MUST be called with the lock held
+    ::Mutex& mutex() { return _m; }
+
+    // read a block into @p, or put @w in the waiting list of readers.
+    // return 1 if a block was read, 2 if the pipe is closed and empty, otherwise 0.
+    int add_select(waitx* w, void* p);
+
+    void del_select(waitx* w) {
+        if (w->queued) {
+            _rq.erase(&w->link);
+            w->queued = false;
+            atomic_store(&_nr, _nr - 1, mo_relaxed);
         }
-        w->co = co;
-        w->state = st_wait;
-        return w;
+    }
+
+    // release the temporary block of @w, return true if the block was read into 
+    // @p by the notifier when the case is selected
+    bool end_select(waitx* w, void* p, bool selected);
+
+    // wake up a waiting writer, as a block has been read
+    void notify_writer() {
+        if (atomic_load(&_nw, mo_seq_cst) != 0) this->notify(_wq, _nw, false);
     }
 
   private:
-    ::Mutex _m;
-    co::deque<waitx*> _wq;
+    // read a block into @p, @o is op_move if p is uninitialized, otherwise op_assign
+    bool pop(void* p, int o);
+
+    // give the block @p to a waiting reader, return false if there is none
+    bool handoff(const void* p, int o);
+
+    // with the lock held, give the block @p to a waiting reader, and return the
+    // coroutine to wake up, or NULL if there is none
+    co::Coroutine* handoff_locked(const void* p, int o);
+
+    // with the lock held, read or write the block for a coroutine in the waiting
+    // list, and return the coroutine to wake up, or NULL if there is none
+    co::Coroutine* notify_locked(co::clist& q, uint32& n, bool rd);
+
+    // try_read() and try_write() on small rings, done with the lock held
+    bool read_locked(void* p);
+    bool write_locked(const void* p, int o);
+
+    // write a block from @p, @o is op_copy or op_move
+    bool push(const void* p, int o);
+
+    // wait until a block is read or written, return false on timeout or if closed.
+    // On small rings, it also wakes up a coroutine waiting on the other side.
+    bool wait(co::clist& q, uint32& n, void* p, bool rd, int o, uint32 ms);
+
+    // wake up a coroutine in the waiting list, @rd is true for readers
+    void notify(co::clist& q, uint32& n, bool rd);
+
+    // remove all coroutines from the waiting list, those to wake up are put in @l
+    void remove_all(co::clist& q, uint32& n, co::clist& l);
+
+    // change the state of the waiting coroutine to st_ready, with the lock held
+    bool wake(waitx* w) {
+        if (!w->sel) return atomic_bool_cas(&w->state, st_wait, st_ready, mo_relaxed, mo_relaxed);
+        if (!atomic_bool_cas(&w->sel->state, st_wait, st_ready, mo_relaxed, mo_relaxed)) return false;
+        w->sel->idx = w->idx;
+        return true;
+    }
+
+    void put(void* dst, const void* src, int o) {
+        _op ? _op(dst, (void*)src, o) : (void) memcpy(dst, src, _blk_size);
+    }
+
+    void destroy(void* p) {
+        if (_op) _op(p, 0, Pipe::op_destroy);
+    }
+
+    size_t slot(uint64 pos) const {
+        return (size_t)(_mask ? (pos & _mask) : (pos % _cap));
+    }
+
+  private:
+    Pipe::op_t _op;   // operations on blocks, NULL for trivially copyable types
     char* _buf;       // buffer
-    uint32 _buf_size; // buffer size
+    uint64* _seq;     // sequence of each slot
     uint32 _blk_size; // block size
-    uint32 _rx;       // read pos
-    uint32 _wx;       // write pos
+    uint32 _cap;      // max number of blocks
+    uint32 _mask;     // _cap - 1 if _cap is power of 2, otherwise 0
     uint32 _ms;       // timeout in milliseconds
-    bool _full;       // 0: not full, 1: full
+    bool _locked;     // the ring is small, operate on it with the lock held
+    char _pad0[64];   // avoid false sharing between readers and writers
+    uint64 _rx;       // read pos
+    char _pad1[64];
+    uint64 _wx;       // write pos
+    char _pad2[64];
+    uint32 _nr;       // number of waiting readers, modified with the lock held
+    uint32 _nw;       // number of waiting writers, modified with the lock held
+    bool _closed;     // modified with the lock held
+    ::Mutex _m;       // for the waiting lists
+    co::clist _rq;    // waiting readers
+    co::clist _wq;    // waiting writers
 };
 
-void PipeImpl::read(void* p) {
-    auto s = gSched;
-    CHECK(s) << "must be called in coroutine..";
+inline PipeImpl::waitx* waitx_of(co::clink* l) {
+    return (PipeImpl::waitx*) ((char*)l - offsetof(PipeImpl::waitx, link));
+}
 
-    _m.lock();
-    if (_rx != _wx) { /* buffer is neither empty nor full */
-        assert(!_full);
-        assert(_wq.empty());
-        memcpy(p, _buf + _rx, _blk_size);
-        _rx += _blk_size;
-        if (_rx == _buf_size) _rx = 0;
-        _m.unlock();
+// free list of waitx for the current thread, linked by link.next
+static __thread co::clink* g_free_waitx = 0;
 
-    } else {
-        if (!_full) { /* buffer is empty */
-            auto co = s->running();
-            waitx* w = this->create_waitx(co, p);
-            _wq.push_back(w);
-            _m.unlock();
+inline PipeImpl::waitx* alloc_waitx() {
+    co::clink* l = g_free_waitx;
+    if (l) {
+        g_free_waitx = l->next;
+        return waitx_of(l);
+    }
+    return (PipeImpl::waitx*) co::alloc(sizeof(PipeImpl::waitx));
+}
 
-            if (co->s != s) co->s = s;
-            co->waitx = (co::waitx_t*)w;
+inline void free_waitx(PipeImpl::waitx* w) {
+    w->link.next = g_free_waitx;
+    g_free_waitx = &w->link;
+}
 
-            if (_ms != (uint32)-1) s->add_timer(_ms);
-            s->yield();
+inline bool PipeImpl::pop(void* p, int o) {
+    if (_locked) {
+        if (_rx == _wx) return false;
+        char* const b = _buf + this->slot(_rx) * _blk_size;
+        this->put(p, b, o);
+        this->destroy(b);
+        ++_rx;
+        return true;
+    }
 
-            if (!s->timeout()) {
-                if (w->buf != p) memcpy(p, w->buf, _blk_size);
-                co::free(w, w->len);
-            }
+    uint64 pos = atomic_load(&_rx, mo_relaxed);
+    size_t i;
+    for (;;) {
+        i = this->slot(pos);
+        const int64 d = (int64)(atomic_load(&_seq[i], mo_seq_cst) - ((pos << 1) + 1));
+        if (d == 0) {
+            const uint64 x = atomic_compare_swap(&_rx, pos, pos + 1, mo_relaxed, mo_relaxed);
+            if (x == pos) break;
+            pos = x;
+        } else if (d < 0) {
+            return false; // empty
+        } else {
+            pos = atomic_load(&_rx, mo_relaxed);
+        }
+    }
 
-            co->waitx = 0;
+    char* const b = _buf + i * _blk_size;
+    this->put(p, b, o);
+    this->destroy(b);
+    // seq_cst, so that either we see the waiting writers, or they see the free slot
+    atomic_store(&_seq[i], (pos + _cap) << 1, mo_seq_cst);
+    return true;
+}
 
-        } else { /* buffer is full */
-            memcpy(p, _buf + _rx, _blk_size);
-            _rx += _blk_size;
-            if (_rx == _buf_size) _rx = 0;
+inline bool PipeImpl::push(const void* p, int o) {
+    if (_locked) {
+        if (_wx - _rx == _cap) return false;
+        this->put(_buf + this->slot(_wx) * _blk_size, p, o);
+        ++_wx;
+        return true;
+    }
 
-            while (!_wq.empty()) {
-                waitx* w = _wq.front(); // wait for write
-                _wq.pop_front();
+    uint64 pos = atomic_load(&_wx, mo_relaxed);
+    size_t i;
+    for (;;) {
+        i = this->slot(pos);
+        const int64 d = (int64)(atomic_load(&_seq[i], mo_seq_cst) - (pos << 1));
+        if (d == 0) {
+            const uint64 x = atomic_compare_swap(&_wx, pos, pos + 1, mo_relaxed, mo_relaxed);
+            if (x == pos) break;
+            pos = x;
+        } else if (d < 0) {
+            return false; // full
+        } else {
+            pos = atomic_load(&_wx, mo_relaxed);
+        }
+    }
 
-                // TODO: is mo_relaxed safe here?
-                if (atomic_bool_cas(&w->state, st_wait, st_ready, mo_relaxed, mo_relaxed)) {
-                    memcpy(_buf + _wx, w->buf, _blk_size);
-                    _wx += _blk_size;
-                    if (_wx == _buf_size) _wx = 0;
-                    _m.unlock();
+    this->put(_buf + i * _blk_size, p, o);
+    atomic_store(&_seq[i], (pos << 1) + 1, mo_seq_cst);
+    return true;
+}
 
-                    ((co::SchedulerImpl*) w->co->s)->add_ready_task(w->co);
-                    return;
+// The block of a waiting reader may be its own object, which can only be move 
+// assigned, so copies of objects go through the ring.
+co::Coroutine* PipeImpl::handoff_locked(const void* p, int o) {
+    if (_op && o == Pipe::op_copy) return 0;
+    while (!_rq.empty()) {
+        waitx* w = waitx_of(_rq.front());
+        _rq.erase(&w->link);
+        w->queued = false;
+        atomic_store(&_nr, _nr - 1, mo_relaxed);
+        if (this->wake(w)) {
+            this->put(w->buf, p, w->o == Pipe::op_assign ? Pipe::op_assign : o);
+            w->done = true;
+            return w->co;
+        }
+    }
+    return 0;
+}
 
-                } else { /* timeout */
-                    co::free(w, w->len);
-                }
-            }
+inline bool PipeImpl::handoff(const void* p, int o) {
+    if (atomic_load(&_nr, mo_seq_cst) == 0 || (_op && o == Pipe::op_copy)) return false;
 
-            _full = false;
-            _m.unlock();
-        }
+    co::Coroutine* co;
+    {
+        ::MutexGuard g(_m);
+        co = this->handoff_locked(p, o);
     }
+    if (!co) return false;
+    ((co::SchedulerImpl*) co->s)->add_ready_task(co);
+    return true;
 }
 
-void PipeImpl::write(const void* p) {
+bool PipeImpl::wait(co::clist& q, uint32& n, void* p, bool rd, int o, uint32 ms) {
     auto s = gSched;
-    CHECK(s) << "must be called in coroutine..";
+    co::Coroutine* co = 0;
+    waitx* w = 0; // created when the coroutine is going to be suspended
+    void* buf = p;
+    int bo = o;
+    int64 deadline = 0;
+
+    bool r = false;
+    co::Coroutine* next = 0; // the coroutine to wake up on a small ring
+    for (;;) {
+        {
+            ::MutexGuard g(_m);
+            if (_closed && !rd) break;
+            if (_locked) {
+                // the block is read or written here, pass it on to the other side
+                if (rd ? this->pop(p, o) : 
+                    (next = this->handoff_locked(buf, bo)) || this->push(buf, bo)) {
+                    if (!next) {
+                        next = rd ? this->notify_locked(_wq, _nw, false) : this->notify_locked(_rq, _nr, true);
+                    }
+                    r = true;
+                    break;
+                }
+                ++n;
+            } else {
+                atomic_inc(&n, mo_seq_cst);
+                if (rd ? this->pop(p, o) : this->push(buf, bo)) {
+                    atomic_store(&n, n - 1, mo_relaxed);
+                    r = true;
+                    break;
+                }
+            }
+            if (_closed) { /* closed and empty */
+                atomic_store(&n, n - 1, mo_relaxed);
+                break;
+            }
+            if (!w) {
+                co = s->running();
+                if (co->s != s) co->s = s;
+                w = alloc_waitx();
+                w->co = co;
+                w->sel = 0;
+                if (s->on_stack(p)) {
+                    // the shared stack will be saved when the coroutine is suspended
+                    buf = _blk_size <= sizeof(w->data) ? w->data : co::alloc(_blk_size);
+                    bo = Pipe::op_move; // from or into the temporary block
+                    if (!rd) this->put(buf, p, o);
+                }
+                w->buf = buf;
+                w->o = bo;
+            }
+            w->state = st_wait;
+            w->queued = true;
+            w->done = false;
+            q.push_back(&w->link);
+        }
 
-    _m.lock();
-    if (_rx != _wx) { /* buffer is neither empty nor full */
-        assert(!_full);
-        assert(_wq.empty());
-        memcpy(_buf + _wx, p, _blk_size);
-        _wx += _blk_size;
-        if (_wx == _buf_size) _wx = 0;
-        if (_rx == _wx) _full = true;
-        _m.unlock();
+        co->waitx = (co::waitx_t*)w;
+        if (ms != (uint32)-1) {
+            if (deadline == 0) {
+                deadline = now::ms() + ms;
+                s->add_timer(ms);
+            } else {
+                const int64 t = deadline - now::ms();
+                s->add_timer(t > 0 ? (uint32)t : 0);
+            }
+        }
+        s->yield();
+        co->waitx = 0;
 
-    } else {
-        if (!_full) { /* buffer is empty */
-            while (!_wq.empty()) {
-                waitx* w = _wq.front(); // wait for read
-                _wq.pop_front();
-
-                // TODO: is mo_relaxed safe here?
-                if (atomic_bool_cas(&w->state, st_wait, st_ready, mo_relaxed, mo_relaxed)) {
-                    _m.unlock();
-                    memcpy(w->buf, p, _blk_size);
-                    ((co::SchedulerImpl*) w->co->s)->add_ready_task(w->co);
-                    return;
-                } else { /* timeout */
-                    co::free(w, w->len);
-                }
+        if (s->timeout()) {
+            ::MutexGuard g(_m);
+            if (w->queued) {
+                q.erase(&w->link);
+                atomic_store(&n, n - 1, mo_relaxed);
             }
+            break;
+        }
 
-            memcpy(_buf + _wx, p, _blk_size);
-            _wx += _blk_size;
-            if (_wx == _buf_size) _wx = 0;
-            if (_rx == _wx) _full = true;
-            _m.unlock();
+        if (w->done) {
+            if (rd && buf != p) {
+                this->put(p, buf, o);
+                this->destroy(buf);
+            }
+            r = true;
+            break;
+        }
+        // woken up by close(), or other coroutines took the block or slot first
+    }
 
-        } else { /* buffer is full */
-            auto co = s->running();
-            waitx* w = this->create_waitx(co, (void*)p);
-            if (w->buf != p) memcpy(w->buf, p, _blk_size);
-            _wq.push_back(w);
-            _m.unlock();
+    if (next) ((co::SchedulerImpl*) next->s)->add_ready_task(next);
+    if (buf != p) {
+        if (!rd) {
+            // give the object back to the caller if it was not written
+            if (!r && o == Pipe::op_move) this->put(p, buf, Pipe::op_assign);
+            this->destroy(buf);
+        }
+        if (buf != w->data) co::free(buf, _blk_size);
+    }
+    if (w) free_waitx(w);
+    return r;
+}
 
-            if (co->s != s) co->s = s;
-            co->waitx = (co::waitx_t*)w;
+co::Coroutine* PipeImpl::notify_locked(co::clist& q, uint32& n, bool rd) {
+    // a reader may have been given a block by a writer, without freeing a slot
+    if (_locked && (rd ? _rx == _wx : _wx - _rx == _cap)) return 0;
+    while (!q.empty()) {
+        waitx* w = waitx_of(q.front());
+        q.erase(&w->link);
+        w->queued = false;
+        atomic_store(&n, n - 1, mo_relaxed);
+
+        // the coroutine may have timed out, or been woken up by another 
+        // source in co::select(), try the next one
+        if (this->wake(w)) {
+            w->done = rd ? this->pop(w->buf, w->o) : this->push(w->buf, w->o);
+            return w->co;
+        }
+    }
+    return 0;
+}
 
-            if (_ms != (uint32)-1) s->add_timer(_ms);
-            s->yield();
+void PipeImpl::notify(co::clist& q, uint32& n, bool rd) {
+    co::Coroutine* co;
+    {
+        ::MutexGuard g(_m);
+        co = this->notify_locked(q, n, rd);
+    }
+    if (co) ((co::SchedulerImpl*) co->s)->add_ready_task(co);
+}
+
+void PipeImpl::remove_all(co::clist& q, uint32& n, co::clist& l) {
+    while (!q.empty()) {
+        waitx* w = waitx_of(q.front());
+        q.erase(&w->link);
+        w->queued = false;
+        atomic_store(&n, n - 1, mo_relaxed);
+        if (this->wake(w)) {
+            l.push_back(&w->link);
+        }
+    }
+}
+
+int PipeImpl::add_select(waitx* w, void* p) {
+    _locked ? (void) ++_nr : (void) atomic_inc(&_nr, mo_seq_cst);
+    if (this->pop(p, Pipe::op_assign)) {
+        atomic_store(&_nr, _nr - 1, mo_relaxed);
+        return 1;
+    }
+    if (_closed) {
+        atomic_store(&_nr, _nr - 1, mo_relaxed);
+        return 2;
+    }
 
-            if (!s->timeout()) co::free(w, w->len);
-            co->waitx = 0;
+    w->buf = p;
+    w->o = Pipe::op_assign;
+    if (gSched->on_stack(p)) {
+        w->buf = _blk_size <= sizeof(w->data) ? w->data : co::alloc(_blk_size);
+        w->o = Pipe::op_move;
+    }
+    w->state = st_wait;
+    w->queued = true;
+    w->done = false;
+    _rq.push_back(&w->link);
+    return 0;
+}
+
+bool PipeImpl::end_select(waitx* w, void* p, bool selected) {
+    const bool r = selected && w->done;
+    if (w->buf != p) {
+        if (r) {
+            this->put(p, w->buf, Pipe::op_assign);
+            this->destroy(w->buf);
         }
+        if (w->buf != w->data) co::free(w->buf, _blk_size);
+        w->buf = p;
+    }
+    return r;
+}
+
+// A block read from a full ring is replaced by the block of a waiting writer, 
+// and a block written to an empty ring is given to a waiting reader, both in the
+// same critical section, as in a lock-based pipe. Blocking operations on small 
+// rings go to wait() directly, which does the same.
+bool PipeImpl::read_locked(void* p) {
+    co::Coroutine* co = 0;
+    bool r;
+    {
+        ::MutexGuard g(_m);
+        r = this->pop(p, Pipe::op_assign);
+        if (r) co = this->notify_locked(_wq, _nw, false);
+    }
+    if (co) ((co::SchedulerImpl*) co->s)->add_ready_task(co);
+    return r;
+}
+
+bool PipeImpl::write_locked(const void* p, int o) {
+    co::Coroutine* co = 0;
+    bool r;
+    {
+        ::MutexGuard g(_m);
+        if (_closed) return false;
+        co = this->handoff_locked(p, o);
+        r = co || this->push(p, o);
+        if (r && !co) co = this->notify_locked(_rq, _nr, true);
+    }
+    if (co) ((co::SchedulerImpl*) co->s)->add_ready_task(co);
+    return r;
+}
+
+bool PipeImpl::read(void* p, uint32 ms) {
+    CHECK(gSched) << "must be called in coroutine..";
+    if (_locked) return this->wait(_rq, _nr, p, true, Pipe::op_assign, ms);
+    if (!this->pop(p, Pipe::op_assign) && !this->wait(_rq, _nr, p, true, Pipe::op_assign, ms)) {
+        return false;
+    }
+    this->notify_writer();
+    return true;
+}
+
+bool PipeImpl::write(const void* p, int o) {
+    CHECK(gSched) << "must be called in coroutine..";
+    if (_locked) return this->wait(_wq, _nw, (void*)p, false, o, _ms);
+    if (this->is_closed()) return false;
+    if (this->handoff(p, o)) return true;
+    if (!this->push(p, o) && !this->wait(_wq, _nw, (void*)p, false, o, _ms)) return false;
+    if (atomic_load(&_nr, mo_seq_cst) != 0) this->notify(_rq, _nr, true);
+    return true;
+}
+
+bool PipeImpl::try_read(void* p) {
+    if (_locked) return this->read_locked(p);
+    if (!this->pop(p, Pipe::op_assign)) return false;
+    this->notify_writer();
+    return true;
+}
+
+bool PipeImpl::try_write(const void* p, int o) {
+    if (_locked) return this->write_locked(p, o);
+    if (this->is_closed()) return false;
+    if (this->handoff(p, o)) return true;
+    if (!this->push(p, o)) return false;
+    if (atomic_load(&_nr, mo_seq_cst) != 0) this->notify(_rq, _nr, true);
+    return true;
+}
+
+void PipeImpl::close() {
+    co::clist l;
+    {
+        ::MutexGuard g(_m);
+        if (_closed) return;
+        atomic_store(&_closed, true, mo_relaxed);
+        this->remove_all(_rq, _nr, l);
+        this->remove_all(_wq, _nw, l);
+    }
+
+    // the waitx may be released once the coroutine is resumed
+    for (co::clink* x = l.front(); x;) {
+        co::Coroutine* co = waitx_of(x)->co;
+        x = x->next;
+        ((co::SchedulerImpl*) co->s)->add_ready_task(co);
     }
 }
 
-Pipe::Pipe(uint32 buf_size, uint32 blk_size, uint32 ms) {
+Pipe::Pipe(uint32 buf_size, uint32 blk_size, uint32 ms, op_t op) {
     _p = (uint32*) co::alloc(sizeof(PipeImpl) + 8);
     _p[0] = 1;
-    new (_p + 2) PipeImpl(buf_size, blk_size, ms);
+    new (_p + 2) PipeImpl(buf_size, blk_size, ms, op);
 }
 
 Pipe::~Pipe() {
@@ -592,14 +1046,228 @@ Pipe::~Pipe() {
     }
 }
 
-void Pipe::read(void* p) const {
-    ((PipeImpl*)(_p + 2))->read(p);
+bool Pipe::read(void* p) const {
+    return ((PipeImpl*)(_p + 2))->read(p);
+}
+
+bool Pipe::read(void* p, uint32 ms) const {
+    return ((PipeImpl*)(_p + 2))->read(p, ms);
+}
+
+bool Pipe::write(const void* p, int o) const {
+    return ((PipeImpl*)(_p + 2))->write(p, o);
 }
 
-void Pipe::write(const void* p) const {
-    ((PipeImpl*)(_p + 2))->write(p);
+bool Pipe::try_read(void* p) const {
+    return ((PipeImpl*)(_p + 2))->try_read(p);
+}
+
+bool Pipe::try_write(const void* p, int o) const {
+    return ((PipeImpl*)(_p + 2))->try_write(p, o);
+}
+
+void Pipe::close() const {
+    ((PipeImpl*)(_p + 2))->close();
+}
+
+bool Pipe::is_closed() const {
+    return ((PipeImpl*)(_p + 2))->is_closed();
 }
 
 } // xx
 
+class SelectImpl {
+  public:
+    SelectImpl() : _sorted(true) {}
+    ~SelectImpl();
+
+    void add_recv(xx::PipeImpl* p, void* x, bool* ok);
+    void add_event(EventImpl* e);
+    int select(uint32 ms);
+
+  private:
+    struct Case {
+        xx::PipeImpl* pipe;       // NULL for events
+        EventImpl* ev;
+        void* buf;                // where to read the element
+        bool* ok;
+        xx::PipeImpl::waitx* w;   // for channels
+        sel_eventx* e;            // for events
+    };
+
+    // register the coroutine on the source of _cases[i], return 1 if the case
+    // is ready (2 if the channel is closed and empty), otherwise 0
+    int add(size_t i) {
+        Case& c = _cases[i];
+        if (c.pipe) return c.pipe->add_select(c.w, c.buf);
+        return c.ev->add_select(c.e) ? 1 : 0;
+    }
+
+    void del(size_t i, bool selected) {
+        Case& c = _cases[i];
+        c.pipe ? c.pipe->del_select(c.w) : c.ev->del_select(c.e, selected);
+    }
+
+    // lock all the sources in the order of address, so that coroutines 
+    // selecting on the same sources will not deadlock
+    void lock() {
+        if (!_sorted) {
+            ::Mutex** const p = _locks.data();
+            std::sort(p, p + _locks.size());
+            _locks.resize(std::unique(p, p + _locks.size()) - p);
+            _sorted = true;
+        }
+        for (size_t i = 0; i < _locks.size(); ++i) _locks[i]->lock();
+    }
+
+    void unlock() {
+        for (size_t i = _locks.size(); i > 0; --i) _locks[i - 1]->unlock();
+    }
+
+  private:
+    co::array<Case> _cases;
+    co::array<::Mutex*> _locks;
+    co::selectx_t _x;
+    bool _sorted;
+};
+
+SelectImpl::~SelectImpl() {
+    for (size_t i = 0; i < _cases.size(); ++i) {
+        Case& c = _cases[i];
+        c.w ? co::free(c.w, sizeof(*c.w)) : co::free(c.e, sizeof(*c.e));
+    }
+}
+
+void SelectImpl::add_recv(xx::PipeImpl* p, void* x, bool* ok) {
+    auto w = (xx::PipeImpl::waitx*) co::alloc(sizeof(xx::PipeImpl::waitx));
+    w->sel = &_x;
+    w->idx = (int)_cases.size();
+    w->queued = false;
+    _cases.push_back(Case{ p, 0, x, ok, w, 0 });
+    _locks.push_back(&p->mutex());
+    _sorted = false;
+}
+
+void SelectImpl::add_event(EventImpl* ev) {
+    auto e = (sel_eventx*) co::alloc(sizeof(sel_eventx));
+    e->sel = &_x;
+    e->idx = (int)_cases.size();
+    e->queued = false;
+    _cases.push_back(Case{ 0, ev, 0, 0, 0, e });
+    _locks.push_back(&ev->mutex());
+    _sorted = false;
+}
+
+int SelectImpl::select(uint32 ms) {
+    auto s = gSched;
+    CHECK(s) << "must be called in coroutine..";
+    const size_t n = _cases.size();
+
+    // check the cases in order without waiting first
+    for (size_t i = 0; i < n; ++i) {
+        Case& c = _cases[i];
+        if (c.pipe) {
+            if (c.pipe->try_read(c.buf)) {
+                if (c.ok) *c.ok = true;
+                return (int)i;
+            }
+            if (c.pipe->is_closed()) {
+                // elements written before close() can still be read
+                const bool r = c.pipe->try_read(c.buf);
+                if (c.ok) *c.ok = r;
+                return (int)i;
+            }
+        } else if (c.ev->try_wait()) {
+            return (int)i;
+        }
+    }
+    if (ms == 0 || n == 0) return -1;
+
+    auto co = s->running();
+    if (co->s != s) co->s = s;
+    _x.co = co;
+    for (size_t i = 0; i < n; ++i) {
+        if (_cases[i].w) _cases[i].w->co = co;
+    }
+
+    const int64 deadline = ms != (uint32)-1 ? now::ms() + ms : 0;
+    for (;;) {
+        size_t k = 0;
+        int r = 0;
+        this->lock();
+        _x.state = st_wait;
+        _x.idx = -1;
+        for (; k < n; ++k) {
+            if ((r = this->add(k)) != 0) break;
+        }
+        if (k < n) { /* ready */
+            for (size_t i = 0; i < k; ++i) this->del(i, false);
+            this->unlock();
+            for (size_t i = 0; i < k; ++i) {
+                if (_cases[i].pipe) _cases[i].pipe->end_select(_cases[i].w, _cases[i].buf, false);
+            }
+            Case& c = _cases[k];
+            if (c.pipe) {
+                if (c.ok) *c.ok = r == 1;
+                if (r == 1) c.pipe->notify_writer();
+            }
+            return (int)k;
+        }
+        this->unlock();
+
+        co->waitx = (co::waitx_t*)&_x;
+        if (ms != (uint32)-1) {
+            const int64 t = deadline - now::ms();
+            s->add_timer(t > 0 ? (uint32)t : 0);
+        }
+        s->yield();
+        co->waitx = 0;
+
+        const int x = s->timeout() ? -1 : _x.idx;
+        this->lock();
+        for (size_t i = 0; i < n; ++i) this->del(i, (int)i == x);
+        this->unlock();
+
+        bool done = false;
+        for (size_t i = 0; i < n; ++i) {
+            Case& c = _cases[i];
+            if (c.pipe && c.pipe->end_select(c.w, c.buf, (int)i == x)) done = true;
+        }
+        if (x < 0) return -1;
+
+        Case& c = _cases[x];
+        if (!c.pipe) return x;
+        if (done) {
+            if (c.ok) *c.ok = true;
+            c.pipe->notify_writer();
+            return x;
+        }
+        // woken up by close(), or other readers took the block first, try again
+    }
+}
+
+Select::Select() {
+    _p = co::make<SelectImpl>();
+}
+
+Select::~Select() {
+    if (_p) {
+        co::del((SelectImpl*)_p);
+        _p = 0;
+    }
+}
+
+void Select::add_recv(const xx::Pipe& p, void* x, bool* ok) {
+    ((SelectImpl*)_p)->add_recv((xx::PipeImpl*)(p._p + 2), x, ok);
+}
+
+Select& Select::event(const Event& ev) {
+    ((SelectImpl*)_p)->add_event((EventImpl*)(ev._p + 2));
+    return *this;
+}
+
+int Select::select(uint32 ms) const {
+    return ((SelectImpl*)_p)->select(ms);
+}
+
 } // co
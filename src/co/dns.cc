@@ -0,0 +1,803 @@
+#ifndef _WIN32
+#include "scheduler.h"
+#include "co/fs.h"
+#include "co/str.h"
+#include "co/lru_map.h"
+#include "co/hash/murmur_hash.h"
+#include <fcntl.h>
+#ifdef __linux__
+#include <sys/random.h>
+#endif
+
+DEF_string(co_dns_servers, "", ">>#1 DNS servers of the coroutine resolver separated by commas, e.g. 8.8.8.8,[::1]:5353, nameservers in resolv.conf are used if empty");
+DEF_string(co_dns_resolv_conf, "/etc/resolv.conf", ">>#1 path of resolv.conf for the coroutine resolver");
+DEF_string(co_dns_hosts, "/etc/hosts", ">>#1 path of the hosts file for the coroutine resolver");
+DEF_uint32(co_dns_cache_size, 4096, ">>#1 max number of entries in the cache of the coroutine resolver, 0 to disable the cache");
+
+namespace co {
+namespace dns {
+namespace xx {
+
+enum {
+    t_a = 1,
+    t_soa = 6,
+    t_ptr = 12,
+    t_aaaa = 28,
+};
+
+// returned by parse_response() if the TC bit is set, the query is sent again over TCP
+static const int k_truncated = 16;
+
+// TTL in seconds for failed lookups without a SOA record
+static const uint32 k_neg_ttl = 30;
+
+// resolv.conf and the hosts file are checked for changes at this interval
+static const int64 k_check_ms = 5000;
+
+union sa_t {
+    struct sockaddr sa;
+    struct sockaddr_in v4;
+    struct sockaddr_in6 v6;
+};
+
+struct Conf {
+    Conf() : ndots(1), timeout(5000), attempts(2), conf_mtime(-1), hosts_mtime(-1) {}
+    co::vector<sa_t> servers;
+    co::vector<fastring> search;
+    uint32 ndots;
+    uint32 timeout;  // timeout in ms for a server to respond
+    uint32 attempts; // times to try all the servers
+    co::hash_map<fastring, co::vector<addr_t>> hosts;
+    co::hash_map<fastring, fastring> names; // address bytes -> the first name in the hosts file
+    int64 conf_mtime;
+    int64 hosts_mtime;
+};
+
+// a positive or negative entry in the cache
+struct Entry {
+    co::vector<addr_t> addrs;
+    fastring name; // for PTR records
+    int64 expire;  // in ms
+    int err;
+};
+
+inline int addr_size(int family) {
+    return family == AF_INET ? 4 : 16;
+}
+
+// parse an IPv4 or IPv6 literal
+inline bool parse_ip(const char* s, addr_t* a) {
+    if (inet_pton(AF_INET, s, &a->v4) == 1) { a->family = AF_INET; return true; }
+    if (inet_pton(AF_INET6, s, &a->v6) == 1) { a->family = AF_INET6; return true; }
+    return false;
+}
+
+// ip, ip:port, or [ip]:port for IPv6
+bool parse_server(const fastring& s, sa_t* x) {
+    fastring ip(s);
+    uint16 port = 53;
+    if (s.starts_with('[')) {
+        const size_t p = s.find(']');
+        if (p == s.npos) return false;
+        ip = s.substr(1, p - 1);
+        if (p + 1 < s.size()) {
+            if (s[p + 1] != ':') return false;
+            port = (uint16) atoi(s.c_str() + p + 2);
+        }
+    } else {
+        const size_t p = s.find(':');
+        if (p != s.npos && s.find(':', p + 1) == s.npos) {
+            ip = s.substr(0, p);
+            port = (uint16) atoi(s.c_str() + p + 1);
+        }
+    }
+
+    const size_t p = ip.find('%'); // drop the zone of link-local IPv6 addresses
+    if (p != ip.npos) ip.resize(p);
+
+    addr_t a;
+    if (port == 0 || !parse_ip(ip.c_str(), &a)) return false;
+    memset(x, 0, sizeof(*x));
+    if (a.family == AF_INET) {
+        x->v4.sin_family = AF_INET;
+        x->v4.sin_port = htons(port);
+        x->v4.sin_addr = a.v4;
+    } else {
+        x->v6.sin6_family = AF_INET6;
+        x->v6.sin6_port = htons(port);
+        x->v6.sin6_addr = a.v6;
+    }
+    return true;
+}
+
+// split a line by blanks
+co::vector<fastring> fields(fastring& line) {
+    const size_t p = line.find('#');
+    if (p != line.npos) line.resize(p);
+    for (size_t i = 0; i < line.size(); ++i) {
+        if (line[i] == '\t' || line[i] == '\r') line[i] = ' ';
+    }
+
+    co::vector<fastring> v = str::split(line, ' ');
+    size_t k = 0;
+    for (size_t i = 0; i < v.size(); ++i) {
+        if (!v[i].empty()) { if (k != i) v[k] = std::move(v[i]); ++k; }
+    }
+    v.resize(k);
+    return v;
+}
+
+co::vector<fastring> read_lines(const fastring& path) {
+    fs::file f(path, 'r');
+    if (!f) return co::vector<fastring>();
+    fastring s = f.read((size_t)f.size());
+    return str::split(s, '\n');
+}
+
+void load_resolv_conf(Conf* c) {
+    auto lines = read_lines(FLG_co_dns_resolv_conf);
+    for (size_t i = 0; i < lines.size(); ++i) {
+        auto v = fields(lines[i]);
+        if (v.size() < 2) continue;
+        if (v[0] == "nameserver") {
+            sa_t a;
+            if (FLG_co_dns_servers.empty() && parse_server(v[1], &a)) c->servers.push_back(a);
+        } else if (v[0] == "search" || v[0] == "domain") {
+            c->search.clear();
+            for (size_t k = 1; k < v.size(); ++k) {
+                v[k].tolower().strip('.', 'r');
+                if (!v[k].empty()) c->search.push_back(std::move(v[k]));
+            }
+        } else if (v[0] == "options") {
+            for (size_t k = 1; k < v.size(); ++k) {
+                const fastring& o = v[k];
+                if (o.starts_with("ndots:")) {
+                    c->ndots = str::to_uint32(o.c_str() + 6);
+                } else if (o.starts_with("timeout:")) {
+                    const uint32 n = str::to_uint32(o.c_str() + 8);
+                    c->timeout = (n > 0 ? n : 1) * 1000;
+                } else if (o.starts_with("attempts:")) {
+                    const uint32 n = str::to_uint32(o.c_str() + 9);
+                    c->attempts = n > 0 ? n : 1;
+                }
+            }
+        }
+    }
+
+    if (!FLG_co_dns_servers.empty()) {
+        auto v = str::split(FLG_co_dns_servers, ',');
+        for (size_t i = 0; i < v.size(); ++i) {
+            sa_t a;
+            if (parse_server(str::strip(v[i]), &a)) c->servers.push_back(a);
+        }
+    }
+    if (c->servers.empty()) {
+        sa_t a;
+        parse_server("127.0.0.1", &a);
+        c->servers.push_back(a);
+    }
+}
+
+void load_hosts(Conf* c) {
+    auto lines = read_lines(FLG_co_dns_hosts);
+    for (size_t i = 0; i < lines.size(); ++i) {
+        auto v = fields(lines[i]);
+        addr_t a;
+        if (v.size() < 2 || !parse_ip(v[0].c_str(), &a)) continue;
+        fastring key((const char*)&a.v6, addr_size(a.family));
+        if (c->names.find(key) == c->names.end()) c->names[key] = v[1];
+        for (size_t k = 1; k < v.size(); ++k) {
+            c->hosts[v[k].tolower()].push_back(a);
+        }
+    }
+}
+
+class Cache {
+  public:
+    enum { N = 16 };
+
+    Cache() = default;
+
+    // return true if found, the addresses will be appended to @res
+    bool get(const fastring& key, co::vector<addr_t>& res, int* err, fastring* name=0);
+
+    void put(const fastring& key, const co::vector<addr_t>& addrs, uint32 ttl, int err, const fastring& name=fastring());
+
+    void clear() {
+        for (int i = 0; i < N; ++i) {
+            ::MutexGuard g(_s[i].m);
+            _s[i].map.clear();
+        }
+    }
+
+  private:
+    struct Shard {
+        Shard() : map(FLG_co_dns_cache_size / N + 1) {}
+        ::Mutex m;
+        LruMap<fastring, Entry> map; // the least recently used entry is evicted when full
+    };
+
+    Shard& shard(const fastring& key) {
+        return _s[murmur_hash(key.data(), key.size()) & (N - 1)];
+    }
+
+    Shard _s[N];
+};
+
+bool Cache::get(const fastring& key, co::vector<addr_t>& res, int* err, fastring* name) {
+    if (FLG_co_dns_cache_size == 0) return false;
+    Shard& s = this->shard(key);
+    ::MutexGuard g(s.m);
+    auto it = s.map.find(key);
+    if (it == s.map.end()) return false;
+    if (it->second.expire <= now::ms()) {
+        s.map.erase(it);
+        return false;
+    }
+    const auto& a = it->second.addrs;
+    for (size_t i = 0; i < a.size(); ++i) res.push_back(a[i]);
+    if (name) *name = it->second.name;
+    *err = it->second.err;
+    return true;
+}
+
+void Cache::put(const fastring& key, const co::vector<addr_t>& addrs, uint32 ttl, int err, const fastring& name) {
+    if (FLG_co_dns_cache_size == 0 || ttl == 0) return;
+    Shard& s = this->shard(key);
+    Entry e;
+    e.addrs = addrs;
+    e.name = name;
+    e.expire = now::ms() + ttl * 1000LL;
+    e.err = err;
+
+    ::MutexGuard g(s.m);
+    s.map.erase(key);
+    s.map.insert(key, std::move(e));
+}
+
+class Resolver {
+  public:
+    Resolver() : _check_ms(0) {}
+
+    // get the current configuration, reload it if the files have been changed
+    co::shared_ptr<Conf> conf();
+
+    void clear() {
+        {
+            ::MutexGuard g(_m);
+            _conf.reset();
+            _check_ms = 0;
+        }
+        _cache.clear();
+    }
+
+    Cache& cache() { return _cache; }
+
+  private:
+    ::Mutex _m;
+    int64 _check_ms;
+    co::shared_ptr<Conf> _conf;
+    Cache _cache;
+};
+
+co::shared_ptr<Conf> Resolver::conf() {
+    ::MutexGuard g(_m);
+    const int64 now_ms = now::ms();
+    if (!_conf || now_ms >= _check_ms) {
+        _check_ms = now_ms + k_check_ms;
+        const int64 a = fs::mtime(FLG_co_dns_resolv_conf);
+        const int64 b = fs::mtime(FLG_co_dns_hosts);
+        if (!_conf || a != _conf->conf_mtime || b != _conf->hosts_mtime) {
+            Conf* c = co::make<Conf>();
+            c->conf_mtime = a;
+            c->hosts_mtime = b;
+            load_resolv_conf(c);
+            load_hosts(c);
+            if (_conf) _cache.clear();
+            _conf.reset(c);
+        }
+    }
+    return _conf;
+}
+
+inline Resolver& resolver() {
+    static auto r = co::static_new<Resolver>();
+    return *r;
+}
+
+// fill @p with @n random bytes from the OS
+static void os_random(void* p, size_t n) {
+  #ifdef __APPLE__
+    arc4random_buf(p, n);
+  #else
+    char* s = (char*)p;
+    while (n > 0) {
+        const ssize_t r = getrandom(s, n, 0);
+        if (r > 0) { s += r; n -= r; continue; }
+        if (r < 0 && errno == EINTR) continue;
+        break;
+    }
+    if (n == 0) return;
+
+    // getrandom() is not supported by the kernel
+    const int fd = ::open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    CHECK(fd >= 0) << "open /dev/urandom failed: " << co::strerror();
+    while (n > 0) {
+        const ssize_t r = ::read(fd, s, n);
+        if (r > 0) { s += r; n -= r; continue; }
+        CHECK(r < 0 && errno == EINTR) << "read /dev/urandom failed: " << co::strerror();
+    }
+    ::close(fd);
+  #endif
+}
+
+// random ids fetched from the OS in batches
+struct IdPool {
+    uint16 ids[64];
+    uint32 n;
+};
+
+static __thread IdPool g_ids;
+
+// Transaction ids must not be predictable, or an off-path attacker may forge 
+// responses to poison the cache. They are taken from the CSPRNG of the OS.
+inline uint16 query_id() {
+    IdPool& p = g_ids;
+    if (p.n == 0) {
+        os_random(p.ids, sizeof(p.ids));
+        p.n = sizeof(p.ids) / sizeof(p.ids[0]);
+    }
+    return p.ids[--p.n];
+}
+
+inline void put16(char*& p, uint16 v) {
+    *p++ = (char)(v >> 8);
+    *p++ = (char)v;
+}
+
+inline uint16 get16(const uint8* p) {
+    return (uint16)((p[0] << 8) | p[1]);
+}
+
+inline uint32 get32(const uint8* p) {
+    return ((uint32)p[0] << 24) | ((uint32)p[1] << 16) | ((uint32)p[2] << 8) | p[3];
+}
+
+// build a query in @buf (at least 512 bytes), return its size, or 0 if the name is invalid
+int make_query(char* buf, uint16 id, const fastring& name, int qtype) {
+    char* p = buf;
+    put16(p, id);
+    put16(p, 0x0100); // recursion desired
+    put16(p, 1);      // qdcount
+    put16(p, 0);
+    put16(p, 0);
+    put16(p, 0);
+
+    size_t b = 0;
+    while (b < name.size()) {
+        size_t e = name.find('.', b);
+        if (e == name.npos) e = name.size();
+        const size_t n = e - b;
+        if (n == 0 || n > 63) return 0;
+        *p++ = (char)n;
+        memcpy(p, name.data() + b, n);
+        p += n;
+        b = e + 1;
+    }
+    *p++ = 0;
+    if (p - buf - 12 > 255) return 0;
+    put16(p, (uint16)qtype);
+    put16(p, 1); // class IN
+    return (int)(p - buf);
+}
+
+// skip a name at @i, return position after the name, or -1 if it is invalid
+int skip_name(const uint8* p, int n, int i) {
+    for (int k = 0; i < n && k < 128; ++k) {
+        const uint8 c = p[i];
+        if (c == 0) return i + 1;
+        if ((c & 0xc0) == 0xc0) return i + 2 <= n ? i + 2 : -1;
+        if (c & 0xc0) return -1;
+        i += c + 1;
+    }
+    return -1;
+}
+
+// read a name at @i to @s, compression pointers are followed, return false if it is invalid
+bool read_name(const uint8* p, int n, int i, fastring& s) {
+    for (int k = 0; i < n && k < 128; ++k) {
+        const uint8 c = p[i];
+        if (c == 0) return !s.empty();
+        if ((c & 0xc0) == 0xc0) {
+            if (i + 2 > n) return false;
+            i = ((c & 0x3f) << 8) | p[i + 1];
+            continue;
+        }
+        if ((c & 0xc0) || i + 1 + c > n) return false;
+        if (!s.empty()) s.append('.');
+        s.append((const char*)p + i + 1, c);
+        i += c + 1;
+    }
+    return false;
+}
+
+/**
+ * parse the response to a query
+ *
+ * @param q    the query.
+ * @param qn   size of the query.
+ * @param res  addresses in the answer section will be appended to it.
+ * @param name the first name in the answer section, for PTR queries.
+ * @param ttl  min TTL of the records, or the negative TTL from the SOA record.
+ *
+ * @return     -1 if it is not a response to the query, otherwise the rcode, or
+ *             k_truncated if the response was truncated (the TC bit is set).
+ */
+int parse_response(
+    const uint8* p, int n, const uint8* q, int qn, int qtype,
+    co::vector<addr_t>& res, fastring& name, uint32* ttl)
+{
+    if (n < qn || p[0] != q[0] || p[1] != q[1]) return -1;
+    const uint16 flags = get16(p + 2);
+    if (!(flags & 0x8000) || ((flags >> 11) & 15) != 0 || get16(p + 4) != 1) return -1;
+
+    // the question section must be the same as the query
+    for (int i = 12; i < qn; ++i) {
+        if (::tolower(p[i]) != ::tolower(q[i])) return -1;
+    }
+
+    if (flags & 0x0200) return k_truncated;
+
+    const int rcode = flags & 15;
+    const int an = get16(p + 6);
+    const int ns = get16(p + 8);
+    const int size = addr_size(qtype == t_a ? AF_INET : AF_INET6);
+    uint32 min_ttl = (uint32)-1, neg_ttl = k_neg_ttl;
+    int i = qn;
+
+    for (int k = 0; k < an + ns; ++k) {
+        if ((i = skip_name(p, n, i)) < 0 || i + 10 > n) break;
+        const int type = get16(p + i);
+        const int cls = get16(p + i + 2);
+        const uint32 t = get32(p + i + 4);
+        const int len = get16(p + i + 8);
+        i += 10;
+        if (i + len > n) break;
+
+        if (k < an) {
+            if (qtype == t_ptr) {
+                if (type == t_ptr && cls == 1 && name.empty()) {
+                    if (read_name(p, i + len, i, name)) {
+                        if (t < min_ttl) min_ttl = t;
+                    } else {
+                        name.clear();
+                    }
+                }
+            } else if (type == qtype && cls == 1 && len == size) {
+                addr_t a;
+                a.family = qtype == t_a ? AF_INET : AF_INET6;
+                memcpy(&a.v6, p + i, size);
+                res.push_back(a);
+                if (t < min_ttl) min_ttl = t;
+            }
+        } else if (type == t_soa) {
+            // TTL of negative answers is min(TTL of SOA, the minimum field)
+            int x = skip_name(p, i + len, i);
+            if (x > 0) x = skip_name(p, i + len, x);
+            if (x > 0 && x + 20 <= i + len) {
+                const uint32 m = get32(p + x + 16);
+                neg_ttl = t < m ? t : m;
+            }
+        }
+        i += len;
+    }
+
+    *ttl = min_ttl != (uint32)-1 ? min_ttl : neg_ttl;
+    return rcode;
+}
+
+inline bool same_addr(const sa_t& a, const sa_t& b) {
+    if (a.sa.sa_family != b.sa.sa_family) return false;
+    if (a.sa.sa_family == AF_INET) {
+        return a.v4.sin_port == b.v4.sin_port && a.v4.sin_addr.s_addr == b.v4.sin_addr.s_addr;
+    }
+    return a.v6.sin6_port == b.v6.sin6_port && memcmp(&a.v6.sin6_addr, &b.v6.sin6_addr, 16) == 0;
+}
+
+// result of a query for one type
+struct Result {
+    co::vector<addr_t> addrs;
+    fastring name;
+    uint32 ttl;
+    bool done;
+};
+
+/**
+ * send a query to @server over TCP, it is used when the UDP response was truncated
+ *
+ * @return  0 if the query was answered without errors, EAI_NONAME if the name
+ *          does not exist, EAI_AGAIN on timeout or failure, or EAI_SYSTEM if the
+ *          socket could not be created.
+ */
+int query_tcp(const sa_t& server, uint32 ms, const char* q, int qn, int qtype, Result& r, uint32* neg_ttl) {
+    const int family = server.sa.sa_family;
+    const int addrlen = family == AF_INET ? sizeof(sockaddr_in) : sizeof(sockaddr_in6);
+    sock_t fd = co::tcp_socket(family);
+    if (fd == (sock_t)-1) return EAI_SYSTEM;
+
+    int err = EAI_AGAIN;
+    const int64 deadline = now::ms() + ms;
+    auto left = [deadline]() { const int64 t = deadline - now::ms(); return t > 0 ? (int)t : 1; };
+    char x[302];
+    uint8 h[2];
+    int n, rc;
+    fastream buf;
+    co::vector<addr_t> addrs;
+    fastring name;
+    uint32 ttl = 0;
+
+    // messages over TCP are prefixed with a 2-byte length
+    x[0] = (char)(qn >> 8);
+    x[1] = (char)qn;
+    memcpy(x + 2, q, qn);
+    if (co::connect(fd, &server, addrlen, (int)ms) != 0) goto end;
+    if (co::send(fd, x, qn + 2, left()) != qn + 2) goto end;
+    if (co::recvn(fd, h, 2, left()) != 2) goto end;
+    n = get16(h);
+    buf.reserve(n);
+    if (co::recvn(fd, (void*)buf.data(), n, left()) != n) goto end;
+
+    rc = parse_response((const uint8*)buf.data(), n, (const uint8*)q, qn, qtype, addrs, name, &ttl);
+    if (rc == 0) {
+        r.addrs = std::move(addrs);
+        r.name = std::move(name);
+        r.ttl = ttl;
+        r.done = true;
+        err = 0;
+    } else if (rc == 3) { /* NXDOMAIN */
+        *neg_ttl = ttl;
+        err = EAI_NONAME;
+    }
+
+  end:
+    co::close(fd);
+    return err;
+}
+
+/**
+ * send queries of @name for @nq types to @server, and wait for the responses
+ *
+ * @return  0 if all the queries were answered without errors, EAI_NONAME if the
+ *          name does not exist, EAI_AGAIN on timeout or server failure, or
+ *          EAI_SYSTEM if the socket could not be created.
+ */
+int query(const sa_t& server, uint32 ms, const fastring& name, const int* qt, Result* r, int nq, uint32* neg_ttl) {
+    char q[2][300];
+    int qn[2];
+    for (int k = 0; k < nq; ++k) {
+        if (r[k].done) continue;
+        qn[k] = make_query(q[k], query_id(), name, qt[k]);
+        if (qn[k] == 0) return EAI_NONAME;
+    }
+
+    const int family = server.sa.sa_family;
+    const int addrlen = family == AF_INET ? sizeof(sockaddr_in) : sizeof(sockaddr_in6);
+    sock_t fd = co::udp_socket(family);
+    if (fd == (sock_t)-1) return EAI_SYSTEM;
+
+    int err = EAI_AGAIN;
+    for (int k = 0; k < nq; ++k) {
+        if (r[k].done) continue;
+        if (co::sendto(fd, q[k], qn[k], &server, addrlen, (int)ms) != qn[k]) goto end;
+    }
+
+    {
+        const int64 deadline = now::ms() + ms;
+        fastream buf(1024);
+        for (;;) {
+            int left = 0;
+            for (int k = 0; k < nq; ++k) left += !r[k].done;
+            if (left == 0) { err = 0; break; }
+
+            const int64 t = deadline - now::ms();
+            if (t <= 0) break;
+
+            sa_t from;
+            int len = sizeof(from);
+            const int n = co::recvfrom(fd, (void*)buf.data(), (int)buf.capacity(), &from, &len, (int)t);
+            if (n < 0) break;
+            if (!same_addr(from, server)) continue;
+
+            for (int k = 0; k < nq; ++k) {
+                if (r[k].done) continue;
+                uint32 ttl = 0;
+                co::vector<addr_t> addrs;
+                fastring name;
+                const int rc = parse_response((const uint8*)buf.data(), n, (const uint8*)q[k], qn[k], qt[k], addrs, name, &ttl);
+                if (rc < 0) continue;
+                if (rc == k_truncated) {
+                    const int64 t = deadline - now::ms();
+                    if (t <= 0) goto end;
+                    const int e = query_tcp(server, (uint32)t, q[k], qn[k], qt[k], r[k], neg_ttl);
+                    if (e != 0) { err = e; goto end; }
+                } else if (rc == 0) {
+                    r[k].addrs = std::move(addrs);
+                    r[k].name = std::move(name);
+                    r[k].ttl = ttl;
+                    r[k].done = true;
+                } else if (rc == 3) { /* NXDOMAIN */
+                    *neg_ttl = ttl;
+                    err = EAI_NONAME;
+                    goto end;
+                } else { /* server failure, try the next server */
+                    goto end;
+                }
+                break;
+            }
+        }
+    }
+
+  end:
+    co::close(fd);
+    return err;
+}
+
+// send queries of @name to the servers, until one of them answers
+int ask(const Conf& c, const fastring& name, const int* qt, Result* r, int nq, uint32* neg_ttl) {
+    for (int k = 0; k < nq; ++k) r[k].done = false;
+    int err = EAI_AGAIN;
+    for (uint32 a = 0; a < c.attempts && err == EAI_AGAIN; ++a) {
+        for (size_t s = 0; s < c.servers.size(); ++s) {
+            err = query(c.servers[s], c.timeout, name, qt, r, nq, neg_ttl);
+            if (err != EAI_AGAIN) break;
+        }
+    }
+    return err;
+}
+
+// resolve @name with the DNS servers, the results are placed in @r
+int lookup(const Conf& c, const fastring& name, const int* qt, Result* r, int nq, uint32* neg_ttl) {
+    if (name.empty() || name.size() > 253) return EAI_NONAME;
+
+    // names to try, the search domains are used for names with less than ndots dots
+    co::vector<fastring> names;
+    uint32 dots = 0;
+    for (size_t i = 0; i < name.size(); ++i) dots += name[i] == '.';
+    if (dots >= c.ndots) names.push_back(name);
+    for (size_t i = 0; i < c.search.size(); ++i) {
+        names.push_back(name + '.' + c.search[i]);
+    }
+    if (dots < c.ndots) names.push_back(name);
+
+    int err = EAI_NONAME;
+    for (size_t i = 0; i < names.size(); ++i) {
+        err = ask(c, names[i], qt, r, nq, neg_ttl);
+        if (err != EAI_NONAME) break;
+    }
+    return err;
+}
+
+} // xx
+
+int resolve(const char* name, int family, co::vector<addr_t>& res) {
+    if (family != AF_INET && family != AF_INET6 && family != AF_UNSPEC) return EAI_FAMILY;
+    if (!name || !*name) return EAI_NONAME;
+
+    addr_t a;
+    if (xx::parse_ip(name, &a)) {
+        if (family != AF_UNSPEC && family != a.family) return EAI_NONAME;
+        res.push_back(a);
+        return 0;
+    }
+
+    fastring host(name);
+    host.tolower().strip('.', 'r');
+    auto c = xx::resolver().conf();
+
+    // the hosts file
+    auto it = c->hosts.find(host);
+    if (it != c->hosts.end()) {
+        const size_t n = res.size();
+        for (int af = AF_INET; af != 0; af = (af == AF_INET ? AF_INET6 : 0)) {
+            if (family != AF_UNSPEC && family != af) continue;
+            for (size_t i = 0; i < it->second.size(); ++i) {
+                if (it->second[i].family == af) res.push_back(it->second[i]);
+            }
+        }
+        if (res.size() > n) return 0;
+    }
+
+    // the cache, keyed by the name and the record type
+    int qt[2], nq = 0;
+    if (family != AF_INET6) qt[nq++] = xx::t_a;
+    if (family != AF_INET) qt[nq++] = xx::t_aaaa;
+
+    fastring key[2];
+    co::vector<addr_t> addrs[2];
+    int err[2] = { 0, 0 };
+    int mq[2], miss[2], nm = 0; // types not in the cache
+    for (int k = 0; k < nq; ++k) {
+        key[k] << host << ' ' << (qt[k] == xx::t_a ? '4' : '6');
+        if (!xx::resolver().cache().get(key[k], addrs[k], &err[k])) {
+            mq[nm] = qt[k];
+            miss[nm++] = k;
+        }
+    }
+
+    if (nm > 0) {
+        xx::Result r[2];
+        uint32 neg_ttl = xx::k_neg_ttl;
+        const int e = xx::lookup(*c, host, mq, r, nm, &neg_ttl);
+        for (int i = 0; i < nm; ++i) {
+            const int k = miss[i];
+            if (e == 0) {
+                addrs[k] = std::move(r[i].addrs);
+                err[k] = addrs[k].empty() ? EAI_NONAME : 0;
+                xx::resolver().cache().put(key[k], addrs[k], r[i].ttl, err[k]);
+            } else {
+                err[k] = e;
+                if (e == EAI_NONAME) xx::resolver().cache().put(key[k], addrs[k], neg_ttl, e);
+            }
+        }
+    }
+
+    int e = err[0];
+    for (int k = 0; k < nq; ++k) {
+        for (size_t i = 0; i < addrs[k].size(); ++i) res.push_back(addrs[k][i]);
+        if (err[k] == 0) e = 0;
+        else if (e != 0 && err[k] == EAI_AGAIN) e = EAI_AGAIN;
+    }
+    return e;
+}
+
+int reverse(const addr_t& a, fastring& name) {
+    if (a.family != AF_INET && a.family != AF_INET6) return EAI_FAMILY;
+    auto c = xx::resolver().conf();
+    const uint8* b = (const uint8*)&a.v6;
+    const int size = xx::addr_size(a.family);
+
+    auto it = c->names.find(fastring((const char*)b, size));
+    if (it != c->names.end()) {
+        name = it->second;
+        return 0;
+    }
+
+    // 4.3.2.1.in-addr.arpa, or nibbles of the IPv6 address in reverse order
+    static const char* hex = "0123456789abcdef";
+    fastring q(80);
+    for (int i = size - 1; i >= 0; --i) {
+        if (a.family == AF_INET) {
+            q << (uint32)b[i] << '.';
+        } else {
+            q << hex[b[i] & 15] << '.' << hex[b[i] >> 4] << '.';
+        }
+    }
+    q << (a.family == AF_INET ? "in-addr.arpa" : "ip6.arpa");
+
+    co::vector<addr_t> x;
+    int err = 0;
+    fastring key = q + " p";
+    if (xx::resolver().cache().get(key, x, &err, &name)) return err;
+
+    xx::Result r;
+    const int qt = xx::t_ptr;
+    uint32 neg_ttl = xx::k_neg_ttl;
+    err = xx::ask(*c, q, &qt, &r, 1, &neg_ttl);
+    if (err == 0) {
+        if (r.name.empty()) err = EAI_NONAME;
+        xx::resolver().cache().put(key, x, r.ttl, err, r.name);
+        name = std::move(r.name);
+    } else if (err == EAI_NONAME) {
+        xx::resolver().cache().put(key, x, neg_ttl, err);
+    }
+    return err;
+}
+
+void clear_cache() {
+    xx::resolver().clear();
+}
+
+} // dns
+} // co
+
+#endif
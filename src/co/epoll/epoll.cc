@@ -2,34 +2,74 @@
 #include "epoll.h"
 #include "../close.h"
 
+DEF_bool(co_io_uring, false, ">>#1 wait for IO events with batched io_uring poll requests instead of epoll_ctl, IO is still done by recv/send, fall back to epoll if not available");
+DEF_bool(co_epoll_persistent, false, ">>#1 register a socket to epoll once with EPOLLIN|EPOLLOUT|EPOLLET, no epoll_ctl for each wait");
+
 namespace co {
 
-Epoll::Epoll(int sched_id) : _signaled(0), _sched_id(sched_id) {
+Epoll::Epoll(int sched_id) : _ep(-1), _signaled(0), _sched_id(sched_id), _persistent(false) {
+    _efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    CHECK_NE(_efd, -1) << "create eventfd error: " << co::strerror();
+    _ev = (epoll_event*) ::calloc(1024, sizeof(epoll_event));
+
+  #ifdef CO_HAS_IO_URING
+    _uring = 0;
+    if (FLG_co_io_uring) {
+        _uring = co::make<IoUring>(sched_id, _ev);
+        if (_uring->init(_efd)) return;
+        WLOG << "io_uring not available, fall back to epoll..";
+        co::del(_uring);
+        _uring = 0;
+    }
+  #endif
+
     _ep = epoll_create(1024);
     CHECK_NE(_ep, -1) << "epoll create error: " << co::strerror();
     co::set_cloexec(_ep);
 
-    CHECK_NE(__sys_api(pipe)(_pipe_fds), -1) << "create pipe error: " << co::strerror();
-    co::set_cloexec(_pipe_fds[0]);
-    co::set_cloexec(_pipe_fds[1]);
+    // register ev_read for the eventfd to this epoll.
+    CHECK(this->add_ev_read(_efd, 0));
+    _persistent = FLG_co_epoll_persistent;
+}
 
-    // register ev_read for _pipe_fds[0] to this epoll.
-    co::set_nonblock(_pipe_fds[0]);
-    CHECK(this->add_ev_read(_pipe_fds[0], 0));
+bool Epoll::register_fd(int fd, SockCtx& ctx) {
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    ev.data.fd = fd;
 
-    _ev = (epoll_event*) ::calloc(1024, sizeof(epoll_event));
+    int r = epoll_ctl(_ep, EPOLL_CTL_ADD, fd, &ev);
+    if (r != 0 && errno == EEXIST) r = epoll_ctl(_ep, EPOLL_CTL_MOD, fd, &ev);
+    if (r == 0) {
+        ctx.set_registered(_sched_id);
+        return true;
+    } else {
+        ELOG << "epoll register error: " << co::strerror() << ", fd: " << fd;
+        return false;
+    }
 }
 
 Epoll::~Epoll() {
     this->close();
+  #ifdef CO_HAS_IO_URING
+    if (_uring) { co::del(_uring); _uring = 0; }
+  #endif
     if (_ev) { ::free(_ev); _ev = 0; }
 }
 
 bool Epoll::add_ev_read(int fd, int32 co_id) {
+  #ifdef CO_HAS_IO_URING
+    if (_uring) return _uring->add_ev_read(fd, co_id);
+  #endif
     if (fd < 0) return false;
     auto& ctx = co::get_sock_ctx(fd);
     if (ctx.has_ev_read()) return true; // already exists
 
+    if (_persistent) {
+        if (!ctx.is_registered(_sched_id) && !this->register_fd(fd, ctx)) return false;
+        ctx.add_ev_read(_sched_id, co_id);
+        return true;
+    }
+
     const bool has_ev_write = ctx.has_ev_write(_sched_id);
     epoll_event ev;
     ev.events = has_ev_write ? (EPOLLIN | EPOLLOUT | EPOLLET) : (EPOLLIN | EPOLLET);
@@ -46,10 +86,19 @@ bool Epoll::add_ev_read(int fd, int32 co_id) {
 }
 
 bool Epoll::add_ev_write(int fd, int32 co_id) {
+  #ifdef CO_HAS_IO_URING
+    if (_uring) return _uring->add_ev_write(fd, co_id);
+  #endif
     if (fd < 0) return false;
     auto& ctx = co::get_sock_ctx(fd);
     if (ctx.has_ev_write()) return true; // already exists
 
+    if (_persistent) {
+        if (!ctx.is_registered(_sched_id) && !this->register_fd(fd, ctx)) return false;
+        ctx.add_ev_write(_sched_id, co_id);
+        return true;
+    }
+
     const bool has_ev_read = ctx.has_ev_read(_sched_id);
     epoll_event ev;
     ev.events = has_ev_read ? (EPOLLIN | EPOLLOUT | EPOLLET) : (EPOLLOUT | EPOLLET);
@@ -66,12 +115,16 @@ bool Epoll::add_ev_write(int fd, int32 co_id) {
 }
 
 void Epoll::del_ev_read(int fd) {
+  #ifdef CO_HAS_IO_URING
+    if (_uring) return _uring->del_ev_read(fd);
+  #endif
     if (fd < 0) return;
     auto& ctx = co::get_sock_ctx(fd);
     if (!ctx.has_ev_read()) return; // not exists
 
     int r;
     ctx.del_ev_read();
+    if (_persistent) return;
     if (!ctx.has_ev_write(_sched_id)) {
         r = epoll_ctl(_ep, EPOLL_CTL_DEL, fd, (epoll_event*)8);
     } else {
@@ -87,12 +140,16 @@ void Epoll::del_ev_read(int fd) {
 }
 
 void Epoll::del_ev_write(int fd) {
+  #ifdef CO_HAS_IO_URING
+    if (_uring) return _uring->del_ev_write(fd);
+  #endif
     if (fd < 0) return;
     auto& ctx = co::get_sock_ctx(fd);
     if (!ctx.has_ev_write()) return; // not exists
 
     int r;
     ctx.del_ev_write();
+    if (_persistent) return;
     if (!ctx.has_ev_read(_sched_id)) {
         r = epoll_ctl(_ep, EPOLL_CTL_DEL, fd, (epoll_event*)8);
     } else {
@@ -108,12 +165,19 @@ void Epoll::del_ev_write(int fd) {
 }
 
 void Epoll::del_event(int fd) {
+  #ifdef CO_HAS_IO_URING
+    if (_uring) return _uring->del_event(fd);
+  #endif
     if (fd < 0) return;
     auto& ctx = co::get_sock_ctx(fd);
-    if (ctx.has_event()) {
+    if (ctx.has_event() || ctx.is_registered()) {
+        // the socket may be registered to epoll of another scheduler
+        const bool ours = !_persistent || ctx.is_registered(_sched_id);
         ctx.del_event();
         const int r = epoll_ctl(_ep, EPOLL_CTL_DEL, fd, (epoll_event*)8);
-        if (r != 0) ELOG << "epoll del event error: " << co::strerror() << ", fd: " << fd;
+        if (r != 0 && (ours || errno != ENOENT)) {
+            ELOG << "epoll del event error: " << co::strerror() << ", fd: " << fd;
+        }
     }
 }
 
@@ -126,23 +190,18 @@ inline void closesocket(int& fd) {
 
 void Epoll::close() {
     co::closesocket(_ep);
-    co::closesocket(_pipe_fds[0]);
-    co::closesocket(_pipe_fds[1]);
+    co::closesocket(_efd);
 }
 
 void Epoll::handle_ev_pipe() {
-    int32 dummy;
+    // a single read resets the counter of the eventfd
+    uint64 v;
     while (true) {
-        int r = __sys_api(read)(_pipe_fds[0], &dummy, 4);
-        if (r != -1) {
-            if (r < 4) break;
-            continue;
-        } else {
-            if (errno == EWOULDBLOCK || errno == EAGAIN) break;
-            if (errno == EINTR) continue;
-            ELOG << "pipe read error: " << co::strerror() << ", fd: " << _pipe_fds[0];
-            break;
-        }
+        int r = (int) __sys_api(read)(_efd, &v, sizeof(v));
+        if (r != -1 || errno == EWOULDBLOCK || errno == EAGAIN) break;
+        if (errno == EINTR) continue;
+        ELOG << "eventfd read error: " << co::strerror() << ", fd: " << _efd;
+        break;
     }
     atomic_store(&_signaled, 0, mo_release);
 }
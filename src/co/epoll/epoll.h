@@ -5,7 +5,9 @@
 #include "co/log.h"
 #include "../hook.h"
 #include "../sock_ctx.h"
+#include "io_uring.h"
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 
 namespace co {
 
@@ -20,6 +22,16 @@ namespace co {
  * 
  *     When an IO event is present, id in the user data will be used to resume 
  *     the corresponding coroutine.
+ * 
+ *   - If co_epoll_persistent is true, a socket is registered with EPOLLIN, 
+ *     EPOLLOUT and EPOLLET the first time a coroutine waits on it, and it is 
+ *     kept in epoll until del_event() is called. Adding or deleting an IO event 
+ *     only updates the SockCtx, and no epoll_ctl is needed. 
+ * 
+ *   - If co_io_uring is true, IO events are polled by IoUring instead, and we 
+ *     fall back to epoll if io_uring is not available. It only batches the 
+ *     registration of IO events, sockets are still read and written with 
+ *     non-blocking recv/send once they are ready.
  */
 class Epoll {
   public:
@@ -32,30 +44,44 @@ class Epoll {
     void del_ev_write(int fd);
     void del_event(int fd);
 
+    // register the socket with EPOLLIN | EPOLLOUT | EPOLLET once
+    bool register_fd(int fd, SockCtx& ctx);
+
     int wait(int ms) {
+      #ifdef CO_HAS_IO_URING
+        if (_uring) return _uring->wait(ms);
+      #endif
         return __sys_api(epoll_wait)(_ep, _ev, 1024, ms);
     }
 
-    // write one byte to the pipe to wake up the epoll.
-    void signal(char c = 'x') {
+    // write to the eventfd to wake up the epoll, return false if it has already 
+    // been signaled and not handled yet.
+    bool signal() {
         if (atomic_bool_cas(&_signaled, 0, 1, mo_acq_rel, mo_acquire)) {
-            const int r = (int) __sys_api(write)(_pipe_fds[1], &c, 1);
-            ELOG_IF(r != 1) << "pipe write error..";
+            const uint64 v = 1;
+            const int r = (int) __sys_api(write)(_efd, &v, sizeof(v));
+            ELOG_IF(r != sizeof(v)) << "eventfd write error: " << co::strerror();
+            return true;
         }
+        return false;
     }
 
     const epoll_event& operator[](int i)   const { return _ev[i]; }
     int user_data(const epoll_event& ev)         { return ev.data.fd; }
-    bool is_ev_pipe(const epoll_event& ev) const { return ev.data.fd == _pipe_fds[0]; }
+    bool is_ev_pipe(const epoll_event& ev) const { return ev.data.fd == _efd; }
     void handle_ev_pipe();
     void close();
 
   private:
     int _ep;
-    int _pipe_fds[2];
+    int _efd;
     int _signaled;
     int _sched_id;
+    bool _persistent;
     epoll_event* _ev;
+  #ifdef CO_HAS_IO_URING
+    IoUring* _uring;
+  #endif
 };
 
 } // co
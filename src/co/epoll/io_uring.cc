@@ -0,0 +1,237 @@
+#ifdef __linux__
+#include "io_uring.h"
+
+#ifdef CO_HAS_IO_URING
+#include "../close.h"
+#include <poll.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace co {
+
+static const uint64 k_remove = 1ULL << 63;
+
+inline uint64 make_user_data(int fd, int w, uint32 gen) {
+    return ((uint64)(gen & 0x3fffffff) << 33) | ((uint64)w << 32) | (uint32)fd;
+}
+
+IoUring::IoUring(int sched_id, epoll_event* ev)
+    : _fd(-1), _pipe_fd(-1), _sched_id(sched_id), _ev(ev), _st(14, 17),
+      _ring(MAP_FAILED), _ring_size(0), _sqes((io_uring_sqe*)MAP_FAILED), _sqes_size(0) {
+}
+
+IoUring::~IoUring() {
+    if (_sqes != MAP_FAILED) ::munmap(_sqes, _sqes_size);
+    if (_ring != MAP_FAILED) ::munmap(_ring, _ring_size);
+    if (_fd >= 0) _close_nocancel(_fd);
+}
+
+bool IoUring::init(int pipe_fd) {
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CLAMP;
+    _fd = (int) syscall(__NR_io_uring_setup, 1024, &p);
+    if (_fd < 0) {
+        WLOG << "io_uring setup error: " << co::strerror();
+        return false;
+    }
+    co::set_cloexec(_fd);
+
+    // IORING_FEAT_EXT_ARG (linux 5.11) is required for waiting with a timeout
+    const uint32 feats = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+    if ((p.features & feats) != feats) {
+        WLOG << "io_uring features not supported: " << (p.features & feats) << " " << feats;
+        return false;
+    }
+
+    const size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(uint32);
+    const size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    _ring_size = sq_size > cq_size ? sq_size : cq_size;
+    _ring = ::mmap(0, _ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+    if (_ring == MAP_FAILED) {
+        WLOG << "io_uring mmap ring error: " << co::strerror();
+        return false;
+    }
+
+    _sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+    _sqes = (io_uring_sqe*) ::mmap(0, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+    if (_sqes == MAP_FAILED) {
+        WLOG << "io_uring mmap sqes error: " << co::strerror();
+        return false;
+    }
+
+    char* const r = (char*)_ring;
+    _sq_head = (uint32*)(r + p.sq_off.head);
+    _sq_tail = (uint32*)(r + p.sq_off.tail);
+    _sq_mask = *(uint32*)(r + p.sq_off.ring_mask);
+    _sq_entries = p.sq_entries;
+    _sq_local = *_sq_tail;
+    _cq_head = (uint32*)(r + p.cq_off.head);
+    _cq_tail = (uint32*)(r + p.cq_off.tail);
+    _cq_mask = *(uint32*)(r + p.cq_off.ring_mask);
+    _cqes = (io_uring_cqe*)(r + p.cq_off.cqes);
+
+    // the i-th entry of the submission ring always refers to the i-th sqe
+    uint32* const a = (uint32*)(r + p.sq_off.array);
+    for (uint32 i = 0; i < p.sq_entries; ++i) a[i] = i;
+
+    _pipe_fd = pipe_fd;
+    this->arm(_pipe_fd, 0);
+    return true;
+}
+
+io_uring_sqe* IoUring::get_sqe() {
+    if (_sq_local - atomic_load(_sq_head, mo_acquire) >= _sq_entries) {
+        // the submission ring is full, submit the pending requests now
+        const int r = this->enter(_sq_entries, 0, 0);
+        if (r < 0 && errno != EINTR && errno != ETIME) {
+            ELOG << "io_uring submit error: " << co::strerror();
+        }
+    }
+    io_uring_sqe* sqe = &_sqes[_sq_local & _sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    ++_sq_local;
+    return sqe;
+}
+
+int IoUring::enter(uint32 to_submit, uint32 min_complete, int ms) {
+    atomic_store(_sq_tail, _sq_local, mo_release);
+    uint32 flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    io_uring_getevents_arg arg;
+    __kernel_timespec ts;
+    if (min_complete > 0 && ms > 0) {
+        ts.tv_sec = ms / 1000;
+        ts.tv_nsec = (ms % 1000) * 1000000LL;
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = (uint64)(size_t)&ts;
+        flags |= IORING_ENTER_EXT_ARG;
+        return (int) syscall(__NR_io_uring_enter, _fd, to_submit, min_complete, flags, &arg, sizeof(arg));
+    }
+    return (int) syscall(__NR_io_uring_enter, _fd, to_submit, min_complete, flags, 0, 0);
+}
+
+void IoUring::arm(int fd, int w) {
+    uint32& s = _st[fd * 2 + w];
+    if (s & 1) return; // already armed
+    s = (s + 2) | 1;
+
+    io_uring_sqe* sqe = this->get_sqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = w ? POLLOUT : POLLIN;
+    sqe->user_data = make_user_data(fd, w, s >> 1);
+}
+
+void IoUring::disarm(int fd, int w) {
+    uint32& s = _st[fd * 2 + w];
+    if (!(s & 1)) return; // not armed, or already completed
+    s &= ~1u;
+
+    io_uring_sqe* sqe = this->get_sqe();
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = make_user_data(fd, w, s >> 1);
+    sqe->user_data = k_remove;
+}
+
+bool IoUring::add_ev_read(int fd, int32 co_id) {
+    if (fd < 0) return false;
+    auto& ctx = co::get_sock_ctx(fd);
+    if (ctx.has_ev_read()) {
+        // the one-shot poll may have been consumed, arm it again
+        if (ctx.has_ev_read(_sched_id)) this->arm(fd, 0);
+        return true;
+    }
+
+    // a poll armed while the event was deleted by another thread is stale
+    this->disarm(fd, 0);
+    this->arm(fd, 0);
+    ctx.add_ev_read(_sched_id, co_id);
+    return true;
+}
+
+bool IoUring::add_ev_write(int fd, int32 co_id) {
+    if (fd < 0) return false;
+    auto& ctx = co::get_sock_ctx(fd);
+    if (ctx.has_ev_write()) {
+        if (ctx.has_ev_write(_sched_id)) this->arm(fd, 1);
+        return true;
+    }
+
+    this->disarm(fd, 1);
+    this->arm(fd, 1);
+    ctx.add_ev_write(_sched_id, co_id);
+    return true;
+}
+
+void IoUring::del_ev_read(int fd) {
+    if (fd < 0) return;
+    auto& ctx = co::get_sock_ctx(fd);
+    if (!ctx.has_ev_read()) return; // not exists
+    ctx.del_ev_read();
+    this->disarm(fd, 0);
+}
+
+void IoUring::del_ev_write(int fd) {
+    if (fd < 0) return;
+    auto& ctx = co::get_sock_ctx(fd);
+    if (!ctx.has_ev_write()) return; // not exists
+    ctx.del_ev_write();
+    this->disarm(fd, 1);
+}
+
+void IoUring::del_event(int fd) {
+    if (fd < 0) return;
+    auto& ctx = co::get_sock_ctx(fd);
+    if (ctx.has_event()) {
+        ctx.del_event();
+        this->disarm(fd, 0);
+        this->disarm(fd, 1);
+    }
+}
+
+int IoUring::wait(int ms) {
+    const uint32 to_submit = _sq_local - atomic_load(_sq_head, mo_relaxed);
+    int r = 0, err = 0;
+    if (ms != 0) {
+        r = this->enter(to_submit, 1, ms);
+    } else if (to_submit > 0) {
+        r = this->enter(to_submit, 0, 0);
+    }
+    if (r < 0) err = errno;
+
+    int n = 0;
+    uint32 head = *_cq_head;
+    const uint32 tail = atomic_load(_cq_tail, mo_acquire);
+    for (; head != tail && n < 1024; ++head) {
+        const io_uring_cqe& cqe = _cqes[head & _cq_mask];
+        const uint64 ud = cqe.user_data;
+        if (ud & k_remove) continue;
+
+        const int fd = (int)(uint32)ud;
+        const int w = (int)((ud >> 32) & 1);
+        uint32& s = _st[fd * 2 + w];
+        if (!(s & 1) || ((s >> 1) & 0x3fffffff) != (uint32)(ud >> 33)) continue; // removed or replaced
+        s &= ~1u;
+        if (cqe.res == -ECANCELED) continue;
+
+        if (fd == _pipe_fd) this->arm(fd, 0);
+        auto& ev = _ev[n++];
+        ev.events = w ? EPOLLOUT : EPOLLIN;
+        ev.data.fd = fd;
+    }
+    atomic_store(_cq_head, head, mo_release);
+
+    if (n == 0 && r < 0 && err != ETIME) {
+        errno = err;
+        return -1;
+    }
+    return n;
+}
+
+} // co
+
+#endif // CO_HAS_IO_URING
+#endif
@@ -0,0 +1,94 @@
+#ifdef __linux__
+#pragma once
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define CO_HAS_IO_URING 1
+#endif
+#endif
+
+#ifdef CO_HAS_IO_URING
+#include "co/co.h"
+#include "co/log.h"
+#include "co/table.h"
+#include "../sock_ctx.h"
+#include <linux/io_uring.h>
+#include <sys/epoll.h>
+
+namespace co {
+
+/**
+ * IoUring for Linux
+ *   - An alternative backend of Epoll, enabled by co_io_uring.
+ *
+ *   - It is a readiness interface with batched registration, like epoll_ctl 
+ *     calls submitted in one system call. IO is not completion-based, sockets 
+ *     are still read and written by recv/send in sock.cc and the hooks.
+ *
+ *   - IO events are registered as one-shot IORING_OP_POLL_ADD requests. The
+ *     requests are only queued to the submission ring by add_ev_xxx() and
+ *     del_ev_xxx(), and all of them are submitted together with waiting for
+ *     completions in wait(), so there is at most one system call per loop
+ *     iteration, no matter how many sockets are added or removed.
+ *
+ *   - A one-shot poll is consumed once it is completed, and will be armed again
+ *     lazily the next time the coroutine waits for the same event.
+ *
+ *   - Completions are translated to epoll_event, data.fd is the socket, and
+ *     events is either EPOLLIN or EPOLLOUT, so the scheduler can handle them
+ *     the same way as events from epoll.
+ *
+ *   - user_data of the poll request:
+ *       | 1 bit: poll remove | 30 bits: generation | 1 bit: write | 32 bits: fd |
+ *     A completion is ignored if its generation does not match the current one,
+ *     as the request was removed or replaced.
+ */
+class IoUring {
+  public:
+    IoUring(int sched_id, epoll_event* ev);
+    ~IoUring();
+
+    // setup the ring, return false if io_uring is not available
+    bool init(int pipe_fd);
+
+    bool add_ev_read(int fd, int32 co_id);
+    bool add_ev_write(int fd, int32 co_id);
+    void del_ev_read(int fd);
+    void del_ev_write(int fd);
+    void del_event(int fd);
+
+    // submit pending requests and wait for completions
+    int wait(int ms);
+
+  private:
+    io_uring_sqe* get_sqe();
+    int enter(uint32 to_submit, uint32 min_complete, int ms);
+    void arm(int fd, int w);
+    void disarm(int fd, int w);
+
+  private:
+    int _fd;
+    int _pipe_fd;
+    int _sched_id;
+    epoll_event* _ev;
+    co::table<uint32> _st; // (generation << 1) | armed, for fd * 2 + w
+
+    void* _ring;
+    size_t _ring_size;
+    io_uring_sqe* _sqes;
+    size_t _sqes_size;
+    uint32* _sq_head;
+    uint32* _sq_tail;
+    uint32 _sq_mask;
+    uint32 _sq_entries;
+    uint32 _sq_local;      // local tail, published to _sq_tail before submitting
+    uint32* _cq_head;
+    uint32* _cq_tail;
+    uint32 _cq_mask;
+    io_uring_cqe* _cqes;
+};
+
+} // co
+
+#endif // CO_HAS_IO_URING
+#endif
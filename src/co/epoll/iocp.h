@@ -50,11 +50,13 @@ class Iocp {
         return ::GetLastError() == WAIT_TIMEOUT ? 0 : -1;
     }
 
-    void signal() {
+    bool signal() {
         if (atomic_bool_cas(&_signaled, 0, 1, mo_acquire, mo_acquire)) {
             const BOOL r = PostQueuedCompletionStatus(_iocp, 0, 0, 0);
             ELOG_IF(!r) << "PostQueuedCompletionStatus error: " << co::strerror();
+            return true;
         }
+        return false;
     }
 
     const OVERLAPPED_ENTRY& operator[](int i) const { return _ev[i]; }
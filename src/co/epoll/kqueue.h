@@ -36,11 +36,13 @@ class Kqueue {
         }
     }
 
-    void signal(char c = 'x') {
+    bool signal(char c = 'x') {
         if (atomic_bool_cas(&_signaled, 0, 1, mo_acq_rel, mo_acquire)) {
             const int r = (int) __sys_api(write)(_pipe_fds[1], &c, 1);
             ELOG_IF(r != 1) << "pipe write error..";
+            return true;
         }
+        return false;
     }
 
     const struct kevent& operator[](int i)    const { return _ev[i]; }
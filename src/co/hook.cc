@@ -25,6 +25,7 @@ void enable_hook_sleep() {}
 #include <dlfcn.h>
 
 DEF_bool(hook_log, false, ">>#1 enable log for hook");
+DEF_bool(hook_dns, false, ">>#1 resolve host names in hooked gethostbyname*, getaddrinfo and getnameinfo with co::dns in coroutines, names not found by co::dns are passed to libc");
 
 #define HOOKLOG DLOG_IF(FLG_hook_log)
 
@@ -123,6 +124,300 @@ inline co::Mutex& gDnsMutex_g() {
     return *mtx;
 }
 
+// buffer for the hostent returned by gethostbyname in each scheduler
+inline fastream& gHostBuf() {
+    static auto bufs = co::static_new<co::vector<fastream>>(co::scheduler_num());
+    return (*bufs)[co::gSched->id()];
+}
+
+// fill @ent with addresses of family @af in @buf, return 0, or ERANGE if buf is too small
+static int fill_hostent(
+    const char* name, int af, const co::vector<co::dns::addr_t>& a,
+    struct hostent* ent, char* buf, size_t len)
+{
+    const size_t size = af == AF_INET ? 4 : 16;
+    size_t n = 0;
+    for (size_t i = 0; i < a.size(); ++i) n += a[i].family == af;
+
+    const size_t nlen = strlen(name) + 1;
+    char* p = (char*)(((size_t)buf + sizeof(void*) - 1) & ~(sizeof(void*) - 1));
+    if ((size_t)(p - buf) + sizeof(char*) * (n + 2) + size * n + nlen > len) return ERANGE;
+
+    char** aliases = (char**)p;
+    char** list = aliases + 1;
+    char* d = (char*)(list + n + 1);
+    aliases[0] = 0;
+    list[0] = 0;
+    for (size_t i = 0, k = 0; i < a.size(); ++i) {
+        if (a[i].family != af) continue;
+        memcpy(d, &a[i].v6, size);
+        list[k++] = d;
+        list[k] = 0;
+        d += size;
+    }
+    memcpy(d, name, nlen);
+
+    ent->h_name = d;
+    ent->h_aliases = aliases;
+    ent->h_addrtype = af;
+    ent->h_length = (int)size;
+    ent->h_addr_list = list;
+    return 0;
+}
+
+// gethostbyname2_r with co::dns::resolve()
+static int co_gethostbyname_r(
+    const char* name, int af,
+    struct hostent* ret, char* buf, size_t len,
+    struct hostent** res, int* err)
+{
+    *res = 0;
+    if (af != AF_INET && af != AF_INET6) {
+        *err = NO_RECOVERY;
+        return EAFNOSUPPORT;
+    }
+
+    co::vector<co::dns::addr_t> a;
+    const int r = co::dns::resolve(name, af, a);
+    if (r != 0) {
+        *err = r == EAI_AGAIN ? TRY_AGAIN : r == EAI_NONAME ? HOST_NOT_FOUND : NO_RECOVERY;
+        return r == EAI_AGAIN ? EAGAIN : ENOENT;
+    }
+    if (fill_hostent(name, af, a, ret, buf, len) != 0) {
+        *err = NETDB_INTERNAL;
+        return ERANGE;
+    }
+    *res = ret;
+    return 0;
+}
+
+// gethostbyname2 with co::dns::resolve(), the result is valid until the next
+// call in the same scheduler
+static struct hostent* co_gethostbyname(const char* name, int af) {
+    fastream& fs = gHostBuf();
+    if (fs.capacity() < 1024) fs.reserve(1024);
+    struct hostent* ent = gHostEnt();
+    struct hostent* res = 0;
+    int err = 0;
+    while (co_gethostbyname_r(name, af, ent, (char*)fs.data(), fs.capacity(), &res, &err) == ERANGE) {
+        fs.reserve(fs.capacity() << 1);
+    }
+    if (!res) h_errno = err;
+    return res;
+}
+
+// addrinfo lists created by co_getaddrinfo(), they are freed in the hooked
+// freeaddrinfo(), and lists from libc are passed to the original one.
+class AiLists {
+  public:
+    AiLists() : _n(0) {}
+
+    void add(void* p) {
+        ::MutexGuard g(_m);
+        _s.insert(p);
+        atomic_store(&_n, _s.size(), mo_relaxed);
+    }
+
+    bool del(void* p) {
+        if (atomic_load(&_n, mo_relaxed) == 0) return false;
+        ::MutexGuard g(_m);
+        if (_s.erase(p) == 0) return false;
+        atomic_store(&_n, _s.size(), mo_relaxed);
+        return true;
+    }
+
+  private:
+    ::Mutex _m;
+    co::hash_set<void*> _s;
+    size_t _n;
+};
+
+inline AiLists& gAiLists() {
+    static auto x = co::static_new<AiLists>();
+    return *x;
+}
+
+// co::dns only reads /etc/hosts and asks the name servers, names served by other
+// nsswitch sources (mDNS, LDAP, nss-resolve...) are looked up again by libc. It
+// runs in the pool of co::async_run(), so the scheduler is not blocked.
+inline bool dns_fallback(int r) {
+    return r == EAI_AGAIN || r == EAI_NONAME;
+}
+
+static int sys_getaddrinfo(
+    const char* node, const char* service,
+    const struct addrinfo* hints, struct addrinfo** res)
+{
+    struct R {
+        int r;
+        struct addrinfo* ai;
+    };
+    struct addrinfo h;
+    memset(&h, 0, sizeof(h));
+    if (hints) {
+        h.ai_flags = hints->ai_flags;
+        h.ai_family = hints->ai_family;
+        h.ai_socktype = hints->ai_socktype;
+        h.ai_protocol = hints->ai_protocol;
+    }
+    const bool hh = hints != 0, hs = service != 0;
+    fastring n(node), s(hs ? service : "");
+
+    R x = co::async_run([n, s, h, hh, hs]() {
+        R x = { 0, 0 };
+        x.r = __sys_api(getaddrinfo)(n.c_str(), hs ? s.c_str() : 0, hh ? &h : 0, &x.ai);
+        return x;
+    });
+    if (x.r == 0) *res = x.ai;
+    return x.r;
+}
+
+static int sys_getnameinfo(
+    const struct sockaddr* sa, socklen_t salen,
+    char* host, socklen_t hostlen, char* serv, socklen_t servlen, int flags)
+{
+    struct R {
+        int r;
+        char host[NI_MAXHOST];
+        char serv[NI_MAXSERV];
+    };
+    struct sockaddr_in6 a;
+    if (salen > (socklen_t)sizeof(a)) salen = (socklen_t)sizeof(a);
+    memcpy(&a, sa, salen);
+    const socklen_t hl = hostlen < NI_MAXHOST ? hostlen : NI_MAXHOST;
+    const socklen_t sl = servlen < NI_MAXSERV ? servlen : NI_MAXSERV;
+    const bool hs = serv != 0;
+
+    auto x = co::async_run([a, salen, hl, sl, hs, flags]() {
+        co::unique_ptr<R> x(co::make<R>());
+        x->r = __sys_api(getnameinfo)(
+            (const struct sockaddr*)&a, salen, x->host, hl, hs ? x->serv : 0, sl, flags
+        );
+        return x;
+    });
+    if (x->r == 0) {
+        memcpy(host, x->host, strlen(x->host) + 1);
+        if (hs) memcpy(serv, x->serv, strlen(x->serv) + 1);
+    }
+    return x->r;
+}
+
+inline bool h_fallback(int err) {
+    return err == TRY_AGAIN || err == HOST_NOT_FOUND;
+}
+
+// getaddrinfo with co::dns::resolve()
+static int co_getaddrinfo(
+    const char* node, const char* service,
+    const struct addrinfo* hints, struct addrinfo** res)
+{
+    const int family = hints ? hints->ai_family : AF_UNSPEC;
+    const int flags = hints ? hints->ai_flags : 0;
+
+    // let libc expand the service to ports, socket types and protocols,
+    // no lookup is needed as the host is numeric.
+    struct addrinfo h, *svc = 0;
+    memset(&h, 0, sizeof(h));
+    h.ai_family = AF_INET;
+    h.ai_flags = AI_NUMERICHOST | (flags & AI_NUMERICSERV);
+    if (hints) {
+        h.ai_socktype = hints->ai_socktype;
+        h.ai_protocol = hints->ai_protocol;
+    }
+    int r = __sys_api(getaddrinfo)("0.0.0.0", service, &h, &svc);
+    if (r != 0) return r;
+
+    co::vector<co::dns::addr_t> a;
+    r = co::dns::resolve(node, family, a);
+    if (r != 0) {
+        __sys_api(freeaddrinfo)(svc);
+        return dns_fallback(r) ? sys_getaddrinfo(node, service, hints, res) : r;
+    }
+
+    // the list is allocated in one block: [addrinfo...][sockaddr...][canonname]
+    size_t ns = 0;
+    for (struct addrinfo* p = svc; p; p = p->ai_next) ++ns;
+    const size_t n = a.size() * ns;
+    const size_t cn = (flags & AI_CANONNAME) ? strlen(node) + 1 : 0;
+    const size_t size = (sizeof(struct addrinfo) + sizeof(struct sockaddr_in6)) * n + cn;
+    char* buf = (char*) ::calloc(1, size);
+    if (!buf) {
+        __sys_api(freeaddrinfo)(svc);
+        return EAI_MEMORY;
+    }
+
+    struct addrinfo* ai = (struct addrinfo*) buf;
+    struct sockaddr_in6* sa = (struct sockaddr_in6*)(ai + n);
+    size_t k = 0;
+    for (size_t i = 0; i < a.size(); ++i) {
+        for (struct addrinfo* p = svc; p; p = p->ai_next, ++k) {
+            struct addrinfo& x = ai[k];
+            const uint16 port = ((struct sockaddr_in*)p->ai_addr)->sin_port;
+            x.ai_flags = flags;
+            x.ai_family = a[i].family;
+            x.ai_socktype = p->ai_socktype;
+            x.ai_protocol = p->ai_protocol;
+            x.ai_addr = (struct sockaddr*)(sa + k);
+            x.ai_next = k + 1 < n ? &ai[k + 1] : 0;
+            if (a[i].family == AF_INET) {
+                struct sockaddr_in* s = (struct sockaddr_in*)(sa + k);
+                s->sin_family = AF_INET;
+                s->sin_port = port;
+                s->sin_addr = a[i].v4;
+                x.ai_addrlen = sizeof(struct sockaddr_in);
+            } else {
+                sa[k].sin6_family = AF_INET6;
+                sa[k].sin6_port = port;
+                sa[k].sin6_addr = a[i].v6;
+                x.ai_addrlen = sizeof(struct sockaddr_in6);
+            }
+        }
+    }
+    if (cn) {
+        ai->ai_canonname = (char*)(sa + n);
+        memcpy(ai->ai_canonname, node, cn);
+    }
+
+    __sys_api(freeaddrinfo)(svc);
+    gAiLists().add(ai);
+    *res = ai;
+    return 0;
+}
+
+// getnameinfo with co::dns::reverse()
+static int co_getnameinfo(
+    const struct sockaddr* sa, socklen_t salen,
+    char* host, socklen_t hostlen, char* serv, socklen_t servlen, int flags)
+{
+    // the service and the numeric host, libc does them without network I/O
+    int r = __sys_api(getnameinfo)(
+        sa, salen, host, hostlen, serv, servlen, (flags & ~NI_NAMEREQD) | NI_NUMERICHOST
+    );
+    if (r != 0) return r;
+
+    co::dns::addr_t a;
+    a.family = sa->sa_family;
+    if (a.family == AF_INET) {
+        a.v4 = ((const struct sockaddr_in*)sa)->sin_addr;
+    } else {
+        a.v6 = ((const struct sockaddr_in6*)sa)->sin6_addr;
+    }
+
+    fastring name;
+    r = co::dns::reverse(a, name);
+    if (dns_fallback(r)) {
+        const int e = sys_getnameinfo(sa, salen, host, hostlen, serv, servlen, flags);
+        if (e == 0 || (flags & NI_NAMEREQD)) return e;
+    }
+    if (r == 0) {
+        if (name.size() >= (size_t)hostlen) return EAI_OVERFLOW;
+        memcpy(host, name.c_str(), name.size() + 1);
+    } else if (flags & NI_NAMEREQD) {
+        return r == EAI_AGAIN ? EAI_AGAIN : EAI_NONAME;
+    }
+    return 0;
+}
+
 
 extern "C" {
 
@@ -157,6 +452,9 @@ _CO_DEF_SYS_API(usleep);
 _CO_DEF_SYS_API(nanosleep);
 _CO_DEF_SYS_API(gethostbyname);
 _CO_DEF_SYS_API(gethostbyaddr);
+_CO_DEF_SYS_API(getaddrinfo);
+_CO_DEF_SYS_API(freeaddrinfo);
+_CO_DEF_SYS_API(getnameinfo);
 
 #ifdef __linux__
 _CO_DEF_SYS_API(epoll_wait);
@@ -732,17 +1030,19 @@ int _hook(poll)(struct pollfd* fds, nfds_t nfds, int ms) {
             auto ctx = gHook().get_hook_ctx(fd);
             if (!ctx || !ctx->is_sock_or_pipe() || !ctx->is_non_blocking()) break;
 
+            co::io_event_t ev;
             if (fds[0].events == POLLIN) {
-                if (!co::gSched->add_io_event(fd, co::ev_read)) break;
+                ev = co::ev_read;
             } else if (fds[0].events == POLLOUT) {
-                if (!co::gSched->add_io_event(fd, co::ev_write)) break;
+                ev = co::ev_write;
             } else {
                 break;
             }
+            if (!co::gSched->add_io_event(fd, ev)) break;
 
             if (ms > 0) co::gSched->add_timer(ms);
             co::gSched->yield();
-            co::gSched->del_io_event(fd);
+            co::gSched->del_io_event(fd, ev);
             if (ms > 0 && co::gSched->timeout()) { r = 0; goto end; }
 
             fds[0].revents = fds[0].events;
@@ -966,6 +1266,10 @@ int _hook(gethostbyname_r)(
     _hook_api(gethostbyname_r);
     HOOKLOG << "hook gethostbyname_r, name: " << (name ? name : "");
     if (!co::gSched) return __sys_api(gethostbyname_r)(name, ret, buf, len, res, err);
+    if (FLG_hook_dns && name) {
+        const int r = co_gethostbyname_r(name, AF_INET, ret, buf, len, res, err);
+        if (r == 0 || !h_fallback(*err)) return r;
+    }
     co::MutexGuard g(gDnsMutex_t());
     return __sys_api(gethostbyname_r)(name, ret, buf, len, res, err);
 }
@@ -978,6 +1282,10 @@ int _hook(gethostbyname2_r)(
     _hook_api(gethostbyname2_r);
     HOOKLOG << "hook gethostbyname2_r, name: " << (name ? name : "");
     if (!co::gSched) return __sys_api(gethostbyname2_r)(name, af, ret, buf, len, res, err);
+    if (FLG_hook_dns && name) {
+        const int r = co_gethostbyname_r(name, af, ret, buf, len, res, err);
+        if (r == 0 || !h_fallback(*err)) return r;
+    }
     co::MutexGuard g(gDnsMutex_t());
     return __sys_api(gethostbyname2_r)(name, af, ret, buf, len, res, err);
 }
@@ -999,6 +1307,10 @@ struct hostent* _hook(gethostbyname2)(const char* name, int af) {
     _hook_api(gethostbyname2);
     HOOKLOG << "hook gethostbyname2, name: " << (name ? name : "");
     if (!co::gSched || !name) return __sys_api(gethostbyname2)(name, af);
+    if (FLG_hook_dns) {
+        struct hostent* r = co_gethostbyname(name, af);
+        if (r || !h_fallback(h_errno)) return r;
+    }
 
     fastream fs(1024);
     struct hostent* ent = gHostEnt();
@@ -1006,8 +1318,9 @@ struct hostent* _hook(gethostbyname2)(const char* name, int af) {
     int* err = (int*) fs.data();
 
     int r = -1;
+    co::MutexGuard g(gDnsMutex_t());
     while (true) {
-        r = gethostbyname2_r(name, af, ent, (char*)(fs.data() + 8), fs.capacity() - 8, &res, err);
+        r = __sys_api(gethostbyname2_r)(name, af, ent, (char*)(fs.data() + 8), fs.capacity() - 8, &res, err);
         if (r == ERANGE && *err == NETDB_INTERNAL) {
             fs.reserve(fs.capacity() << 1);
             err = (int*) fs.data();
@@ -1072,6 +1385,10 @@ struct hostent* _hook(gethostbyname)(const char* name) {
 
     HOOKLOG << "hook gethostbyname, name: " << (name ? name : "");
     if (!co::gSched) return __sys_api(gethostbyname)(name);
+    if (FLG_hook_dns && name) {
+        struct hostent* r = co_gethostbyname(name, AF_INET);
+        if (r || !h_fallback(h_errno)) return r;
+    }
 
     co::MutexGuard g(gDnsMutex_g());
     struct hostent* r = __sys_api(gethostbyname)(name);
@@ -1097,6 +1414,60 @@ struct hostent* _hook(gethostbyaddr)(const void* addr, socklen_t len, int type)
     return ent;
 }
 
+// IP literals and AI_NUMERICHOST need no lookup, they go to libc directly. Other
+// names are resolved by co::dns if hook_dns is true, or by libc in the pool of 
+// co::async_run(), so the scheduler is not blocked by the lookup. AI_V4MAPPED for
+// IPv6 is not supported by co::dns, it is also left to libc in the pool.
+int _hook(getaddrinfo)(
+    const char* node, const char* service,
+    const struct addrinfo* hints, struct addrinfo** res)
+{
+    _hook_api(getaddrinfo);
+    HOOKLOG << "hook getaddrinfo, node: " << (node ? node : "") << ", service: " << (service ? service : "");
+    if (!co::gSched || !node || !res) {
+        return __sys_api(getaddrinfo)(node, service, hints, res);
+    }
+
+    if (hints && (hints->ai_flags & AI_NUMERICHOST)) {
+        return __sys_api(getaddrinfo)(node, service, hints, res);
+    }
+
+    char buf[sizeof(struct in6_addr)];
+    if (inet_pton(AF_INET, node, buf) == 1 || inet_pton(AF_INET6, node, buf) == 1) {
+        return __sys_api(getaddrinfo)(node, service, hints, res);
+    }
+
+    if (!FLG_hook_dns || (hints && hints->ai_family == AF_INET6 && (hints->ai_flags & AI_V4MAPPED))) {
+        return sys_getaddrinfo(node, service, hints, res);
+    }
+    return co_getaddrinfo(node, service, hints, res);
+}
+
+void _hook(freeaddrinfo)(struct addrinfo* ai) {
+    _hook_api(freeaddrinfo);
+    if (ai && gAiLists().del(ai)) {
+        ::free(ai);
+        return;
+    }
+    __sys_api(freeaddrinfo)(ai);
+}
+
+int _hook(getnameinfo)(
+    const struct sockaddr* sa, socklen_t salen,
+    char* host, socklen_t hostlen, char* serv, socklen_t servlen, int flags)
+{
+    _hook_api(getnameinfo);
+    HOOKLOG << "hook getnameinfo";
+    if (!co::gSched || !sa || !host || hostlen == 0 || (flags & NI_NUMERICHOST) ||
+        (sa->sa_family == AF_INET && salen < (socklen_t)sizeof(struct sockaddr_in)) ||
+        (sa->sa_family == AF_INET6 && salen < (socklen_t)sizeof(struct sockaddr_in6)) ||
+        (sa->sa_family != AF_INET && sa->sa_family != AF_INET6)) {
+        return __sys_api(getnameinfo)(sa, salen, host, hostlen, serv, servlen, flags);
+    }
+    if (!FLG_hook_dns) return sys_getnameinfo(sa, salen, host, hostlen, serv, servlen, flags);
+    return co_getnameinfo(sa, salen, host, hostlen, serv, servlen, flags);
+}
+
 } // "C"
 
 namespace co {
@@ -1170,6 +1541,9 @@ static bool _init_hooks() {
     hook_api(nanosleep);
     hook_api(gethostbyaddr);
     hook_api(gethostbyname);
+    hook_api(getaddrinfo);
+    hook_api(freeaddrinfo);
+    hook_api(getnameinfo);
 
   #ifdef __linux__
     hook_api(dup3);
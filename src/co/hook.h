@@ -172,6 +172,9 @@ typedef int (*usleep_fp_t)(useconds_t);
 typedef int (*nanosleep_fp_t)(const struct timespec*, struct timespec*);
 typedef struct hostent* (*gethostbyname_fp_t)(const char*);
 typedef struct hostent* (*gethostbyaddr_fp_t)(const void*, socklen_t, int);
+typedef int (*getaddrinfo_fp_t)(const char*, const char*, const struct addrinfo*, struct addrinfo**);
+typedef void (*freeaddrinfo_fp_t)(struct addrinfo*);
+typedef int (*getnameinfo_fp_t)(const struct sockaddr*, socklen_t, char*, socklen_t, char*, socklen_t, int);
 
 #ifdef __linux__
 typedef int (*epoll_wait_fp_t)(int, struct epoll_event*, int, int);
@@ -216,6 +219,9 @@ _CO_DEC_SYS_API(usleep);
 _CO_DEC_SYS_API(nanosleep);
 _CO_DEC_SYS_API(gethostbyname);
 _CO_DEC_SYS_API(gethostbyaddr);
+_CO_DEC_SYS_API(getaddrinfo);
+_CO_DEC_SYS_API(freeaddrinfo);
+_CO_DEC_SYS_API(getnameinfo);
 
 #ifdef __linux__
 _CO_DEC_SYS_API(epoll_wait);
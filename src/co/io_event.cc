@@ -139,6 +139,8 @@ bool IoEvent::wait(uint32 ms) {
     if (!_has_ev) {
         _has_ev = s->add_io_event(_fd, _ev);
         if (!_has_ev) return false;
+    } else {
+        s->add_io_event(_fd, _ev); // arm the one-shot poll again for io_uring
     }
 
     if (ms != (uint32)-1) {
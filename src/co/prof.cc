@@ -0,0 +1,372 @@
+#include "scheduler.h"
+#include "co/co/prof.h"
+#include "co/fs.h"
+#include "../log/stack_trace.h"
+
+DEF_bool(co_prof, false, ">>#1 start the CPU profiler when the schedulers are created");
+DEF_uint32(co_prof_hz, 99, ">>#1 number of samples per second of CPU time taken by the profiler");
+DEF_string(co_prof_path, "co.prof.folded", ">>#1 samples are written to this file at exit if co_prof is true");
+
+#if defined(__linux__) && !defined(__ANDROID__)
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+namespace co {
+namespace xx {
+
+uint32 g_prof_gen = 0;
+
+} // xx
+
+namespace prof {
+
+enum {
+    kSlots = 1024,  // slots in the table of a scheduler, MUST be power of 2
+    kDepth = 48,    // max frames of a sample
+    kProbes = 16,   // samples are dropped if no slot is found in kProbes probes
+};
+
+// Samples with the same call stack are merged in a slot. A table is written only
+// by the signal handler on its scheduler thread, and a slot is published by the
+// release store of count, so it can be read by other threads without a lock.
+struct Sample {
+    uint32 count;
+    uint32 n;         // number of frames
+    uint64 hash;
+    void* site;       // go() that created the coroutine
+    bool co;          // taken in a coroutine
+    uintptr_t pcs[kDepth];
+};
+
+struct Table {
+    Sample slots[kSlots];
+    uint64 dropped;   // samples dropped as the table is full
+    uint32 writing;   // the signal handler is adding a sample
+    uint32 resetting; // start() is clearing the table
+};
+
+struct Prof {
+    Prof() : t(0), n(0), st(0), hz(99), on(false), installed(false) {}
+
+    ::Mutex mtx;
+    co::vector<Table*> tables; // indexed by scheduler id, never freed
+    Table** t;                 // tables.data() for the signal handler
+    uint32 n;                  // tables.size() for the signal handler
+    ___::log::StackTrace* st;
+    uint32 hz;
+    bool on;
+    bool installed;            // the SIGPROF handler is installed
+};
+
+inline Prof& prof() {
+    static auto p = co::static_new<Prof>();
+    return *p;
+}
+
+inline uint64 hash(const uintptr_t* pcs, uint32 n, void* site, bool co) {
+    uint64 h = 14695981039346656037ULL ^ (uint64)(uintptr_t)site ^ (uint64)co;
+    for (uint32 i = 0; i < n; ++i) h = (h ^ pcs[i]) * 1099511628211ULL;
+    return h;
+}
+
+void add_sample(Table* t, const uintptr_t* pcs, uint32 n, void* site, bool co) {
+    const uint64 h = hash(pcs, n, site, co);
+    uint32 k = (uint32)h & (kSlots - 1);
+    for (int i = 0; i < kProbes; ++i, k = (k + 1) & (kSlots - 1)) {
+        Sample& x = t->slots[k];
+        if (x.count == 0) {
+            x.n = n;
+            x.hash = h;
+            x.site = site;
+            x.co = co;
+            memcpy(x.pcs, pcs, n * sizeof(uintptr_t));
+            atomic_store(&x.count, 1u, mo_release);
+            return;
+        }
+        if (x.hash == h && x.n == n && x.site == site && x.co == co &&
+            memcmp(x.pcs, pcs, n * sizeof(uintptr_t)) == 0) {
+            atomic_store(&x.count, x.count + 1, mo_relaxed);
+            return;
+        }
+    }
+    atomic_store(&t->dropped, t->dropped + 1, mo_relaxed);
+}
+
+// Clear a table for a new run. Timers of the last run may still fire on the 
+// scheduler thread until it sees the new generation, their samples are dropped
+// while the table is cleared.
+void reset(Table* t) {
+    atomic_store(&t->resetting, 1u);
+    while (atomic_load(&t->writing)) sched_yield();
+    memset(t->slots, 0, sizeof(t->slots));
+    t->dropped = 0;
+    atomic_store(&t->resetting, 0u);
+}
+
+void on_sigprof(int, siginfo_t*, void* ctx) {
+    const int e = errno;
+    SchedulerImpl* const s = gSched;
+    auto& p = prof();
+    if (s && atomic_load(&p.on, mo_relaxed) && s->id() < atomic_load(&p.n, mo_acquire)) {
+        // the pc and sp of the interrupted code
+        auto uc = (ucontext_t*) ctx;
+      #if defined(__x86_64__)
+        const uintptr_t pc = (uintptr_t) uc->uc_mcontext.gregs[REG_RIP];
+        const uintptr_t sp = (uintptr_t) uc->uc_mcontext.gregs[REG_RSP];
+      #elif defined(__aarch64__)
+        const uintptr_t pc = (uintptr_t) uc->uc_mcontext.pc;
+        const uintptr_t sp = (uintptr_t) uc->uc_mcontext.sp;
+      #else
+        const uintptr_t pc = 0, sp = 0; (void)uc;
+      #endif
+
+        // frames of the signal handler are skipped, they end with the pc
+        // interrupted. If it is not found, skip the handler and the trampoline.
+        uintptr_t pcs[kDepth + 8];
+        const int n = p.st->backtrace(pcs, kDepth + 8, 0);
+        int i = 0;
+        while (i < n && pcs[i] != pc) ++i;
+        if (i == n) i = n < 2 ? n : 2;
+
+        Coroutine* const co = s->running();
+        const bool in_co = co && sp && s->on_stack((void*)sp);
+        const uint32 m = (uint32)(n - i) < kDepth ? (uint32)(n - i) : kDepth;
+        Table* const t = p.t[s->id()];
+        atomic_store(&t->writing, 1u);
+        if (m > 0 && !atomic_load(&t->resetting)) add_sample(t, pcs + i, m, in_co ? co->site : 0, in_co);
+        atomic_store(&t->writing, 0u, mo_release);
+    }
+    errno = e;
+}
+
+bool start(const co::vector<Scheduler*>& scheds, uint32 hz) {
+    auto& p = prof();
+    ::MutexGuard g(p.mtx);
+    if (p.on) return true;
+
+    p.st = ___::log::stack_trace();
+    if (!p.st) return false;
+    if (!p.installed) {
+        // the unwinder may initialize itself on the first call
+        uintptr_t pcs[4];
+        p.st->backtrace(pcs, 4, 0);
+
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_sigaction = on_sigprof;
+        sa.sa_flags = SA_SIGINFO | SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        if (sigaction(SIGPROF, &sa, 0) != 0) {
+            ELOG << "install SIGPROF handler failed: " << co::strerror();
+            return false;
+        }
+        p.installed = true;
+    }
+
+    if (p.tables.size() < scheds.size()) {
+        // created on the first start, the number of schedulers does not change
+        while (p.tables.size() < scheds.size()) {
+            p.tables.push_back((Table*) ::calloc(1, sizeof(Table)));
+        }
+        p.t = p.tables.data();
+        atomic_store(&p.n, (uint32)p.tables.size(), mo_release);
+    }
+    for (size_t i = 0; i < p.tables.size(); ++i) reset(p.tables[i]);
+    p.hz = hz == 0 ? 99 : (hz < 10000 ? hz : 10000);
+
+    atomic_store(&p.on, true, mo_release);
+    atomic_inc(&xx::g_prof_gen, mo_release);
+    for (size_t i = 0; i < scheds.size(); ++i) ((SchedulerImpl*)scheds[i])->wakeup();
+    return true;
+}
+
+bool start(uint32 hz) {
+    return start(co::schedulers(), hz > 0 ? hz : FLG_co_prof_hz);
+}
+
+void stop() {
+    auto& p = prof();
+    ::MutexGuard g(p.mtx);
+    if (!p.on) return;
+    atomic_store(&p.on, false, mo_release);
+    atomic_inc(&xx::g_prof_gen, mo_release);
+    auto& scheds = co::schedulers();
+    for (size_t i = 0; i < scheds.size(); ++i) ((SchedulerImpl*)scheds[i])->wakeup();
+}
+
+// names of frames at a pc, from the outermost inline function, separated by ';'
+const fastring& frames(co::hash_map<uintptr_t, fastring>& cache, ___::log::StackTrace* st, uintptr_t pc) {
+    auto it = cache.find(pc);
+    if (it != cache.end()) return it->second;
+
+    co::vector<fastring> v;
+    fastring& s = cache[pc];
+    if (st->symbolize(pc, v, false) > 0) {
+        for (size_t i = v.size(); i > 0; --i) {
+            if (!s.empty()) s.append(';');
+            s.append(v[i - 1]);
+        }
+    } else {
+        s << (void*)pc;
+    }
+    return s;
+}
+
+// the go() call that created the coroutine, inline frames of go() are skipped
+fastring site_name(___::log::StackTrace* st, void* site) {
+    co::vector<fastring> v;
+    const uintptr_t pc = (uintptr_t)site - 1; // return address of go()
+    st->symbolize(pc, v, true);
+    for (size_t i = 0; i < v.size(); ++i) {
+        const fastring& x = v[i];
+        const size_t k = x.find('<');
+        const bool go = k != x.npos && (
+            (k == 2 && x.starts_with("go")) || (k > 4 && x.find("::go") == k - 4)
+        );
+        if (!go) return "go@" + x;
+    }
+    if (!v.empty()) return "go@" + v.back();
+    fastring s("go@");
+    s << site;
+    return s;
+}
+
+fastring folded() {
+    auto& p = prof();
+    co::vector<Table*> tables;
+    ___::log::StackTrace* st;
+    {
+        ::MutexGuard g(p.mtx);
+        tables = p.tables;
+        st = p.st;
+    }
+    if (!st) return fastring();
+
+    co::map<fastring, uint64> stacks;
+    co::hash_map<uintptr_t, fastring> names;
+    co::hash_map<void*, fastring> sites;
+    fastring s(256);
+    for (size_t i = 0; i < tables.size(); ++i) {
+        Table* const t = tables[i];
+        for (int k = 0; k < kSlots; ++k) {
+            Sample& x = t->slots[k];
+            const uint32 c = atomic_load(&x.count, mo_acquire);
+            if (c == 0) continue;
+
+            s.clear();
+            if (x.co) {
+                auto it = sites.find(x.site);
+                if (it == sites.end()) it = sites.emplace(x.site, site_name(st, x.site)).first;
+                s.append(it->second);
+            } else {
+                s.append("[scheduler]");
+            }
+            const size_t prefix = s.size();
+            for (uint32 j = x.n; j > 0; --j) {
+                const fastring& f = frames(names, st, x.pcs[j - 1]);
+                // frames below the entry of coroutines are meaningless
+                if (x.co && f.find("SchedulerImpl::main_func") != f.npos) {
+                    s.resize(prefix);
+                    continue;
+                }
+                s.append(';').append(f);
+            }
+            stacks[s] += c;
+        }
+    }
+
+    fastring r(stacks.size() * 128);
+    for (auto it = stacks.begin(); it != stacks.end(); ++it) {
+        r << it->first << ' ' << it->second << '\n';
+    }
+    return r;
+}
+
+bool dump(const char* path) {
+    fs::file f(path, 'w');
+    if (!f) return false;
+    const fastring s = folded();
+    return f.write(s) == s.size();
+}
+
+} // prof
+
+namespace xx {
+
+void prof_update(uint32& gen, void*& timer, bool stop) {
+    auto& p = prof::prof();
+    gen = atomic_load(&g_prof_gen, mo_acquire);
+    const bool on = !stop && atomic_load(&p.on, mo_acquire);
+    timer_t t;
+    static_assert(sizeof(timer_t) <= sizeof(void*), "");
+    if (on) {
+        if (!timer) {
+            struct sigevent sev;
+            memset(&sev, 0, sizeof(sev));
+            sev.sigev_notify = SIGEV_THREAD_ID;
+            sev.sigev_signo = SIGPROF;
+            sev.sigev_notify_thread_id = (pid_t) syscall(SYS_gettid);
+            if (timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &t) != 0) {
+                ELOG << "create profiling timer failed: " << co::strerror();
+                return;
+            }
+            memcpy(&timer, &t, sizeof(t));
+        }
+        memcpy(&t, &timer, sizeof(t));
+        struct itimerspec its;
+        its.it_interval.tv_sec = 0;
+        its.it_interval.tv_nsec = 1000000000 / p.hz;
+        its.it_value = its.it_interval;
+        timer_settime(t, 0, &its, 0);
+    } else if (timer) {
+        memcpy(&t, &timer, sizeof(t));
+        timer_delete(t);
+        timer = 0;
+    }
+}
+
+void prof_auto_start(const co::vector<Scheduler*>& scheds) {
+    if (prof::start(scheds, FLG_co_prof_hz)) {
+        atexit([]() {
+            prof::stop();
+            if (!FLG_co_prof_path.empty()) prof::dump(FLG_co_prof_path.c_str());
+        });
+    }
+}
+
+} // xx
+} // co
+
+#else
+namespace co {
+namespace xx {
+
+uint32 g_prof_gen = 0;
+
+void prof_update(uint32& gen, void*&, bool) { gen = g_prof_gen; }
+
+void prof_auto_start(const co::vector<Scheduler*>&) {}
+
+} // xx
+
+namespace prof {
+
+bool start(uint32) { return false; }
+
+void stop() {}
+
+fastring folded() { return fastring(); }
+
+bool dump(const char*) { return false; }
+
+} // prof
+} // co
+#endif
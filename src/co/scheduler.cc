@@ -1,36 +1,89 @@
 #include "scheduler.h"
 #include "co/os.h"
 
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include "co/fs.h"
+#include "co/str.h"
+#include <algorithm>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#endif
+
 DEF_uint32(co_sched_num, os::cpunum(), ">>#1 number of coroutine schedulers, default: os::cpunum()");
 DEF_uint32(co_stack_size, 1024 * 1024, ">>#1 size of the stack shared by coroutines, default: 1M");
+DEF_bool(co_dedicated_stack, false, ">>#1 each coroutine runs on its own stack of co_stack_size, no stack copy on switches");
 DEF_bool(co_debug_log, false, ">>#1 enable debug log for coroutine library");
+DEF_bool(co_timer_wheel, false, ">>#1 use a hierarchical timer wheel for timers, instead of the ordered map");
+DEF_bool(co_steal, false, ">>#1 allow idle schedulers to steal coroutines not started yet from busy schedulers");
+DEF_string(co_sched_cpus, "", ">>#1 CPUs to pin schedulers to, e.g. 0-7,16-23, scheduler i runs on the i-th CPU in the list (linux)");
+DEF_bool(co_sched_numa, false, ">>#1 place schedulers round-robin across NUMA nodes, each on CPUs and memory of its node (linux)");
+DEF_uint32(co_low_budget_us, 1000, ">>#1 max time in microseconds spent on low priority coroutines in each round of the scheduler loop");
+DEC_bool(co_prof);
+DEC_uint32(co_watchdog_ms);
 
 #ifdef _MSC_VER
 extern LONG WINAPI _co_on_exception(PEXCEPTION_POINTERS p);
+#include <intrin.h>
+#define _co_return_address() _ReturnAddress()
+#else
+#define _co_return_address() __builtin_return_address(0)
 #endif
 
 namespace co {
 
 __thread SchedulerImpl* gSched = 0;
+__thread WakeupCounter* gWakeupCounter = 0;
+
+// counters of all producer threads, they are never freed
+static WakeupCounter* g_wakeup_counters = 0;
+
+WakeupCounter* wakeup_counter() {
+    auto c = (WakeupCounter*) co::static_alloc(sizeof(WakeupCounter));
+    c->n = 0;
+    c->next = atomic_load(&g_wakeup_counters, mo_relaxed);
+    while (true) {
+        auto x = atomic_cas(&g_wakeup_counters, c->next, c, mo_acq_rel, mo_relaxed);
+        if (x == c->next) break;
+        c->next = x;
+    }
+    return gWakeupCounter = c;
+}
 
 SchedulerImpl::SchedulerImpl(uint32 id, uint32 sched_num, uint32 stack_size)
     : _wait_ms((uint32)-1), _id(id), _sched_num(sched_num), 
-      _stack_size(stack_size), _running(0), _co_pool(), 
-      _stop(false), _timeout(false) {
-    _epoll = co::make<Epoll>(id);
+      _stack_size(stack_size), _dedicated_stack(FLG_co_dedicated_stack),
+      _running(0), _co_pool(), 
+      _stop(false), _timeout(false), _idle(false),
+      _wakeups_issued(0),
+      _node(-1), _in_co(false), _yield_hint(false), _prof_gen(0), _prof_timer(0) {
+    memset(&_stats, 0, sizeof(_stats));
+    _stats.id = id;
+    _epoll = 0;    // created in loop()
+    _main_co = 0;  // created in loop()
     _stack = (Stack*) co::zalloc(8 * sizeof(Stack));
-    _main_co = _co_pool.pop(); // coroutine with zero id is reserved for _main_co
 }
 
 SchedulerImpl::~SchedulerImpl() {
     this->stop();
+    // dedicated stacks are kept by coroutines in the pool for reuse
+    for (size_t i = 0; i < _co_pool.size(); ++i) {
+        Coroutine* co = _co_pool[i];
+        if (co->stk) { this->free_stack(co->stk); co->stk = 0; }
+    }
     co::del(_epoll);
     co::free(_stack, 8 * sizeof(Stack));
 }
 
 void SchedulerImpl::stop() {
     if (atomic_swap(&_stop, true, mo_acq_rel) == false) {
-        _epoll->signal();
+        auto e = atomic_load(&_epoll);
+        if (e) e->signal(); // or loop() has not created it yet, and will see _stop
         _ev.wait(32); // wait at most 32ms
     }
 }
@@ -59,10 +112,79 @@ void SchedulerImpl::main_func(tb_context_from_t from) {
  *       |             v
  *       <-------- co->cb->run():  run on _stack
  */
+#ifdef _WIN32
+inline size_t _page_size() {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwPageSize;
+}
+
+// Physical pages are allocated by the system when they are first touched.
+char* SchedulerImpl::alloc_stack() {
+    static const size_t kpage = _page_size();
+    char* p = (char*) VirtualAlloc(NULL, _stack_size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    CHECK(p != NULL) << "alloc coroutine stack failed: " << co::strerror();
+    DWORD x;
+    VirtualProtect(p, kpage, PAGE_NOACCESS, &x);
+    return p;
+}
+
+void SchedulerImpl::free_stack(char* p) {
+    VirtualFree(p, 0, MEM_RELEASE);
+}
+
+#else
+// The stack is reserved with MAP_NORESERVE, and pages are committed by the 
+// system when they are first touched.
+char* SchedulerImpl::alloc_stack() {
+    static const size_t kpage = (size_t) sysconf(_SC_PAGESIZE);
+    void* p = ::mmap(
+        NULL, _stack_size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0
+    );
+    CHECK(p != MAP_FAILED) << "alloc coroutine stack failed: " << co::strerror();
+    ::mprotect(p, kpage, PROT_NONE);
+    return (char*)p;
+}
+
+void SchedulerImpl::free_stack(char* p) {
+    ::munmap(p, _stack_size);
+}
+#endif
+
 void SchedulerImpl::resume(Coroutine* co) {
     tb_context_from_t from;
-    Stack* s = &_stack[co->sid];
     _running = co;
+    stat_add(_stats.switches, (uint64)1);
+    atomic_store(&_in_co, true, mo_relaxed);
+    if (this->yield_hint()) atomic_store(&_yield_hint, false, mo_relaxed);
+    if (_dedicated_stack) {
+        if (co->ctx == 0) {
+            if (co->stk == 0) co->stk = this->alloc_stack();
+            co->ctx = tb_context_make(co->stk, _stack_size, main_func);
+            CO_DBG_LOG << "resume new co: " << co << " id: " << co->id;
+        } else {
+            if (_timer_mgr.has_timer(co)) {
+                CO_DBG_LOG << "del timer of co: " << co;
+                _timer_mgr.del_timer(co);
+            }
+            CO_DBG_LOG << "resume co: " << co << ", id: " <<  co->id;
+        }
+
+        // no stack copy here, the coroutine has its own stack
+        from = tb_context_jump(co->ctx, _main_co);
+        atomic_store(&_in_co, false, mo_relaxed);
+        if (from.priv) {
+            assert(_running == from.priv);
+            _running->ctx = from.ctx;
+            CO_DBG_LOG << "yield co: " << _running << " id: " << _running->id;
+        } else {
+            this->recycle();
+        }
+        return;
+    }
+
+    Stack* s = &_stack[co->sid];
     if (s->p == 0) {
         s->p = (char*) co::alloc(_stack_size);
         s->top = s->p + _stack_size;
@@ -78,10 +200,9 @@ void SchedulerImpl::resume(Coroutine* co) {
 
     } else {
         // remove timer before resume the coroutine
-        if (co->it != _timer_mgr.end()) {
-            CO_DBG_LOG << "del timer: " << co->it;
-            _timer_mgr.del_timer(co->it);
-            co->it = _timer_mgr.end();
+        if (_timer_mgr.has_timer(co)) {
+            CO_DBG_LOG << "del timer of co: " << co;
+            _timer_mgr.del_timer(co);
         }
 
         // resume suspended coroutine
@@ -94,6 +215,7 @@ void SchedulerImpl::resume(Coroutine* co) {
         }
         from = tb_context_jump(co->ctx, _main_co); // jump back to where the user called yiled()
     }
+    atomic_store(&_in_co, false, mo_relaxed);
 
     if (from.priv) {
         // yield() was called in the coroutine, update context for it
@@ -108,12 +230,39 @@ void SchedulerImpl::resume(Coroutine* co) {
 
 void SchedulerImpl::loop() {
     gSched = this;
-    co::array<Closure*> new_tasks;
+  #ifndef _WIN32
+    _thread = pthread_self();
+  #endif
+  #ifdef __linux__
+    if (!_cpus.empty()) this->apply_binding();
+  #endif
+    // Created after the thread is bound, so the memory is first touched on 
+    // the NUMA node of the scheduler.
+    _main_co = _co_pool.pop(); // coroutine with zero id is reserved for _main_co
+    atomic_store(&_epoll, co::make<Epoll>(_id));
+
+    co::array<TaskManager::NewTask> new_tasks;
     co::array<Coroutine*> ready_tasks;
 
     while (!_stop) {
+        if (_wait_ms != 0) {
+            // Producers do not signal the epoll while the scheduler is awake, so 
+            // check the tasks again after marking the scheduler idle. Do not block 
+            // on epoll wait if there are tasks to steal either.
+            atomic_swap(&_idle, true, mo_seq_cst);
+            if (!_task_mgr.empty() || (FLG_co_steal && this->can_steal())) _wait_ms = 0;
+        }
+        const int64 t0 = now::us();
         int n = _epoll->wait(_wait_ms);
+        const int64 t1 = now::us();
+        _timer_mgr.set_now(t1 / 1000);
+        if (_idle) atomic_store(&_idle, false, mo_relaxed);
         if (_stop) break;
+        if (unlikely(atomic_load(&xx::g_prof_gen, mo_relaxed) != _prof_gen)) {
+            xx::prof_update(_prof_gen, _prof_timer);
+        }
+        stat_add(_stats.polls, (uint64)1);
+        stat_add(_stats.wait_us, (uint64)(t1 - t0));
 
         if (unlikely(n == -1)) {
             if (errno != EINTR) {
@@ -128,6 +277,7 @@ void SchedulerImpl::loop() {
                 _epoll->handle_ev_pipe();
                 continue;
             }
+            stat_add(_stats.io_events, (uint64)1);
 
           #if defined(_WIN32)
             auto info = (IoEvent::PerIoInfo*) ((void**)ev.lpOverlapped - 2);
@@ -136,7 +286,7 @@ void SchedulerImpl::loop() {
             if (atomic_bool_cas(&info->state, st_wait, st_ready, mo_relaxed, mo_relaxed)) {
                 info->n = ev.dwNumberOfBytesTransferred;
                 if (co->s == this) {
-                    this->resume(co);
+                    if (!this->defer(co)) this->resume(co);
                 } else {
                     ((SchedulerImpl*)co->s)->add_ready_task(co);
                 }
@@ -148,21 +298,29 @@ void SchedulerImpl::loop() {
             auto& ctx = co::get_sock_ctx(_epoll->user_data(ev));
             if ((ev.events & EPOLLIN)  || !(ev.events & EPOLLOUT)) rco = ctx.get_ev_read(this->id());
             if ((ev.events & EPOLLOUT) || !(ev.events & EPOLLIN))  wco = ctx.get_ev_write(this->id());
-            if (rco) this->resume(_co_pool[rco]);
-            if (wco) this->resume(_co_pool[wco]);
+            if (rco && !this->defer(_co_pool[rco])) this->resume(_co_pool[rco]);
+            if (wco && !this->defer(_co_pool[wco])) this->resume(_co_pool[wco]);
           #else
-            this->resume((Coroutine*)_epoll->user_data(ev));
+            auto co = (Coroutine*)_epoll->user_data(ev);
+            if (!this->defer(co)) this->resume(co);
           #endif
         }
 
         CO_DBG_LOG << "> check tasks ready to resume..";
         do {
             _task_mgr.get_all_tasks(new_tasks, ready_tasks);
+            if (FLG_co_steal && new_tasks.empty() && ready_tasks.empty()) {
+                this->steal(new_tasks);
+            }
+
+            const uint32 nt = (uint32)(new_tasks.size() + ready_tasks.size());
+            stat_set(_stats.ready, nt);
+            if (nt > _stats.max_ready) stat_set(_stats.max_ready, nt);
 
             if (!new_tasks.empty()) {
                 CO_DBG_LOG << ">> resume new tasks, num: " << new_tasks.size();
                 for (size_t i = 0; i < new_tasks.size(); ++i) {
-                    this->resume(this->new_coroutine(new_tasks[i]));
+                    this->resume(this->new_coroutine(new_tasks[i].cb, new_tasks[i].site));
                 }
                 new_tasks.clear();
             }
@@ -170,7 +328,7 @@ void SchedulerImpl::loop() {
             if (!ready_tasks.empty()) {
                 CO_DBG_LOG << ">> resume ready tasks, num: " << ready_tasks.size();
                 for (size_t i = 0; i < ready_tasks.size(); ++i) {
-                    this->resume(ready_tasks[i]);
+                    if (!this->defer(ready_tasks[i])) this->resume(ready_tasks[i]);
                 }
                 ready_tasks.clear();
             }
@@ -184,20 +342,154 @@ void SchedulerImpl::loop() {
                 CO_DBG_LOG << ">> resume timedout tasks, num: " << ready_tasks.size();
                 _timeout = true;
                 for (size_t i = 0; i < ready_tasks.size(); ++i) {
-                    this->resume(ready_tasks[i]);
+                    if (!this->defer(ready_tasks[i])) this->resume(ready_tasks[i]);
                 }
                 _timeout = false;
                 ready_tasks.clear();
             }
         } while (0);
 
+        // Coroutines MUST be resumed in this function, as the context of the main 
+        // coroutine is saved at the same position on the stack each time.
+        if (!_low.empty()) {
+            CO_DBG_LOG << "> resume low priority tasks, num: " << _low.size();
+            const int64 t = now::us();
+            size_t i = 0;
+            while (i < _low.size()) {
+                const Deferred d = _low[i++]; // the lane may grow while resuming
+                d.co->deferred = false;
+                _timeout = d.timeout;
+                this->resume(d.co);
+                if (now::us() - t >= (int64)FLG_co_low_budget_us) break;
+            }
+            _timeout = false;
+
+            // the rest are left to the next round, do not block on epoll wait then
+            const size_t m = _low.size() - i;
+            if (m > 0) {
+                memmove(_low.data(), _low.data() + i, m * sizeof(Deferred));
+                _wait_ms = 0;
+            }
+            _low.resize(m);
+            stat_set(_stats.deferred, (uint32)m);
+        }
+
         if (_running) _running = 0;
+        stat_set(_stats.timers, (uint32)_timer_mgr.size());
+        stat_add(_stats.run_us, (uint64)(now::us() - t1));
     }
 
+    if (_prof_timer) xx::prof_update(_prof_gen, _prof_timer, true);
     _ev.signal();
 }
 
+void SchedulerImpl::set_priority(prio_t p) {
+    Coroutine* const co = _running;
+    const bool lower = p == prio_low && co->prio != prio_low;
+    co->prio = (uint8)p;
+    if (lower) {
+        co->deferred = true;
+        _low.push_back(Deferred{ co, false });
+        this->yield();
+    }
+}
+
+void TimerWheel::add(TimerNode* x) {
+    int64 e = x->expire;
+    const int64 d = e - _tick;
+    uint32 i;
+    if (d < 256) {
+        i = (uint32)((d < 0 ? _tick : e) & 255);
+        ++_n0;
+    } else if (d < (1 << 14)) {
+        i = 256 + (uint32)((e >> 8) & 63);
+    } else if (d < (1 << 20)) {
+        i = 320 + (uint32)((e >> 14) & 63);
+    } else if (d < (1 << 26)) {
+        i = 384 + (uint32)((e >> 20) & 63);
+    } else {
+        if (d > 0xffffffffLL) e = _tick + 0xffffffffLL;
+        i = 448 + (uint32)((e >> 26) & 63);
+    }
+    _tv[i].push_back(x);
+    x->slot = i + 1;
+    ++_n;
+}
+
+void TimerWheel::cascade() {
+    for (uint32 lv = 0; lv < 4; ++lv) {
+        const uint32 k = (uint32)((_tick >> (8 + 6 * lv)) & 63);
+        co::clist& l = _tv[256 + (lv << 6) + k];
+        co::clink* p = l.front();
+        l.clear();
+        while (p) {
+            co::clink* const x = p->next;
+            --_n;
+            this->add((TimerNode*)p);
+            p = x;
+        }
+        if (k != 0) break;
+    }
+}
+
+void TimerWheel::expire(int64 now_ms, co::array<Coroutine*>& res) {
+    while (_tick <= now_ms) {
+        if (_n == 0) { _tick = now_ms + 1; break; }
+
+        const uint32 i = (uint32)(_tick & 255);
+        if (i == 0) {
+            this->cascade();
+        } else if (_n0 == 0) {
+            // level 0 is empty, jump to the next tick to cascade
+            const int64 x = (_tick | 255) + 1;
+            _tick = x <= now_ms ? x : now_ms + 1;
+            continue;
+        }
+
+        co::clist& l = _tv[i];
+        while (!l.empty()) {
+            TimerNode* x = (TimerNode*) l.front();
+            l.erase(x);
+            x->slot = 0;
+            --_n0;
+            --_n;
+            res.push_back(x->co);
+        }
+        ++_tick;
+    }
+}
+
+uint32 TimerWheel::next_timeout(int64 now_ms) const {
+    if (_n == 0) return (uint32)-1;
+
+    // Timers in the higher levels may expire earlier than those in level 0, 
+    // we have to wake up at the next tick to cascade.
+    int64 x = _n > _n0 ? ((_tick + 255) & ~(int64)255) : _tick + 256;
+    if (_n0 > 0) {
+        for (int64 t = _tick; t < x; ++t) {
+            if (!_tv[t & 255].empty()) { x = t; break; }
+        }
+    }
+    return (uint32)(x > now_ms ? x - now_ms : 0);
+}
+
 uint32 TimerManager::check_timeout(co::array<Coroutine*>& res) {
+    if (_wheel) {
+        const int64 now_ms = _now;
+        _wheel->expire(now_ms, res);
+
+        size_t k = 0;
+        for (size_t i = 0; i < res.size(); ++i) {
+            Coroutine* co = res[i];
+            auto w = (co::waitx_t*) co->waitx;
+            if (!w || atomic_bool_cas(&w->state, st_wait, st_timeout, mo_relaxed, mo_relaxed)) {
+                res[k++] = co;
+            }
+        }
+        res.resize(k);
+        return _wheel->next_timeout(now_ms);
+    }
+
     if (_timer.empty()) return (uint32)-1;
 
     int64 now_ms = now::ms();
@@ -226,6 +518,106 @@ uint32 TimerManager::check_timeout(co::array<Coroutine*>& res) {
     return (int) (_timer.begin()->first - now_ms);
 }
 
+#ifdef __linux__
+void SchedulerImpl::apply_binding() {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (size_t i = 0; i < _cpus.size(); ++i) CPU_SET(_cpus[i], &set);
+    const int r = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (r != 0) {
+        ELOG << "pin scheduler " << _id << " to cpus failed: " << co::strerror(r);
+    }
+
+  #ifdef SYS_set_mempolicy
+    // MPOL_PREFERRED, memory falls back to other nodes if the node is full
+    if (_node >= 0 && _node < 1024) {
+        unsigned long mask[1024 / (8 * sizeof(unsigned long))] = { 0 };
+        mask[_node / (8 * sizeof(unsigned long))] |= 1UL << (_node % (8 * sizeof(unsigned long)));
+        if (syscall(SYS_set_mempolicy, 1, mask, sizeof(mask) * 8 + 1) != 0) {
+            ELOG << "set memory policy of scheduler " << _id << " failed: " << co::strerror();
+        }
+    }
+  #endif
+}
+
+inline bool _is_cpu_id(const fastring& s) {
+    if (s.empty() || s.size() > 6) return false;
+    for (size_t i = 0; i < s.size(); ++i) {
+        if (s[i] < '0' || s[i] > '9') return false;
+    }
+    return true;
+}
+
+// parse a list like "0-3,8,10-11", return an empty list if it is invalid
+static co::vector<int> parse_cpu_list(const fastring& s) {
+    co::vector<int> v;
+    auto l = str::split(str::strip(s), ',');
+    for (size_t i = 0; i < l.size(); ++i) {
+        auto r = str::split(str::strip(l[i]), '-');
+        if (r.empty()) continue;
+        for (size_t k = 0; k < r.size(); ++k) r[k].strip();
+        if (r.size() > 2 || !_is_cpu_id(r[0]) || (r.size() == 2 && !_is_cpu_id(r[1]))) {
+            ELOG << "invalid cpu list: " << s;
+            return co::vector<int>();
+        }
+        const int b = str::to_int32(r[0].c_str());
+        const int e = r.size() > 1 ? str::to_int32(r[1].c_str()) : b;
+        for (int c = b; c <= e && c < CPU_SETSIZE; ++c) v.push_back(c);
+    }
+    return v;
+}
+
+static fastring read_sys_file(const char* path) {
+    fs::file f(path, 'r');
+    return f ? f.read(4096) : fastring();
+}
+
+// CPUs and NUMA node of each scheduler, by co_sched_cpus and co_sched_numa
+static void place_schedulers(uint32 n, co::vector<co::vector<int>>& cpus, co::vector<int>& nodes) {
+    co::vector<int> allowed = parse_cpu_list(FLG_co_sched_cpus);
+    if (!FLG_co_sched_numa) {
+        if (allowed.empty()) return;
+        for (uint32 i = 0; i < n; ++i) {
+            cpus.push_back(co::vector<int>(1, allowed[i % allowed.size()]));
+            nodes.push_back(-1);
+        }
+        return;
+    }
+
+    // CPUs of each node, limited to co_sched_cpus if it is set
+    co::vector<int> ids;
+    co::vector<co::vector<int>> node_cpus;
+    auto online = parse_cpu_list(read_sys_file("/sys/devices/system/node/online"));
+    for (size_t i = 0; i < online.size(); ++i) {
+        fastring path = "/sys/devices/system/node/node" + str::from(online[i]) + "/cpulist";
+        auto c = parse_cpu_list(read_sys_file(path.c_str()));
+        if (!allowed.empty()) {
+            co::vector<int> x;
+            for (size_t k = 0; k < c.size(); ++k) {
+                if (std::find(allowed.begin(), allowed.end(), c[k]) != allowed.end()) x.push_back(c[k]);
+            }
+            c.swap(x);
+        }
+        if (c.empty()) continue;
+        ids.push_back(online[i]);
+        node_cpus.push_back(std::move(c));
+    }
+    if (ids.empty()) {
+        WLOG << "co_sched_numa: no NUMA node found";
+        return;
+    }
+
+    // Scheduler i runs on node i % k. A scheduler may run on any CPU of its node, 
+    // or on a single CPU if co_sched_cpus is set.
+    const uint32 k = (uint32)ids.size();
+    for (uint32 i = 0; i < n; ++i) {
+        const auto& c = node_cpus[i % k];
+        cpus.push_back(allowed.empty() ? c : co::vector<int>(1, c[(i / k) % c.size()]));
+        nodes.push_back(ids[i % k]);
+    }
+}
+#endif
+
 SchedulerManager::SchedulerManager() {
     co::init_sock();
     co::init_hook();
@@ -236,13 +628,24 @@ SchedulerManager::SchedulerManager() {
     _r = static_cast<uint32>((1ULL << 32) % FLG_co_sched_num);
     _s = _r == 0 ? (FLG_co_sched_num - 1) : -1;
 
+  #ifdef __linux__
+    co::vector<co::vector<int>> cpus;
+    co::vector<int> nodes;
+    place_schedulers(FLG_co_sched_num, cpus, nodes);
+  #endif
+
     for (uint32 i = 0; i < FLG_co_sched_num; ++i) {
         SchedulerImpl* s = new SchedulerImpl(i, FLG_co_sched_num, FLG_co_stack_size);
+      #ifdef __linux__
+        if (!cpus.empty()) s->bind(cpus[i], nodes[i]);
+      #endif
         s->start();
         _scheds.push_back(s);
     }
 
     is_active() = true;
+    if (FLG_co_prof) xx::prof_auto_start(_scheds);
+    if (FLG_co_watchdog_ms > 0) xx::watchdog_start(_scheds);
 }
 
 SchedulerManager::~SchedulerManager() {
@@ -254,6 +657,43 @@ inline SchedulerManager* scheduler_manager() {
     return ksm;
 }
 
+// Only coroutines not started yet can be stolen. A suspended coroutine can't
+// move to another scheduler, as its stack data points into the shared stack of
+// the scheduler it runs in.
+size_t SchedulerImpl::steal(co::array<TaskManager::NewTask>& new_tasks) {
+    auto& scheds = scheduler_manager()->schedulers();
+    const size_t n = scheds.size();
+    for (size_t i = 1; i < n; ++i) {
+        auto s = (SchedulerImpl*) scheds[(_id + i) % n];
+        if (s->_task_mgr.has_stealable_tasks()) {
+            const size_t x = s->_task_mgr.steal_tasks(new_tasks);
+            if (x > 0) {
+                CO_DBG_LOG << ">> steal tasks from scheduler " << s->id() << ", num: " << x;
+                return x;
+            }
+        }
+    }
+    return 0;
+}
+
+bool SchedulerImpl::can_steal() {
+    auto& scheds = scheduler_manager()->schedulers();
+    const size_t n = scheds.size();
+    for (size_t i = 1; i < n; ++i) {
+        auto s = (SchedulerImpl*) scheds[(_id + i) % n];
+        if (s->_task_mgr.has_stealable_tasks()) return true;
+    }
+    return false;
+}
+
+void SchedulerManager::wake_idle_scheduler(SchedulerImpl* s) {
+    const size_t n = _scheds.size();
+    for (size_t i = 1; i < n; ++i) {
+        auto x = (SchedulerImpl*) _scheds[(s->id() + i) % n];
+        if (x->idle()) { x->wakeup(); return; }
+    }
+}
+
 struct Cleanup {
     ~Cleanup() {
         if (is_active()) {
@@ -274,11 +714,18 @@ void SchedulerManager::stop() {
 }
 
 void Scheduler::go(Closure* cb) {
-    ((SchedulerImpl*)this)->add_new_task(cb);
+    ((SchedulerImpl*)this)->add_new_task(cb, _co_return_address());
 }
 
 void go(Closure* cb) {
-    ((SchedulerImpl*) scheduler_manager()->next_scheduler())->add_new_task(cb);
+    auto sm = scheduler_manager();
+    auto s = (SchedulerImpl*) sm->next_scheduler();
+    if (!FLG_co_steal) {
+        s->add_new_task(cb, _co_return_address());
+    } else {
+        s->add_stealable_task(cb, _co_return_address());
+        if (!s->idle()) sm->wake_idle_scheduler(s);
+    }
 }
 
 const co::vector<Scheduler*>& schedulers() {
@@ -306,6 +753,51 @@ int scheduler_num() {
     return os::cpunum();
 }
 
+void wakeup_stats(uint64* issued, uint64* suppressed) {
+    uint64 x = 0, y = 0;
+    if (is_active()) {
+        auto& scheds = scheduler_manager()->schedulers();
+        for (size_t i = 0; i < scheds.size(); ++i) {
+            auto s = (SchedulerImpl*) scheds[i];
+            x += s->wakeups_issued();
+        }
+    }
+    auto c = atomic_load(&g_wakeup_counters, mo_acquire);
+    for (; c; c = c->next) y += atomic_load(&c->n, mo_relaxed);
+    if (issued) *issued = x;
+    if (suppressed) *suppressed = y;
+}
+
+sched_stats_t SchedulerImpl::stats() const {
+    sched_stats_t r;
+    r.id = _stats.id;
+    r.coroutines = atomic_load(&_stats.coroutines, mo_relaxed);
+    r.timers = atomic_load(&_stats.timers, mo_relaxed);
+    r.ready = atomic_load(&_stats.ready, mo_relaxed);
+    r.max_ready = atomic_load(&_stats.max_ready, mo_relaxed);
+    r.deferred = atomic_load(&_stats.deferred, mo_relaxed);
+    r.switches = atomic_load(&_stats.switches, mo_relaxed);
+    r.stack_saved = atomic_load(&_stats.stack_saved, mo_relaxed);
+    r.polls = atomic_load(&_stats.polls, mo_relaxed);
+    r.io_events = atomic_load(&_stats.io_events, mo_relaxed);
+    r.wakeups_issued = this->wakeups_issued();
+    r.wait_us = atomic_load(&_stats.wait_us, mo_relaxed);
+    r.run_us = atomic_load(&_stats.run_us, mo_relaxed);
+    return r;
+}
+
+co::vector<sched_stats_t> sched_stats() {
+    co::vector<sched_stats_t> v;
+    if (is_active()) {
+        auto& scheds = scheduler_manager()->schedulers();
+        v.reserve(scheds.size());
+        for (size_t i = 0; i < scheds.size(); ++i) {
+            v.push_back(((SchedulerImpl*)scheds[i])->stats());
+        }
+    }
+    return v;
+}
+
 int scheduler_id() {
     return gSched ? ((SchedulerImpl*)gSched)->id() : -1;
 }
@@ -339,6 +831,26 @@ void yield() {
     gSched->yield();
 }
 
+void set_priority(prio_t p) {
+    CHECK(gSched) << "MUST be called in coroutine..";
+    gSched->set_priority(p);
+}
+
+prio_t priority() {
+    CHECK(gSched) << "MUST be called in coroutine..";
+    return (prio_t)gSched->running()->prio;
+}
+
+void maybe_yield() {
+    auto s = gSched;
+    if (s) {
+        if (unlikely(!atomic_load(&xx::g_watchdog_on, mo_relaxed))) {
+            xx::watchdog_start(scheduler_manager()->schedulers());
+        }
+        if (s->yield_hint()) s->yield_now();
+    }
+}
+
 void resume(void* p) {
     const auto co = (Coroutine*)p;
     ((SchedulerImpl*)co->s)->add_ready_task(co);
@@ -11,6 +11,7 @@
 #include "co/stl.h"
 #include "co/time.h"
 #include "co/closure.h"
+#include "co/clist.h"
 #include "co/thread.h"
 #include "co/fastream.h"
 #include "context/context.h"
@@ -29,7 +30,10 @@
 
 DEC_uint32(co_sched_num);
 DEC_uint32(co_stack_size);
+DEC_bool(co_dedicated_stack);
 DEC_bool(co_debug_log);
+DEC_bool(co_steal);
+DEC_bool(co_timer_wheel);
 
 #define CO_DBG_LOG DLOG_IF(FLG_co_debug_log)
 
@@ -44,6 +48,13 @@ void cleanup_hook();
 struct Coroutine;
 typedef co::multimap<int64, Coroutine*>::iterator timer_id_t;
 
+// node of the timer wheel, it is embedded in the Coroutine.
+struct TimerNode : co::clink {
+    int64 expire;  // expire time in milliseconds
+    uint32 slot;   // 1 + index of the slot in the wheel, 0 if not in the wheel
+    Coroutine* co; // coroutine owns this node
+};
+
 /**
  * coroutine state 
  *   - The state is used to implement co::Event.
@@ -77,6 +88,7 @@ struct Coroutine {
     uint32 sid;        // stack id
     waitx_t* waitx;    // wait info
     tb_context_t ctx;  // context, a pointer points to the stack bottom
+    char* stk;         // dedicated stack of this coroutine (co_dedicated_stack)
 
     // for saving stack data of this coroutine
     union { fastream stack; char _dummy1[sizeof(fastream)]; };
@@ -88,6 +100,12 @@ struct Coroutine {
         Closure* cb;   // coroutine function
         Scheduler* s;  // scheduler this coroutine runs in
     };
+
+    Coroutine* next;   // next coroutine in the ready queue
+    TimerNode tn;      // for the timer wheel
+    void* site;        // return address of go() that created this coroutine
+    uint8 prio;        // priority, prio_normal or prio_low
+    bool deferred;     // waiting in the low priority lane
 };
 
 // header of wait info
@@ -96,6 +114,14 @@ struct waitx_t {
     union { int state; void* dummy; };
 };
 
+// wait info of co::select(), shared by all the sources it waits on. The source 
+// that changes the state from st_wait to st_ready sets idx to its case index.
+struct selectx_t {
+    Coroutine* co;
+    union { int state; void* dummy; };
+    int idx;
+};
+
 inline waitx_t* make_waitx(void* co) {
     waitx_t* w = (waitx_t*) co::alloc(sizeof(waitx_t)); assert(w);
     w->co = (Coroutine*)co;
@@ -134,6 +160,16 @@ class Copool {
         if (_ids.size() >= 1024) co->stack.reset();
     }
 
+    // number of available coroutines in the pool
+    size_t idle() const {
+        return _ids.size();
+    }
+
+    // number of coroutines ever created in the pool
+    size_t size() const {
+        return (size_t)_id;
+    }
+
     Coroutine* operator[](size_t i) {
         return &_tb[i];
     }
@@ -144,60 +180,250 @@ class Copool {
     int _id;
 };
 
-// Tasks may be added from any thread. We need a Mutex here.
+/**
+ * lock-free multi-producer/single-consumer queue
+ *   - T is an intrusive node type with a member `T* next`.
+ *   - Producers push nodes onto the head of a LIFO list with CAS. The consumer 
+ *     takes the whole list with a single atomic swap, and reverses it to restore 
+ *     the FIFO order. As nodes are never popped one by one, there is no ABA issue.
+ */
+template <typename T>
+class MpscQueue {
+  public:
+    MpscQueue() : _head(0) {}
+    ~MpscQueue() = default;
+
+    void push(T* x) {
+        T* h = atomic_load(&_head, mo_relaxed);
+        for (;;) {
+            x->next = h;
+            T* const o = atomic_compare_swap(&_head, h, x, mo_seq_cst, mo_relaxed);
+            if (o == h) return;
+            h = o;
+        }
+    }
+
+    // take all nodes in the queue, return the first one (in FIFO order)
+    T* pop_all() {
+        T* h = atomic_swap(&_head, (T*)0, mo_acquire);
+        T* r = 0;
+        while (h) {
+            T* const x = h->next;
+            h->next = r;
+            r = h;
+            h = x;
+        }
+        return r;
+    }
+
+    bool empty() const {
+        return atomic_load(&_head, mo_seq_cst) == 0;
+    }
+
+  private:
+    T* _head;
+};
+
+// Tasks may be added from any thread. New tasks and ready tasks are pushed into 
+// lock-free MPSC queues, the scheduler thread takes them in batches. Stealable 
+// tasks may be taken by other schedulers, we need a Mutex for them.
 class TaskManager {
   public:
     TaskManager() = default;
     ~TaskManager() = default;
 
-    void add_new_task(Closure* cb) {
+    // a new task and where it was created
+    struct NewTask {
+        Closure* cb;
+        void* site;
+    };
+
+    void add_new_task(Closure* cb, void* site) {
+        auto t = (Task*) co::alloc(sizeof(Task)); assert(t);
+        t->cb = cb;
+        t->site = site;
+        _new_tasks.push(t);
+    }
+
+    // add a new task that may be stolen by other schedulers
+    void add_stealable_task(Closure* cb, void* site) {
         ::MutexGuard g(_mtx);
-        _new_tasks.push_back(cb);
+        _stealable_tasks.push_back(NewTask{ cb, site });
+        atomic_store(&_nstealable, _stealable_tasks.size(), mo_seq_cst);
     }
 
     void add_ready_task(Coroutine* co) {
-        ::MutexGuard g(_mtx);
-        _ready_tasks.push_back(co);
+        _ready_tasks.push(co);
     }
 
     void get_all_tasks(
-        co::array<Closure*>& new_tasks,
+        co::array<NewTask>& new_tasks,
         co::array<Coroutine*>& ready_tasks
     ) {
+        if (!_new_tasks.empty()) {
+            Task* t = _new_tasks.pop_all();
+            while (t) {
+                Task* const x = t->next;
+                new_tasks.push_back(NewTask{ t->cb, t->site });
+                co::free(t, sizeof(Task));
+                t = x;
+            }
+        }
+
+        if (this->has_stealable_tasks()) {
+            ::MutexGuard g(_mtx);
+            new_tasks.push_back(_stealable_tasks.data(), _stealable_tasks.size());
+            _stealable_tasks.clear();
+            atomic_store(&_nstealable, 0, mo_relaxed);
+        }
+
+        if (!_ready_tasks.empty()) {
+            Coroutine* co = _ready_tasks.pop_all();
+            while (co) {
+                Coroutine* const x = co->next;
+                ready_tasks.push_back(co);
+                co = x;
+            }
+        }
+    }
+
+    // Steal the newer half of the stealable tasks, which are pushed back into @res.
+    // It is called by other schedulers.
+    size_t steal_tasks(co::array<NewTask>& res) {
         ::MutexGuard g(_mtx);
-        if (!_new_tasks.empty()) _new_tasks.swap(new_tasks);
-        if (!_ready_tasks.empty()) _ready_tasks.swap(ready_tasks);
+        const size_t n = (_stealable_tasks.size() + 1) >> 1;
+        if (n > 0) {
+            const size_t m = _stealable_tasks.size() - n;
+            res.push_back(_stealable_tasks.data() + m, n);
+            _stealable_tasks.resize(m);
+            atomic_store(&_nstealable, m, mo_relaxed);
+        }
+        return n;
+    }
+
+    // a hint whether there are tasks to steal, no lock here
+    bool has_stealable_tasks() const {
+        return atomic_load(&_nstealable, mo_relaxed) != 0;
+    }
+
+    // Check whether there is no task. Together with the seq_cst push of producers, 
+    // it makes sure a task added while the scheduler is going to sleep is either 
+    // seen here, or the producer sees the scheduler idle and wakes it up.
+    bool empty() const {
+        return _new_tasks.empty() && _ready_tasks.empty() && 
+               atomic_load(&_nstealable, mo_seq_cst) == 0;
     }
  
   private:
+    // Closure may be shared by users (it may not delete itself after run()), 
+    // so we can't link it into the queue directly.
+    struct Task {
+        Task* next;
+        Closure* cb;
+        void* site;
+    };
+
+    MpscQueue<Task> _new_tasks;
+    MpscQueue<Coroutine> _ready_tasks;
     ::Mutex _mtx;
-    co::array<Closure*> _new_tasks;
-    co::array<Coroutine*> _ready_tasks;
+    co::array<NewTask> _stealable_tasks;
+    size_t _nstealable = 0;
 };
 
-inline fastream& operator<<(fastream& fs, const timer_id_t& id) {
-    return fs << *(void**)(&id);
-}
+/**
+ * hierarchical timer wheel
+ *   - Timers are linked into the wheel by the TimerNode in the Coroutine, adding 
+ *     or deleting a timer is O(1), and no memory allocation is needed.
+ *   - The tick is 1 ms. Level 0 has 256 slots, and each of the 4 higher levels 
+ *     has 64 slots. A slot in level n covers all slots in level n-1. Timers in a 
+ *     higher level are cascaded down when the lower level wraps around.
+ */
+class __coapi TimerWheel {
+  public:
+    // @now_ms: the first tick to process
+    explicit TimerWheel(int64 now_ms) : _tick(now_ms), _n(0), _n0(0) {}
+    ~TimerWheel() = default;
+
+    void add(TimerNode* x);
+
+    void del(TimerNode* x) {
+        _tv[x->slot - 1].erase(x);
+        if (x->slot <= 256) --_n0;
+        --_n;
+        x->slot = 0;
+    }
+
+    // remove timers expired at or before @now_ms, and push them into @res.
+    void expire(int64 now_ms, co::array<Coroutine*>& res);
+
+    // return time(ms) to wait for the next tick with timers to expire.
+    uint32 next_timeout(int64 now_ms) const;
+
+    // number of timers in the wheel
+    uint32 size() const { return _n; }
+
+  private:
+    // move timers in a slot of the higher levels down to the lower levels.
+    void cascade();
+
+  private:
+    int64 _tick;        // next tick to process
+    uint32 _n;          // number of timers in the wheel
+    uint32 _n0;         // number of timers in level 0
+    co::clist _tv[512]; // 256 slots for level 0, 64 slots for level 1 ~ 4
+};
 
 // Timer must be added in the scheduler thread. We need no lock here.
+//   - Timers are stored in an ordered map by default, or in a hierarchical 
+//     timer wheel if co_timer_wheel is true.
+//   - The timer wheel does not read the clock, it uses the time of the current 
+//     loop set by the scheduler.
 class TimerManager {
   public:
-    TimerManager() : _timer(), _it(_timer.end()) {}
-    ~TimerManager() {}
+    TimerManager()
+        : _timer(), _it(_timer.end()), _now(now::ms()),
+          _wheel(FLG_co_timer_wheel ? co::make<TimerWheel>(_now) : 0) {
+    }
 
-    timer_id_t add_timer(uint32 ms, Coroutine* co) {
-        return _it = _timer.insert(_it, std::make_pair(now::ms() + ms, co));
+    ~TimerManager() { co::del(_wheel); }
+
+    // initialize the timer of a new coroutine
+    void init_timer(Coroutine* co) {
+        co->it = _timer.end();
+        co->tn.co = co;
     }
 
-    void del_timer(const timer_id_t& it) {
-        if (_it == it) ++_it;
-        _timer.erase(it);
+    void add_timer(uint32 ms, Coroutine* co) {
+        if (_wheel) {
+            co->tn.expire = _now + ms;
+            _wheel->add(&co->tn);
+        } else {
+            co->it = _it = _timer.insert(_it, std::make_pair(now::ms() + ms, co));
+        }
     }
 
-    timer_id_t end() {
-        return _timer.end();
+    void del_timer(Coroutine* co) {
+        if (_wheel) {
+            _wheel->del(&co->tn);
+        } else {
+            if (_it == co->it) ++_it;
+            _timer.erase(co->it);
+            co->it = _timer.end();
+        }
     }
 
+    bool has_timer(const Coroutine* co) const {
+        return _wheel ? co->tn.slot != 0 : co->it != _timer.end();
+    }
+
+    // number of pending timers
+    size_t size() const {
+        return _wheel ? _wheel->size() : _timer.size();
+    }
+
+    // set time(ms) of the current loop, called once the scheduler wakes up
+    void set_now(int64 ms) { _now = ms; }
+
     // return time(ms) to wait for the next timeout.
     // all timedout coroutines will be pushed into @res.
     uint32 check_timeout(co::array<Coroutine*>& res);
@@ -205,8 +431,22 @@ class TimerManager {
   private:
     co::multimap<int64, Coroutine*> _timer;        // timed-wait tasks: <time_ms, co>
     co::multimap<int64, Coroutine*>::iterator _it; // make insert faster with this hint
+    int64 _now; // time of the current loop
+    TimerWheel* _wheel;
 };
 
+// Wakeups suppressed by a producer thread. Counters are kept per thread, so that 
+// wakeup() does not write the cache line of the target scheduler when it is awake.
+struct WakeupCounter {
+    uint64 n;
+    WakeupCounter* next;
+};
+
+extern __thread WakeupCounter* gWakeupCounter;
+
+// create and register the counter of the current thread
+WakeupCounter* wakeup_counter();
+
 struct Stack {
     char* p;       // stack pointer 
     char* top;     // stack top
@@ -222,6 +462,9 @@ class SchedulerImpl : public co::Scheduler {
     SchedulerImpl(uint32 id, uint32 sched_num, uint32 stack_size);
     ~SchedulerImpl();
 
+    // start the scheduler thread
+    void start() { Thread(&SchedulerImpl::loop, this).detach(); }
+
     // id of this scheduler
     uint32 id() const { return _id; }
 
@@ -235,6 +478,10 @@ class SchedulerImpl : public co::Scheduler {
 
     // check whether a pointer is on the stack of the coroutine
     bool on_stack(const void* p) const {
+        if (_dedicated_stack) {
+            const char* const b = _running->stk;
+            return (b <= (char*)p) && ((char*)p < b + _stack_size);
+        }
         Stack* const s =  &_stack[_running->sid];
         return (s->p <= (char*)p) && ((char*)p < s->top);
     }
@@ -249,21 +496,69 @@ class SchedulerImpl : public co::Scheduler {
     }
 
     // add a new task will run in a coroutine later (thread-safe)
-    void add_new_task(Closure* cb) {
-        _task_mgr.add_new_task(cb);
-        _epoll->signal();
+    //   - @site: where the task was created, for the profiler.
+    void add_new_task(Closure* cb, void* site=0) {
+        _task_mgr.add_new_task(cb, site);
+        this->wakeup();
+    }
+
+    // add a new task that may be stolen by idle schedulers (thread-safe)
+    void add_stealable_task(Closure* cb, void* site=0) {
+        _task_mgr.add_stealable_task(cb, site);
+        this->wakeup();
+    }
+
+    // Wake up the scheduler thread (thread-safe). The wakeup is suppressed if the 
+    // scheduler is awake, as it will check the task queues before going to sleep.
+    void wakeup() {
+        if (atomic_load(&_idle, mo_seq_cst) && _epoll->signal()) {
+            atomic_inc(&_wakeups_issued, mo_relaxed);
+        } else {
+            WakeupCounter* c = gWakeupCounter;
+            if (unlikely(!c)) c = wakeup_counter();
+            atomic_store(&c->n, c->n + 1, mo_relaxed);
+        }
+    }
+
+    // whether the scheduler is blocking on epoll wait with nothing to do
+    bool idle() const { return atomic_load(&_idle, mo_relaxed); }
+
+    uint64 wakeups_issued() const { return atomic_load(&_wakeups_issued, mo_relaxed); }
+
+    // number of switches into coroutines, for the watchdog (thread-safe)
+    uint64 switches() const { return atomic_load(&_stats.switches, mo_relaxed); }
+
+    // whether a coroutine is running now, for the watchdog (thread-safe)
+    bool in_coroutine() const { return atomic_load(&_in_co, mo_relaxed); }
+
+    // the running coroutine has used up its time slice (set by the watchdog)
+    bool yield_hint() const { return atomic_load(&_yield_hint, mo_relaxed); }
+    void set_yield_hint() { atomic_store(&_yield_hint, true, mo_relaxed); }
+
+    // suspend the current coroutine, and resume it after other ready coroutines
+    void yield_now() {
+        this->add_ready_task(_running);
+        this->yield();
     }
 
+  #ifndef _WIN32
+    // the scheduler thread
+    pthread_t thread() const { return _thread; }
+  #endif
+
+    // get a snapshot of the statistics (thread-safe)
+    sched_stats_t stats() const;
+
     // add a coroutine ready to resume (thread-safe)
     void add_ready_task(Coroutine* co) {
         _task_mgr.add_ready_task(co);
-        _epoll->signal();
+        this->wakeup();
     }
 
     // sleep for milliseconds in the current coroutine 
     void sleep(uint32 ms) {
         if (_wait_ms > ms) _wait_ms = ms;
-        (void) _timer_mgr.add_timer(ms, _running);
+        _timer_mgr.add_timer(ms, _running);
         this->yield();
     }
 
@@ -271,13 +566,16 @@ class SchedulerImpl : public co::Scheduler {
     // the coroutine. When the timer expires, the scheduler will resume it again.
     void add_timer(uint32 ms) {
         if (_wait_ms > ms) _wait_ms = ms;
-        _running->it = _timer_mgr.add_timer(ms, _running);
-        CO_DBG_LOG << "co(" << _running << ") add timer " << _running->it << " (" << ms << " ms)" ;
+        _timer_mgr.add_timer(ms, _running);
+        CO_DBG_LOG << "co(" << _running << ") add timer (" << ms << " ms)" ;
     }
 
     // check whether the current coroutine has timed out
     bool timeout() const { return _timeout; }
 
+    // set priority of the current coroutine
+    void set_priority(prio_t p);
+
     // add an IO event on a socket to epoll for the current coroutine.
     bool add_io_event(sock_t fd, io_event_t ev) {
         CO_DBG_LOG << "co(" << _running << ") add io event fd: " << fd << " ev: " << (int)ev;
@@ -313,12 +611,30 @@ class SchedulerImpl : public co::Scheduler {
 
     // push a coroutine back to the pool, so it can be reused later.
     void recycle() {
-        _stack[_running->sid].co = 0;
+        if (!_dedicated_stack) {
+            _stack[_running->sid].co = 0;
+        } else if (_co_pool.idle() >= 1024) {
+            this->free_stack(_running->stk);
+            _running->stk = 0;
+        }
         _co_pool.push(_running);
+        stat_add(_stats.coroutines, (uint32)-1);
     }
 
-    // start the scheduler thread
-    void start() { Thread(&SchedulerImpl::loop, this).detach(); }
+    // alloc a dedicated stack for a coroutine, with a guard page at the bottom
+    char* alloc_stack();
+
+    // free a dedicated stack
+    void free_stack(char* p);
+
+    // Pin the scheduler thread to @cpus, and prefer memory on NUMA node @node 
+    // (-1 for none). It MUST be called before start(), and takes effect before 
+    // the scheduler allocates anything, so stacks, coroutines and memory of the 
+    // thread-local allocator are placed on the node by the first-touch policy.
+    void bind(const co::vector<int>& cpus, int node) {
+        _cpus = cpus;
+        _node = node;
+    }
 
     // stop the scheduler thread
     void stop();
@@ -326,28 +642,65 @@ class SchedulerImpl : public co::Scheduler {
     // the thread function
     void loop();
 
+    // apply the binding set by bind() on the scheduler thread
+    void apply_binding();
+
+    // Push a low priority coroutine to the low priority lane, instead of resuming 
+    // it now, whether it has timed out is saved. It may be woken up again by IO 
+    // events before it is resumed, just ignore it then. 
+    // Return false if the coroutine has the normal priority.
+    bool defer(Coroutine* co) {
+        if (co->prio != prio_low) return false;
+        if (co->deferred) return true;
+        if (_timer_mgr.has_timer(co)) _timer_mgr.del_timer(co);
+        co->deferred = true;
+        _low.push_back(Deferred{ co, _timeout });
+        return true;
+    }
+
+    // steal new tasks from other schedulers, return number of tasks stolen
+    size_t steal(co::array<TaskManager::NewTask>& new_tasks);
+
+    // check whether there are tasks to steal in other schedulers
+    bool can_steal();
+
     // save stack for the coroutine
     void save_stack(Coroutine* co) {
         if (co) {
+            const size_t n = _stack[co->sid].top - (char*)co->ctx;
             co->stack.clear();
-            co->stack.append(co->ctx, _stack[co->sid].top - (char*)co->ctx);
+            co->stack.append(co->ctx, n);
+            stat_add(_stats.stack_saved, (uint64)n);
         }
     }
 
     // pop a Coroutine from the pool
-    Coroutine* new_coroutine(Closure* cb) {
+    Coroutine* new_coroutine(Closure* cb, void* site) {
         Coroutine* co = _co_pool.pop();
         co->cb = cb;
-        co->it = _timer_mgr.end();
+        co->site = site;
+        co->prio = prio_normal;
+        co->deferred = false;
+        _timer_mgr.init_timer(co);
+        stat_add(_stats.coroutines, 1u);
         return co;
     }
 
+    // Statistics are written only by the scheduler thread, a plain store is enough, 
+    // while other threads may read them with atomic loads.
+    template <typename T>
+    static void stat_add(T& x, T n) { atomic_store(&x, x + n, mo_relaxed); }
+
+    template <typename T>
+    static void stat_set(T& x, T n) { atomic_store(&x, n, mo_relaxed); }
+
   private:
     Epoll* _epoll;
     uint32 _wait_ms;     // time in milliseconds the epoll to wait for
     uint32 _id;          // scheduler id
     uint32 _sched_num;   // scheduler num
     uint32 _stack_size;  // size of stack
+    bool _dedicated_stack; // each coroutine has its own stack
     Stack* _stack;       // pointer to stack list
     Coroutine* _main_co; // save the main context
     Coroutine* _running; // the current running coroutine
@@ -359,6 +712,25 @@ class SchedulerImpl : public co::Scheduler {
     SyncEvent _ev;
     bool _stop;
     bool _timeout;
+    bool _idle;          // the scheduler may be blocking on epoll wait
+    uint64 _wakeups_issued;
+    sched_stats_t _stats;
+    // coroutines with low priority, resumed after others in each round
+    struct Deferred {
+        Coroutine* co;
+        bool timeout;
+    };
+    co::array<Deferred> _low;
+
+    co::vector<int> _cpus; // CPUs the scheduler thread is pinned to
+    int _node;           // preferred NUMA node of memory, -1 for none
+    bool _in_co;         // a coroutine is running
+    bool _yield_hint;    // the running coroutine has used up its time slice
+  #ifndef _WIN32
+    pthread_t _thread;   // the scheduler thread
+  #endif
+    uint32 _prof_gen;    // generation of the profiler seen by this scheduler
+    void* _prof_timer;   // profiling timer of this scheduler thread
 };
 
 class SchedulerManager {
@@ -377,6 +749,9 @@ class SchedulerManager {
         return _scheds;
     }
 
+    // wake up an idle scheduler other than @s, so it can steal tasks from @s
+    void wake_idle_scheduler(SchedulerImpl* s);
+
     void stop();
 
   private:
@@ -393,4 +768,24 @@ inline bool& is_active() {
 
 extern __thread SchedulerImpl* gSched;
 
+namespace xx {
+
+// generation of the profiler, changed when it is started or stopped (prof.cc)
+extern uint32 g_prof_gen;
+
+// arm or disarm the profiling timer of the current scheduler thread, the timer
+// is always disarmed if @stop is true
+void prof_update(uint32& gen, void*& timer, bool stop=false);
+
+// start the profiler with co_prof_hz (co_prof)
+void prof_auto_start(const co::vector<Scheduler*>& scheds);
+
+// start the watchdog thread if it is not running (watchdog.cc)
+void watchdog_start(const co::vector<Scheduler*>& scheds);
+
+// watchdog_start() has been called
+extern bool g_watchdog_on;
+
+} // xx
+
 } // co
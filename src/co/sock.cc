@@ -41,41 +41,11 @@ int close(sock_t fd, int ms) {
     return _close_nocancel(fd);
 }
 
+// IO events are not deleted here, coroutines waiting on the socket will be woken 
+// up by the kernel, and their IoEvents delete the events then.
 int shutdown(sock_t fd, char c) {
     if (fd < 0) return 0;
-
-    int how;
-    if (gSched) {
-        switch (c) {
-          case 'r':
-            gSched->del_io_event(fd, ev_read);
-            how = SHUT_RD;
-            break;
-          case 'w':
-            gSched->del_io_event(fd, ev_write);
-            how = SHUT_WR;
-            break;
-          default:
-            gSched->del_io_event(fd);
-            how = SHUT_RDWR;
-        } 
-
-    } else {
-        switch (c) {
-          case 'r':
-            co::get_sock_ctx(fd).del_ev_read();
-            how = SHUT_RD;
-            break;
-          case 'w':
-            co::get_sock_ctx(fd).del_ev_write();
-            how = SHUT_WR;
-            break;
-          default:
-            co::get_sock_ctx(fd).del_event();
-            how = SHUT_RDWR;
-        } 
-    }
-
+    const int how = c == 'r' ? SHUT_RD : c == 'w' ? SHUT_WR : SHUT_RDWR;
     return __sys_api(shutdown)(fd, how);
 }
 
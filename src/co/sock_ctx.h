@@ -54,10 +54,25 @@ class SockCtx {
         _wev.c = co_id;
     }
 
-    void del_event() { _r64 = 0; _w64 = 0; }
+    void del_event() { _r64 = 0; _w64 = 0; _reg = 0; }
     void del_ev_read()  { _r64 = 0; }
     void del_ev_write() { _w64 = 0; }
 
+    // The socket is registered to epoll of a scheduler once, and kept there 
+    // until del_event() is called. A socket used in several schedulers stays 
+    // registered to each of them. It is used when co_epoll_persistent is true.
+    //   - Schedulers with id >= 63 are not tracked, they register it again 
+    //     every time.
+    void set_registered(int sched_id) {
+        atomic_or(&_reg, _reg_bit(sched_id), mo_relaxed);
+    }
+
+    bool is_registered(int sched_id) const {
+        return sched_id < 63 && (atomic_load(&_reg, mo_relaxed) & _reg_bit(sched_id));
+    }
+
+    bool is_registered() const { return atomic_load(&_reg, mo_relaxed) != 0; }
+
     bool has_ev_read()  const { return _rev.c != 0; }
     bool has_ev_write() const { return _wev.c != 0; }
 
@@ -82,12 +97,17 @@ class SockCtx {
     }
 
   private:
+    static uint64 _reg_bit(int sched_id) {
+        return sched_id < 63 ? (1ULL << sched_id) : (1ULL << 63);
+    }
+
     struct event_t {
         int32 s; // scheduler id
         int32 c; // coroutine id
     };
     union { event_t _rev; uint64 _r64; };
     union { event_t _wev; uint64 _w64; };
+    uint64 _reg; // bit i is set if registered to scheduler i, bit 63 for the others
 };
 
 #else
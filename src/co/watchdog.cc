@@ -0,0 +1,165 @@
+#include "scheduler.h"
+#include "../log/stack_trace.h"
+
+#ifndef _WIN32
+#include <signal.h>
+#include <pthread.h>
+#endif
+
+DEF_uint32(co_watchdog_ms, 0, ">>#1 log coroutines running longer than this without being suspended, 0 to disable");
+DEF_uint32(co_time_slice_ms, 10, ">>#1 co::maybe_yield() yields if the coroutine has been running longer than this");
+
+namespace co {
+namespace xx {
+
+bool g_watchdog_on = false;
+
+} // xx
+
+// The watchdog checks the schedulers periodically. If the number of switches of
+// a scheduler does not change while a coroutine is running, the coroutine has
+// not been suspended since the last check.
+class Watchdog {
+  public:
+    explicit Watchdog(const co::vector<Scheduler*>& scheds);
+
+    void loop();
+
+  private:
+    // log the stack of the coroutine running in @s for @ms milliseconds
+    void report(SchedulerImpl* s, int64 ms);
+
+    struct State {
+        uint64 switches;  // switches of the scheduler seen in the last check
+        int64 since;      // time the switches was seen
+        bool reported;
+    };
+
+    co::vector<Scheduler*> _scheds;
+    co::vector<State> _st;
+    uint32 _tick;         // interval of checks in milliseconds
+};
+
+#ifndef _WIN32
+// Stack of a scheduler thread is taken in a signal handler on that thread.
+// SIGURG is ignored by default, and it is hardly used by applications.
+struct Snapshot {
+    uintptr_t pcs[32];
+    int n;
+    int state;  // 1: requested, 2: taken
+};
+
+Snapshot* g_snaps = 0;
+___::log::StackTrace* g_st = 0;
+
+void on_sigurg(int) {
+    const int e = errno;
+    auto s = gSched;
+    if (s && g_snaps) {
+        Snapshot& x = g_snaps[s->id()];
+        if (atomic_load(&x.state, mo_acquire) == 1) {
+            // skip frames of the signal handler and the trampoline
+            x.n = g_st->backtrace(x.pcs, 32, 2);
+            atomic_store(&x.state, 2, mo_release);
+        }
+    }
+    errno = e;
+}
+#endif
+
+Watchdog::Watchdog(const co::vector<Scheduler*>& scheds)
+    : _scheds(scheds) {
+    uint32 t = FLG_co_time_slice_ms;
+    if (FLG_co_watchdog_ms > 0 && (t == 0 || FLG_co_watchdog_ms < t)) t = FLG_co_watchdog_ms;
+    _tick = t >= 8 ? t / 4 : 2;
+    const int64 now_ms = now::ms();
+    for (size_t i = 0; i < _scheds.size(); ++i) {
+        _st.push_back(State{ ((SchedulerImpl*)_scheds[i])->switches(), now_ms, false });
+    }
+
+  #ifndef _WIN32
+    g_st = ___::log::stack_trace();
+    if (FLG_co_watchdog_ms > 0 && g_st) {
+        g_snaps = (Snapshot*) ::calloc(_scheds.size(), sizeof(Snapshot));
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = on_sigurg;
+        sa.sa_flags = SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        if (sigaction(SIGURG, &sa, 0) != 0) {
+            ::free(g_snaps);
+            g_snaps = 0;
+        }
+    }
+  #endif
+}
+
+void Watchdog::loop() {
+    const uint32 slice = FLG_co_time_slice_ms;
+    const uint32 limit = FLG_co_watchdog_ms;
+    while (is_active()) {
+        sleep::ms(_tick);
+        const int64 now_ms = now::ms();
+        for (size_t i = 0; i < _scheds.size(); ++i) {
+            auto s = (SchedulerImpl*) _scheds[i];
+            State& x = _st[i];
+            const uint64 n = s->switches();
+            if (n != x.switches || !s->in_coroutine()) {
+                x.switches = n;
+                x.since = now_ms;
+                x.reported = false;
+                continue;
+            }
+
+            const int64 ms = now_ms - x.since;
+            if (slice > 0 && ms >= slice && !s->yield_hint()) s->set_yield_hint();
+            if (limit > 0 && ms >= limit && !x.reported) {
+                x.reported = true;
+                this->report(s, ms);
+            }
+        }
+    }
+}
+
+void Watchdog::report(SchedulerImpl* s, int64 ms) {
+    fastream fs(512);
+    fs << "coroutine " << s->coroutine_id() << " in scheduler " << s->id()
+       << " has been running for at least " << ms << " ms without being suspended";
+
+  #ifndef _WIN32
+    if (g_snaps) {
+        Snapshot& x = g_snaps[s->id()];
+        atomic_store(&x.state, 1, mo_release);
+        if (pthread_kill(s->thread(), SIGURG) == 0) {
+            for (int i = 0; i < 100 && atomic_load(&x.state, mo_acquire) != 2; ++i) sleep::ms(1);
+        }
+        if (atomic_load(&x.state, mo_acquire) == 2) {
+            co::vector<fastring> v;
+            for (int i = 0; i < x.n; ++i) {
+                v.clear();
+                g_st->symbolize(x.pcs[i], v, true);
+                if (v.empty()) { fs << "\n    " << (void*)x.pcs[i]; continue; }
+                for (size_t k = 0; k < v.size(); ++k) fs << "\n    " << v[k];
+            }
+        }
+        atomic_store(&x.state, 0, mo_release);
+    }
+  #endif
+    WLOG << fs;
+}
+
+namespace xx {
+
+void watchdog_start(const co::vector<Scheduler*>& scheds) {
+    static ::Mutex m;
+    ::MutexGuard g(m);
+    if (g_watchdog_on) return;
+    if (FLG_co_watchdog_ms > 0 || FLG_co_time_slice_ms > 0) {
+        auto w = co::make<Watchdog>(scheds); // never freed, as the thread is detached
+        Thread(&Watchdog::loop, w).detach();
+    }
+    atomic_store(&g_watchdog_on, true, mo_release);
+}
+
+} // xx
+} // co
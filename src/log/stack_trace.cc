@@ -20,6 +20,7 @@ StackTrace* stack_trace() { return 0; }
 #include "co/os.h"
 #include "co/mem.h"
 #include "co/fastream.h"
+#include "co/path.h"
 #include "../co/hook.h"
 #include <string.h>
 #include <stdio.h>
@@ -36,6 +37,8 @@ inline void write_to_stderr(const char* s, size_t n) {
     auto r = __sys_api(write)(STDERR_FILENO, s, n); (void)r;
 }
 
+void silent_error_cb(void*, const char*, int) {}
+
 inline void write_to_stderr(const char* s) {
     write_to_stderr(s, strlen(s));
 }
@@ -47,6 +50,7 @@ class StackTraceImpl : public StackTrace {
         memset(_buf, 0, 4096);
         memset((char*)_fs.data(), 0, _fs.capacity());
         (void) _exe.c_str();
+        _state = backtrace_create_state(_exe.c_str(), 1, silent_error_cb, NULL);
         if (__sys_api(write) == 0) { auto r = ::write(-1, 0, 0); (void)r; }
     }
 
@@ -56,6 +60,10 @@ class StackTraceImpl : public StackTrace {
 
     virtual void dump_stack(void* f, int skip);
 
+    virtual int backtrace(uintptr_t* pcs, int n, int skip);
+
+    virtual int symbolize(uintptr_t pc, co::vector<fastring>& res, bool line);
+
     char* demangle(const char* name);
 
     char* buf() const { return _buf; }
@@ -72,6 +80,7 @@ class StackTraceImpl : public StackTrace {
     char* _buf;   // for demangle
     fastream _fs; // for stack trace
     fastring _exe;
+    struct backtrace_state* _state; // for backtrace() and symbolize(), it is thread-safe
 };
 
 StackTrace* stack_trace() {
@@ -135,6 +144,73 @@ void StackTraceImpl::dump_stack(void* f, int skip) {
     backtrace_full(state, skip, backtrace_cb, error_cb, (void*)&ud);
 }
 
+struct pcs_t {
+    uintptr_t* pcs;
+    int n;
+    int max;
+};
+
+int simple_cb(void* data, uintptr_t pc) {
+    pcs_t* x = (pcs_t*) data;
+    if (x->n >= x->max) return 1;
+    x->pcs[x->n++] = pc;
+    return 0;
+}
+
+// Program counters got here are already adjusted to point into the call
+// instructions, except the one interrupted by a signal.
+int StackTraceImpl::backtrace(uintptr_t* pcs, int n, int skip) {
+    if (!_state) return 0;
+    pcs_t x = { pcs, 0, n };
+    backtrace_simple(_state, skip + 1, simple_cb, silent_error_cb, (void*)&x);
+    return x.n;
+}
+
+struct sym_t {
+    co::vector<fastring>* res;
+    bool line;
+};
+
+// demangle with a buffer allocated by __cxa_demangle, as symbolize() may be
+// called by multiple threads
+inline fastring demangled(const char* name) {
+  #ifdef HAS_CXXABI_H
+    int status = 0;
+    char* p = abi::__cxa_demangle(name, 0, 0, &status);
+    if (p) {
+        fastring s(p);
+        ::free(p);
+        return s;
+    }
+  #endif
+    return fastring(name);
+}
+
+int pcinfo_cb(void* data, uintptr_t, const char* filename, int lineno, const char* function) {
+    sym_t* x = (sym_t*) data;
+    if (!function) return 0;
+    fastring s = demangled(function);
+    if (x->line && filename) s << ' ' << path::base(filename) << ':' << lineno;
+    x->res->push_back(std::move(s));
+    return 0;
+}
+
+void syminfo_cb(void* data, uintptr_t, const char* symname, uintptr_t, uintptr_t) {
+    sym_t* x = (sym_t*) data;
+    if (symname) x->res->push_back(demangled(symname));
+}
+
+int StackTraceImpl::symbolize(uintptr_t pc, co::vector<fastring>& res, bool line) {
+    const size_t n = res.size();
+    sym_t x = { &res, line };
+    if (!_state) return 0;
+    backtrace_pcinfo(_state, pc, pcinfo_cb, silent_error_cb, (void*)&x);
+    if (res.size() == n) {
+        backtrace_syminfo(_state, pc, syminfo_cb, silent_error_cb, (void*)&x);
+    }
+    return (int)(res.size() - n);
+}
+
 } // log
 } // ___
 #endif
@@ -1,5 +1,9 @@
 #pragma once
 
+#include "co/stl.h"
+#include "co/fastring.h"
+#include <stdint.h>
+
 namespace ___ {
 namespace log {
 
@@ -11,6 +15,30 @@ class StackTrace {
      */
     virtual void dump_stack(void* f, int skip) = 0;
 
+    /**
+     * get program counters of the current call stack, from the innermost frame
+     *   - It is async-signal-safe, so it can be called in a signal handler.
+     *
+     * @param pcs   the program counters will be stored in it.
+     * @param n     max number of frames.
+     * @param skip  number of frames to skip.
+     *
+     * @return      number of frames stored in @pcs, 0 if not supported.
+     */
+    virtual int backtrace(uintptr_t* pcs, int n, int skip) { (void)pcs; (void)n; (void)skip; return 0; }
+
+    /**
+     * get names of functions at a program counter
+     *   - Functions inlined at @pc are also pushed back, from the innermost one.
+     *
+     * @param line  if true, append " file:line" to the names.
+     *
+     * @return      number of names pushed back to @res.
+     */
+    virtual int symbolize(uintptr_t pc, co::vector<fastring>& res, bool line) {
+        (void)pc; (void)res; (void)line; return 0;
+    }
+
   protected:
     StackTrace() = default;
     virtual ~StackTrace() = default;
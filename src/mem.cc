@@ -196,13 +196,40 @@ class Bitset {
     }
 
     void atomic_set(uint32 i) {
-        atomic_or(&_s[i >> B], C << (i & R), mo_relaxed);
+        atomic_or(&_s[i >> B], C << (i & R), mo_release);
     }
 
   private:
     size_t* _s;
 };
 
+// Bits in @q are set by other threads when they free memory in a block, move 
+// them out of @p, the bits of allocated memory. 
+//   - @bit is the current bit of the block, the new one is returned, it is 0 if 
+//     nothing is allocated in the block. 
+inline uint32 _xdrain(size_t* p, size_t* q, uint32 bit) {
+    int lo = -1;     // the lowest bit freed above the last allocated one
+    bool top = true; // looking for the last allocated bit
+    for (int i = static_cast<int>(bit >> B); i >= 0; --i) {
+        size_t x = atomic_load(&q[i], mo_relaxed);
+        if (x) {
+            x = atomic_swap(&q[i], (size_t)0, mo_acquire);
+            p[i] &= ~x;
+        }
+        if (top) {
+            if (p[i]) {
+                const int m = _find_msb(p[i]);
+                const size_t y = m < (int)R ? (x & ~((C << (m + 1)) - 1)) : 0;
+                if (y) lo = static_cast<int>(_find_lsb(y) + (i << B));
+                top = false;
+            } else if (x) {
+                lo = static_cast<int>(_find_lsb(x) + (i << B));
+            }
+        }
+    }
+    return top ? 0 : (lo >= 0 ? (uint32)lo : bit);
+}
+
 // 128M on arch64, or 32M on arch32
 // manage and alloc large blocks(2M or 1M)
 class HugeBlock : public co::clink {
@@ -291,11 +318,10 @@ class LargeAlloc : public co::clink {
     static const uint32 MAX_bIT = BS_BITS - 1;
 
     explicit LargeAlloc(HugeBlock* parent, ThreadAlloc* ta)
-        : _parent(parent), _ta(ta) {
+        : _xs(0), _xnext(0), _parent(parent), _ta(ta) {
         static_assert(sizeof(*this) <= LA_SIZE, "");
         _p = (char*)this + 4096;
         _pbs = (char*)this + LA_SIZE;
-        _xpbs = (char*)this + (LA_SIZE + (BS_BITS >> 3));
         //assert(!next && !prev && _bit == 0);
     }
 
@@ -318,11 +344,26 @@ class LargeAlloc : public co::clink {
         return r < i ? ((_bit = r >= 0 ? i : 0) == 0) : false;
     }
 
+    // called by other threads before xfree(), return true if the block is not 
+    // in the remote-free list of the owner, and should be pushed to it
+    bool xmark() {
+        return !atomic_load(&_xs, mo_relaxed) && !atomic_swap(&_xs, 1u, mo_acq_rel);
+    }
+
+    // called by other threads, the block is not touched after the bit is set, 
+    // as it may be released by the owner then
     void xfree(void* p) {
         const uint32 i = (uint32)(((char*)p - _p) >> 12);
-        _xbs.atomic_set(i);
+        Bitset(this->xbits()).atomic_set(i);
     }
 
+    // called by the owner after the block is popped from the remote-free list,
+    // return true if nothing is allocated in the block
+    bool xdrain();
+
+    // the block is in the remote-free list, or being pushed to it
+    bool xmarked() const { return atomic_load(&_xs, mo_relaxed) != 0; }
+
     void* realloc(void* p, uint32 o, uint32 n) {
         uint32 i = (uint32)(((char*)p - _p) >> 12);
         if (_bit == i + o && i + n <= MAX_bIT) {
@@ -332,31 +373,42 @@ class LargeAlloc : public co::clink {
         return NULL;
     }
 
+    LargeAlloc* xnext() const { return _xnext; }
+    void set_xnext(LargeAlloc* x) { _xnext = x; }
     HugeBlock* parent() const { return _parent; }
     ThreadAlloc* thread_alloc() const { return _ta; }
 
   private:
+    // bits set by other threads when they free memory
+    size_t* xbits() const {
+        return (size_t*)((char*)this + (LA_SIZE + (BS_BITS >> 3)));
+    }
+
     char* _p;    // beginning address to alloc
     uint32 _bit; // current bit
+    uint32 _xs;  // 1 if the block is in the remote-free list
     union {
         Bitset _bs;
         char* _pbs;
     };
-    union {
-        Bitset _xbs;
-        char* _xpbs;
-    };
+    LargeAlloc* _xnext; // next block in the remote-free list
     HugeBlock* _parent;
     ThreadAlloc* _ta;
     DISALLOW_COPY_AND_ASSIGN(LargeAlloc);
 };
 
+inline bool LargeAlloc::xdrain() {
+    atomic_swap(&_xs, 0u, mo_acq_rel);
+    _bit = _xdrain((size_t*)_pbs, this->xbits(), _bit);
+    return _bit == 0;
+}
+
 void* LargeAlloc::try_hard_alloc(uint32 n) {
     size_t* const p = (size_t*)_pbs;
-    size_t* const q = (size_t*)_xpbs;
+    size_t* const q = this->xbits();
 
     int i = _bit >> B;
-    while (p[i] == 0) --i;
+    while (i > 0 && p[i] == 0) --i;
     size_t x = atomic_load(&q[i], mo_relaxed);
     if (x) {
         for (;;) {
@@ -389,11 +441,10 @@ class SmallAlloc : public co::clink {
     static const uint32 MAX_bIT = BS_BITS - ((SA_SIZE + (BS_BITS >> 2)) >> 4);
 
     explicit SmallAlloc(LargeBlock* parent, ThreadAlloc* ta)
-        : _bit(0), _parent(parent), _ta(ta) {
+        : _bit(0), _xs(0), _xnext(0), _parent(parent), _ta(ta) {
         static_assert(sizeof(*this) <= SA_SIZE, "");
         _p = (char*)this + (SA_SIZE + (BS_BITS >> 2));
         _pbs = (char*)this + SA_SIZE;
-        _xpbs = (char*)this + (SA_SIZE + (BS_BITS >> 3));
         next = prev = 0;
     }
 
@@ -416,11 +467,22 @@ class SmallAlloc : public co::clink {
         return r < i ? ((_bit = r >= 0 ? i : 0) == 0) : false;
     }
 
+    // see LargeAlloc::xmark()
+    bool xmark() {
+        return !atomic_load(&_xs, mo_relaxed) && !atomic_swap(&_xs, 1u, mo_acq_rel);
+    }
+
+    // see LargeAlloc::xfree()
     void xfree(void* p) {
         const uint32 i = (uint32)(((char*)p - _p) >> 4);
-        _xbs.atomic_set(i);
+        Bitset(this->xbits()).atomic_set(i);
     }
 
+    // see LargeAlloc::xdrain()
+    bool xdrain();
+
+    bool xmarked() const { return atomic_load(&_xs, mo_relaxed) != 0; }
+
     void* realloc(void* p, uint32 o, uint32 n) {
         uint32 i = (uint32)(((char*)p - _p) >> 4);
         if (_bit == i + o && i + n <= MAX_bIT) {
@@ -430,31 +492,41 @@ class SmallAlloc : public co::clink {
         return NULL;
     }
 
+    SmallAlloc* xnext() const { return _xnext; }
+    void set_xnext(SmallAlloc* x) { _xnext = x; }
     LargeBlock* parent() const { return _parent; }
     ThreadAlloc* thread_alloc() const { return _ta; }
 
   private:
+    size_t* xbits() const {
+        return (size_t*)((char*)this + (SA_SIZE + (BS_BITS >> 3)));
+    }
+
     char* _p; // beginning address to alloc
     uint32 _bit;
+    uint32 _xs;
     union {
         Bitset _bs;
         char* _pbs;
     };
-    union {
-        Bitset _xbs;
-        char* _xpbs;
-    };
+    SmallAlloc* _xnext;
     LargeBlock* _parent;
     ThreadAlloc* _ta;
     DISALLOW_COPY_AND_ASSIGN(SmallAlloc);
 };
 
+inline bool SmallAlloc::xdrain() {
+    atomic_swap(&_xs, 0u, mo_acq_rel);
+    _bit = _xdrain((size_t*)_pbs, this->xbits(), _bit);
+    return _bit == 0;
+}
+
 void* SmallAlloc::try_hard_alloc(uint32 n) {
     size_t* const p = (size_t*)_pbs;
-    size_t* const q = (size_t*)_xpbs;
+    size_t* const q = this->xbits();
 
     int i = _bit >> B;
-    while (p[i] == 0) --i;
+    while (i > 0 && p[i] == 0) --i;
     size_t x = atomic_load(&q[i], mo_relaxed);
     if (x) {
         for (;;) {
@@ -515,11 +587,25 @@ class ThreadAlloc {
     void* realloc(void* p, size_t o, size_t n);
 
   private:
+    // push a block to a remote-free list, it is called by other threads
+    template <typename T>
+    static void xpush(T** head, T* x);
+
+    // pop all blocks from a remote-free list, and drain memory freed in them
+    template <typename T>
+    void xdrain(T** head, co::clist& l);
+
     union { LargeBlock* _lb; co::clist _llb; };
     union { LargeAlloc* _la; co::clist _lla; };
     union { SmallAlloc* _sa; co::clist _lsa; };
     uint32 _id;
     StaticAllocator _ka;
+
+    // Remote-free lists, blocks with memory freed by other threads. A block is 
+    // pushed by the first thread that frees memory in it after it was drained, 
+    // and the owner drains them in a batch when the current block is full.
+    SmallAlloc* _xsa;
+    LargeAlloc* _xla;
 };
 
 
@@ -601,6 +687,31 @@ inline SmallAlloc* make_small_alloc(LargeBlock* lb, ThreadAlloc* ta) {
     return p ? new(p) SmallAlloc(lb, ta) : NULL;
 }
 
+template <typename T>
+inline void ThreadAlloc::xpush(T** head, T* x) {
+    T* h = atomic_load(head, mo_relaxed);
+    for (;;) {
+        x->set_xnext(h);
+        T* const o = atomic_cas(head, h, x, mo_release, mo_relaxed);
+        if (o == h) return;
+        h = o;
+    }
+}
+
+// A block that becomes empty is moved to the front of the list, it will be used 
+// as the current block. Empty blocks are not released here, as the producer is 
+// likely to fill them again soon.
+template <typename T>
+inline void ThreadAlloc::xdrain(T** head, co::clist& l) {
+    T* x = atomic_swap(head, (T*)0, mo_acquire);
+    while (x) {
+        // the block may be pushed again once it is drained
+        T* const next = x->xnext();
+        if (x->xdrain() && x != (T*)l.front()) l.move_front(x);
+        x = next;
+    }
+}
+
 inline void* ThreadAlloc::alloc(size_t n) {
     void* p = 0;
     SmallAlloc* sa;
@@ -608,6 +719,11 @@ inline void* ThreadAlloc::alloc(size_t n) {
         const uint32 u = n > 16 ? god::b16((uint32)n) : 1;
         if (_sa && (p = _sa->alloc(u))) goto end;
 
+        if (atomic_load(&_xsa, mo_relaxed)) {
+            this->xdrain(&_xsa, _lsa);
+            if ((p = _sa->alloc(u))) goto end;
+        }
+
         if (_sa && _sa->next) {
             _try_alloc(_lsa, 4, k) {
                 if ((p = ((SmallAlloc*)k)->try_hard_alloc(u))) {
@@ -649,6 +765,11 @@ inline void* ThreadAlloc::alloc(size_t n) {
         const uint32 u = god::b4k((uint32)n);
         if (_la && (p = _la->alloc(u))) goto end;
 
+        if (atomic_load(&_xla, mo_relaxed)) {
+            this->xdrain(&_xla, _lla);
+            if ((p = _la->alloc(u))) goto end;
+        }
+
         if (_la && _la->next) {
             _try_alloc(_lla, 4, k) {
                 if ((p = ((LargeAlloc*)k)->try_hard_alloc(u))) {
@@ -681,7 +802,8 @@ inline void ThreadAlloc::free(void* p, size_t n) {
             const auto sa = (SmallAlloc*) god::align_down<1u << g_sb_bits>(p);
             const auto ta = sa->thread_alloc();
             if (ta == this) {
-                if (sa->free(p) && sa != _sa) {
+                // blocks in the remote-free list are not released
+                if (sa->free(p) && sa != _sa && !sa->xmarked()) {
                     _lsa.erase(sa);
                     const auto lb = sa->parent();
                     if (lb->free(sa) && lb != _lb) {
@@ -690,6 +812,7 @@ inline void ThreadAlloc::free(void* p, size_t n) {
                     }
                 }
             } else {
+                if (sa->xmark()) xpush(&ta->_xsa, sa);
                 sa->xfree(p);
             }
 
@@ -697,11 +820,12 @@ inline void ThreadAlloc::free(void* p, size_t n) {
             const auto la = (LargeAlloc*) god::align_down<1u << g_lb_bits>(p);
             const auto ta = la->thread_alloc();
             if (ta == this) {
-                if (la->free(p) && la != _la) {
+                if (la->free(p) && la != _la && !la->xmarked()) {
                     _lla.erase(la);
                     galloc()->free(la, la->parent(), _id);
                 }
             } else {
+                if (la->xmark()) xpush(&ta->_xla, la);
                 la->xfree(p);
             }
 
@@ -445,25 +445,61 @@ inline const char* status_str(int n) {
 }
 
 
-inline void http_req_t::add_header(uint32 k, uint32 v) {
-    if (arr_cap < arr_size + 2) {
-        arr = (uint32*) co::realloc(arr, arr_cap << 2, (arr_cap + 32) << 2);
+inline bool header_eq(const char* a, const char* b) {
+    for (; *a; ++a, ++b) {
+        if (*a != *b && ::tolower((uint8)*a) != ::tolower((uint8)*b)) return false;
+    }
+    return *b == '\0';
+}
+
+struct known_headers_t {
+    known_headers_t() {
+        for (int i = 0; i < kKnownHeaders; ++i) hash[i] = header_hash(name[i], strlen(name[i]));
+    }
+
+    // which known header the key is, or -1
+    int find(const char* key, uint32 h) const {
+        for (int i = 0; i < kKnownHeaders; ++i) {
+            if (hash[i] == h && header_eq(key, name[i])) return i;
+        }
+        return -1;
+    }
+
+    const char* name[kKnownHeaders] = {
+        "Content-Length", "Connection", "Transfer-Encoding", "Host", "Expect"
+    };
+    uint32 hash[kKnownHeaders];
+};
+
+inline const known_headers_t& known_headers() {
+    static known_headers_t k;
+    return k;
+}
+
+inline void http_req_t::add_header(uint32 k, uint32 v, uint32 h) {
+    if (arr_cap < arr_size + 3) {
+        arr = (uint32*) co::realloc(arr, arr_cap << 2, (arr_cap + 48) << 2);
         assert(arr);
-        arr_cap += 32;
+        arr_cap += 48;
     }
     arr[arr_size++] = k;
     arr[arr_size++] = v;
+    arr[arr_size++] = h;
+
+    // the first one wins if a header appears more than once
+    const int i = known_headers().find(buf->data() + k, h);
+    if (i >= 0 && known[i] == 0) known[i] = v;
 }
 
 const char* http_req_t::header(const char* key) const {
-    fastring& s = fastring_cache();
-    fastring x(key);
-    x.toupper();
+    const uint32 h = header_hash(key, strlen(key));
+    const int k = known_headers().find(key, h);
+    if (k >= 0) return this->header((KnownHeader)k);
 
-    for (uint32 i = 0; i < arr_size; i += 2) {
-        s.clear();
-        s.append(buf->data() + arr[i]).toupper();
-        if (s == x) return buf->data() + arr[i + 1];
+    for (uint32 i = 0; i < arr_size; i += 3) {
+        if (arr[i + 2] == h && header_eq(buf->data() + arr[i], key)) {
+            return buf->data() + arr[i + 1];
+        }
     }
 
     static const char* e = "";
@@ -522,6 +558,7 @@ Res::~Res() {
 int parse_http_headers(fastring* buf, size_t size, size_t x, http_req_t* req) {
     fastring& m = *buf;
     size_t p, k, v;
+    uint32 h;
 
     while (x < size) {
         p = m.find('\r', x, size - x); // header end
@@ -532,8 +569,9 @@ int parse_http_headers(fastring* buf, size_t size, size_t x, http_req_t* req) {
         v = m.find(':', x, p - x);
         if (v == m.npos) return 400;
         m[v] = '\0'; // make key null-terminated
+        h = header_hash(m.data() + k, v - k);
         while (m[++v] == ' ');
-        req->add_header((uint32)k, (uint32)v);
+        req->add_header((uint32)k, (uint32)v, h);
 
         x = p + 2;
     }
@@ -589,7 +627,7 @@ int parse_http_req(fastring* buf, size_t size, http_req_t* req) {
     }
 
     { /* parse body size */
-        const char* v = req->header("CONTENT-LENGTH");
+        const char* v = req->header(kContentLength);
         if (*v == '\0' || *v == '0') {
             req->body_size = 0;
             return 0;
@@ -764,7 +802,7 @@ void ServerImpl::on_connection(tcp::Connection conn) {
                 goto handle_req;
 
             } else {
-                const char* const te = preq->header("Transfer-Encoding");
+                const char* const te = preq->header(kTransferEncoding);
                 if (!*te) {
                     total_len = pos + 4;
                     goto handle_req; // no Transfer-Encoding
@@ -777,7 +815,7 @@ void ServerImpl::on_connection(tcp::Connection conn) {
 
             { /* chunked Transfer-Encoding */
                 // see https://datatracker.ietf.org/doc/html/rfc2616#section-3.6.1
-                const bool expect_100_continue = strcmp(preq->header("Expect"), "100-continue") == 0;
+                const bool expect_100_continue = strcmp(preq->header(kExpect), "100-continue") == 0;
                 size_t x, o, i, n = 0;
                 const size_t hlen = pos + 4; // header length
                 fastring s(128);
@@ -861,7 +899,7 @@ void ServerImpl::on_connection(tcp::Connection conn) {
         { /* handle the http request */
             bool need_close = false;
             fastring s(4096);
-            s.append(preq->header("Connection"));
+            s.append(preq->header(kConnection));
             if (!s.empty()) pres->add_header("Connection", s.c_str());
 
             if (preq->version != kHTTP10) {
@@ -4,18 +4,44 @@
 
 namespace http {
 
+// headers looked up by the server itself, they are indexed when parsed
+enum KnownHeader {
+    kContentLength = 0,
+    kConnection,
+    kTransferEncoding,
+    kHost,
+    kExpect,
+    kKnownHeaders,
+};
+
+// case-insensitive hash of a header name, letters are hashed in lower case
+inline uint32 header_hash(const char* s, size_t n) {
+    uint32 h = 2166136261u;
+    for (size_t i = 0; i < n; ++i) h = (h ^ (uint8)(s[i] | 0x20)) * 16777619u;
+    return h;
+}
+
 struct http_req_t {
     http_req_t() = delete;
     ~http_req_t() = delete;
 
-    void add_header(uint32 k, uint32 v);
+    // @k, @v: offset of the key and value in buf, @h: header_hash() of the key
+    void add_header(uint32 k, uint32 v, uint32 h);
+
+    // return a null-terminated value of the header, or "" if it is not found.
+    // The key is case-insensitive.
     const char* header(const char* key) const;
 
+    const char* header(KnownHeader h) const {
+        return known[h] ? buf->data() + known[h] : "";
+    }
+
     void clear() {
         body_size = 0;
         url.clear();
         buf = 0;
         arr_size = 0;
+        memset(known, 0, sizeof(known));
     }
 
     // DO NOT change orders of the members here.
@@ -25,9 +51,10 @@ struct http_req_t {
     uint32 body_size;
     fastring url;
     fastring* buf; // http data: | header | \r\n\r\n | body |
-    uint32* arr;   // array of header index: [<k,v>]
+    uint32* arr;   // array of header index: [<k,v,hash>]
     uint32 arr_size;
     uint32 arr_cap;
+    uint32 known[kKnownHeaders]; // offset of values of known headers, 0 if not present
 };
 
 struct http_res_t {
@@ -61,7 +88,7 @@ struct http_res_t {
     size_t body_size;
 };
 
-int parse_http_req(fastring* buf, size_t size, http_req_t* req);
+__coapi int parse_http_req(fastring* buf, size_t size, http_req_t* req);
 void send_error_message(int err, http_res_t* res, void* conn);
 
 } // http
@@ -9,6 +9,7 @@
 #include "co/str.h"
 #include "co/time.h"
 #include "co/hash.h"
+#include "co/thread.h"
 
 DEF_int32(rpc_max_msg_size, 8 << 20, ">>#2 max size of rpc message, default: 8M");
 DEF_int32(rpc_recv_timeout, 3000, ">>#2 recv timeout in ms");
@@ -17,6 +18,7 @@ DEF_int32(rpc_conn_timeout, 3000, ">>#2 connect timeout in ms");
 DEF_int32(rpc_conn_idle_sec, 180, ">>#2 connection may be closed if no data was recieved for n seconds");
 DEF_int32(rpc_max_idle_conn, 128, ">>#2 max idle connections");
 DEF_bool(rpc_log, true, ">>#2 enable rpc log if true");
+DEF_uint32(rpc_max_inflight, 0, ">>#2 max requests with ids processed concurrently on a connection, 0: one by one");
 DEC_uint32(http_max_header_size);
 
 #define RPCLOG LOG_IF(FLG_rpc_log)
@@ -24,19 +26,69 @@ DEC_uint32(http_max_header_size);
 namespace rpc {
 
 struct Header {
-    uint16 flags; // reserved, 0
+    uint16 flags; // 0 for JSON, or kBinary and kError
     uint16 magic; // 0x7777
     uint32 len;   // body len
 }; // 8 bytes
 
 static const uint16 kMagic = 0x7777;
+static const uint16 kBinary = 1; // the body is in the binary encoding
+static const uint16 kError = 2;  // the body of a binary response is an error message
+static const uint16 kId = 4;     // a request id follows the header, it is sent back with the response
 
-inline void set_header(const void* header, uint32 msg_len) {
-    ((Header*)header)->flags = 0;
+// length of the header and the request id
+static const uint32 kIdHeaderLen = sizeof(Header) + sizeof(uint32);
+
+inline void set_header(const void* header, uint32 msg_len, uint16 flags=0) {
+    ((Header*)header)->flags = hton16(flags);
     ((Header*)header)->magic = kMagic;
     ((Header*)header)->len = hton32(msg_len);
 }
 
+// the id is opaque to the server, it is sent back as it is
+inline void set_id(const void* header, uint32 id) {
+    memcpy((char*)header + sizeof(Header), &id, sizeof(id));
+}
+
+// name of the method of a binary request, or '#' and the id, for logs
+inline fastring method_of(const char* p) {
+    if (*p) return fastring(p);
+    uint32 id;
+    memcpy(&id, p + 1, sizeof(id));
+    fastring s(16);
+    s << '#' << ntoh32(id);
+    return s;
+}
+
+// A connection whose requests are processed concurrently. The reader, the writer
+// and coroutines processing the requests run in the same scheduler, so there is
+// no lock. It is allocated on heap, as they do not share the stack.
+struct ConnCtx {
+    ConnCtx(tcp::Connection&& c, uint32 max)
+        : conn(std::move(c)), n(0), max(max), down(false), err(false) {
+    }
+
+    tcp::Connection conn;
+    fastream wbuf;     // responses to be sent
+    co::Event wev;     // responses are queued, or the connection is going down
+    co::Event wend;    // the writer exits
+    co::Event slot;    // a request in flight is done
+    co::WaitGroup wg;  // requests in flight
+    uint32 n;          // number of requests in flight
+    uint32 max;        // max requests in flight, rpc_max_inflight when the connection started
+    bool down;         // no more responses will be queued
+    bool err;          // send error
+};
+
+// a request processed in its own coroutine
+struct ConnReq {
+    ConnCtx* ctx;
+    fastring body;     // body of a binary request
+    Json req;          // JSON request
+    uint32 id;
+    uint16 flags;
+};
+
 class ServerImpl {
   public:
     static void ping(Json&, Json& res) {
@@ -47,6 +99,7 @@ class ServerImpl {
         using std::placeholders::_1;
         using std::placeholders::_2;
         _methods["ping"] = &ServerImpl::ping;
+        this->build_bin_ids();
     }
 
     ~ServerImpl() = default;
@@ -56,15 +109,46 @@ class ServerImpl {
         for (auto& x : s->methods()) {
             _methods[x.first] = x.second;
         }
+        auto b = s->bin_methods();
+        if (b) {
+            for (auto& x : *b) _bin_methods[x.first] = x.second;
+            this->build_bin_ids();
+        }
     }
 
+    // build the table of binary methods indexed by id
+    void build_bin_ids();
+
     Service::Fun* find_method(const char* name) {
         auto it = _methods.find(name);
         return it != _methods.end() ? &it->second : nullptr;
     }
 
+    Service::BinFun* find_bin_method(const char* name) {
+        auto it = _bin_methods.find(name);
+        return it != _bin_methods.end() ? &it->second : nullptr;
+    }
+
+    Service::BinFun* find_bin_method(uint32 id) {
+        for (uint32 i = id & _bin_mask;; i = (i + 1) & _bin_mask) {
+            const BinSlot& x = _bin_ids[i];
+            if (x.fun == 0) return nullptr;
+            if (x.id == id) return x.fun > 0 ? &_bin_funs[x.fun - 1] : nullptr;
+        }
+    }
+
     void on_connection(tcp::Connection conn);
 
+    // process requests of @conn concurrently, at most @max of them are in flight,
+    // the first one is in @buf
+    void serve(tcp::Connection& conn, uint32 max, uint16 flags, uint32 id, fastring& buf);
+
+    // process a request and queue the response
+    void handle(ConnReq* q);
+
+    // send responses queued
+    void write(ConnCtx* x);
+
     void start(const char* ip, int port, const char* url, const char* key, const char* ca) {
         _url = url;
         atomic_store(&_started, true, mo_relaxed);
@@ -82,15 +166,54 @@ class ServerImpl {
 
     void process(Json& req, Json& res);
 
+    // process a binary request, return flags of the response
+    uint16 process(const char* p, size_t n, fastream& res);
+
   private:
     tcp::Server _tcp_serv;
     bool _started;
     bool _stopped;
     co::hash_map<const char*, std::shared_ptr<Service>> _services;
     co::hash_map<const char*, Service::Fun> _methods;
+    co::hash_map<const char*, Service::BinFun> _bin_methods;
+
+    // Binary methods called by id, see method_id(). _bin_ids is an open addressing
+    // table with at least half of the slots empty. fun is 0 for empty slots, the
+    // index of the method in _bin_funs plus 1, or -1 if more than one method have
+    // the id. Methods with the same id can be called by name only.
+    struct BinSlot {
+        uint32 id;
+        int32 fun;
+    };
+    co::vector<Service::BinFun> _bin_funs;
+    co::vector<BinSlot> _bin_ids;
+    uint32 _bin_mask;
     fastring _url;
 };
 
+void ServerImpl::build_bin_ids() {
+    size_t n = 8;
+    while (n < _bin_methods.size() * 2) n <<= 1;
+    _bin_funs.clear();
+    _bin_ids.assign(n, BinSlot{ 0, 0 });
+    _bin_mask = (uint32)(n - 1);
+
+    for (auto& x : _bin_methods) {
+        const uint32 id = method_id(x.first);
+        uint32 i = id & _bin_mask;
+        while (_bin_ids[i].fun != 0 && _bin_ids[i].id != id) i = (i + 1) & _bin_mask;
+        BinSlot& s = _bin_ids[i];
+        if (s.fun != 0) {
+            ELOG << "rpc method id conflicts: " << x.first << ", it can be called by name only";
+            s.fun = -1;
+            continue;
+        }
+        _bin_funs.push_back(x.second);
+        s.id = id;
+        s.fun = (int32)_bin_funs.size();
+    }
+}
+
 Server::Server() {
     _p = co::make<ServerImpl>();
 }
@@ -130,6 +253,41 @@ void ServerImpl::process(Json& req, Json& res) {
     }
 }
 
+// The body of a binary request is the name of the method ending with '\0', or
+// '\0' and the id of the method in 4 bytes, followed by the encoded request. The
+// body of the response is the encoded response, or an error message if kError
+// is set.
+uint16 ServerImpl::process(const char* p, size_t n, fastream& res) {
+    const size_t pos = res.size();
+    const char* err = "bad req: no api";
+    const char* e = (const char*) memchr(p, '\0', n);
+    Service::BinFun* m = nullptr;
+    if (e == p && n > sizeof(uint32)) {
+        uint32 id;
+        memcpy(&id, p + 1, sizeof(id));
+        id = ntoh32(id);
+        RPCLOG << "rpc recv binary req: #" << id << ", len: " << n;
+        m = this->find_bin_method(id);
+        e += sizeof(id);
+    } else if (e) {
+        RPCLOG << "rpc recv binary req: " << p << ", len: " << n;
+        m = this->find_bin_method(p);
+    }
+    if (e) {
+        if (m) {
+            Reader r(e + 1, n - (e + 1 - p));
+            Writer w(res);
+            if ((*m)(r, w)) return kBinary;
+            res.resize(pos);
+            err = "bad req: decode failed";
+        } else {
+            err = "api not found";
+        }
+    }
+    res.append(err);
+    return kBinary | kError;
+}
+
 using http::http_req_t;
 using http::http_res_t;
 
@@ -140,7 +298,10 @@ void ServerImpl::on_connection(tcp::Connection conn) {
         Header header;
         char c;
     };
+    uint16 flags = 0;
+    uint32 id = 0, hlen = 0, max = 0;
     fastring buf;
+    fastream out;
     Json req, res;
 
     size_t pos = 0, total_len = 0;
@@ -187,12 +348,42 @@ void ServerImpl::on_connection(tcp::Connection conn) {
             len = ntoh32(header.len);
             if (unlikely(len > FLG_rpc_max_msg_size)) goto msg_too_long_err;
 
+            flags = ntoh16(header.flags);
+            hlen = sizeof(Header);
+            if (flags & kId) {
+                r = conn.recvn(&id, sizeof(id), FLG_rpc_recv_timeout);
+                if (unlikely(r == 0)) goto recv_zero_err;
+                if (unlikely(r < 0)) goto recv_err;
+                hlen = kIdHeaderLen;
+            }
+
             if (buf.capacity() == 0) buf.reserve(4096);
             buf.resize(len);
             r = conn.recvn((char*)buf.data(), len, FLG_rpc_recv_timeout);
             if (unlikely(r == 0)) goto recv_zero_err;
             if (unlikely(r < 0)) goto recv_err;
 
+            // requests with ids may be processed concurrently
+            if ((flags & kId) && (max = FLG_rpc_max_inflight) > 0) {
+                this->serve(conn, max, flags, id, buf);
+                goto end;
+            }
+
+            // reply in the encoding of the request
+            if (flags & kBinary) {
+                out.resize(hlen);
+                const uint16 f = this->process(buf.data(), buf.size(), out);
+                set_header(out.data(), (uint32)(out.size() - hlen), f | (flags & kId));
+                if (flags & kId) set_id(out.data(), id);
+
+                r = conn.send(out.data(), (int)out.size(), FLG_rpc_send_timeout);
+                if (unlikely(r <= 0)) goto send_err;
+                RPCLOG << "rpc send binary res, len: " << (out.size() - hlen);
+
+                if (_stopped) goto reset_conn;
+                goto recv_rpc_beg;
+            }
+
             req = json::parse(buf.data(), buf.size());
             if (req.is_null()) goto json_parse_err;
             RPCLOG << "rpc recv req: " << req;
@@ -201,9 +392,10 @@ void ServerImpl::on_connection(tcp::Connection conn) {
             res.reset();
             this->process(req, res);
 
-            buf.resize(sizeof(Header));
+            buf.resize(hlen);
             res.str(buf);
-            set_header(buf.data(), (uint32)(buf.size() - sizeof(Header)));
+            set_header(buf.data(), (uint32)(buf.size() - hlen), flags & kId);
+            if (flags & kId) set_id(buf.data(), id);
             
             r = conn.send(buf.data(), (int)buf.size(), FLG_rpc_send_timeout);
             if (unlikely(r <= 0)) goto send_err;
@@ -302,7 +494,7 @@ void ServerImpl::on_connection(tcp::Connection conn) {
                 bool need_close = false;
                 fastring x;
                 fastring s(4096);
-                s.append(preq->header("Connection"));
+                s.append(preq->header(http::kConnection));
                 if (!s.empty()) pres->add_header("Connection", s.c_str());
 
                 if (preq->version != http::kHTTP10) {
@@ -384,6 +576,157 @@ void ServerImpl::on_connection(tcp::Connection conn) {
     if (pres) co::free(pres, sizeof(*pres));
 }
 
+void ServerImpl::serve(tcp::Connection& conn, uint32 max, uint16 flags, uint32 id, fastring& buf) {
+    int r = 0, len = 0;
+    Header header;
+    bool reset = true;
+    ConnReq* q;
+    auto sched = co::scheduler();
+    ConnCtx* x = co::make<ConnCtx>(std::move(conn), max);
+    x->wg.add(); // the reader, the counter must not reach 0 before it ends
+    sched->go(&ServerImpl::write, this, x);
+
+    while (true) {
+        // wait for a slot, and process the request in its own coroutine
+        while (x->n >= x->max) x->slot.wait();
+        if (x->err) goto end;
+
+        q = co::make<ConnReq>();
+        q->ctx = x;
+        q->id = id;
+        q->flags = flags;
+        if (flags & kBinary) {
+            q->body.swap(buf);
+        } else {
+            q->req = json::parse(buf.data(), buf.size());
+            if (q->req.is_null()) { co::del(q); goto json_parse_err; }
+            RPCLOG << "rpc recv req: " << q->req;
+        }
+        ++x->n;
+        x->wg.add();
+        sched->go(&ServerImpl::handle, this, q);
+        if (_stopped) goto end;
+
+        // recv the next request
+        while (true) {
+            r = x->conn.recvn(&header, sizeof(header), FLG_rpc_conn_idle_sec * 1000);
+            if (unlikely(r == 0)) goto recv_zero_err;
+            if (r > 0) break;
+            if (!co::timeout()) goto recv_err;
+            if (_stopped || x->err) goto end;
+            if (x->n == 0 && _tcp_serv.conn_num() > FLG_rpc_max_idle_conn) goto idle_err;
+        }
+
+        if (unlikely(header.magic != kMagic)) goto magic_err;
+
+        len = ntoh32(header.len);
+        if (unlikely(len > FLG_rpc_max_msg_size)) goto msg_too_long_err;
+
+        flags = ntoh16(header.flags);
+        if (unlikely(!(flags & kId))) goto no_id_err;
+        r = x->conn.recvn(&id, sizeof(id), FLG_rpc_recv_timeout);
+        if (unlikely(r == 0)) goto recv_zero_err;
+        if (unlikely(r < 0)) goto recv_err;
+
+        if (buf.capacity() == 0) buf.reserve(4096);
+        buf.resize(len);
+        r = x->conn.recvn((char*)buf.data(), len, FLG_rpc_recv_timeout);
+        if (unlikely(r == 0)) goto recv_zero_err;
+        if (unlikely(r < 0)) goto recv_err;
+    }
+
+  recv_zero_err:
+    // the client may wait for responses of requests in flight
+    LOG << "rpc client close the connection, connfd: " << x->conn.socket();
+    reset = false;
+    goto end;
+  idle_err:
+    ELOG << "rpc close idle connection, connfd: " << x->conn.socket();
+    goto end;
+  magic_err:
+    ELOG << "rpc recv error: bad magic number";
+    goto end;
+  msg_too_long_err:
+    ELOG << "rpc recv error: body too long: " << len;
+    goto end;
+  no_id_err:
+    ELOG << "rpc recv error: no request id";
+    goto end;
+  recv_err:
+    ELOG << "rpc recv error: " << x->conn.strerror();
+    goto end;
+  json_parse_err:
+    ELOG << "rpc json parse error: " << buf;
+    goto end;
+  end:
+    // wait for requests in flight, and for the writer to send their responses
+    x->wg.done();
+    x->wg.wait();
+    x->down = true;
+    x->wev.signal();
+    x->wend.wait();
+    if (reset || x->err) {
+        x->conn.reset(3000);
+    } else {
+        x->conn.close();
+    }
+    co::del(x);
+}
+
+void ServerImpl::handle(ConnReq* q) {
+    ConnCtx* const x = q->ctx;
+    uint16 f = 0;
+    fastream s(256);
+    s.resize(kIdHeaderLen);
+    if (q->flags & kBinary) {
+        f = this->process(q->body.data(), q->body.size(), s);
+        RPCLOG << "rpc send binary res, len: " << (s.size() - kIdHeaderLen);
+    } else {
+        Json res;
+        this->process(q->req, res);
+        res.str(s);
+        RPCLOG << "rpc send res: " << res;
+    }
+    set_header(s.data(), (uint32)(s.size() - kIdHeaderLen), f | kId);
+    set_id(s.data(), q->id);
+    co::del(q);
+
+    if (x->wbuf.empty()) {
+        x->wbuf.swap(s);
+    } else {
+        x->wbuf.append(s.data(), s.size());
+    }
+    x->wev.signal();
+    if (x->n-- == x->max) x->slot.signal();
+    x->wg.done();
+}
+
+void ServerImpl::write(ConnCtx* x) {
+    int r;
+    fastream s(4096);
+    while (true) {
+        if (x->wbuf.empty()) {
+            if (x->down) break;
+            x->wev.wait();
+            continue;
+        }
+
+        // responses queued while sending are sent in the next batch
+        s.swap(x->wbuf);
+        if (!x->err) {
+            r = x->conn.send(s.data(), (int)s.size(), FLG_rpc_send_timeout);
+            if (unlikely(r <= 0)) {
+                ELOG << "rpc send error: " << x->conn.strerror();
+                x->err = true;
+                // wake up the reader, it may be waiting for the next request
+                co::shutdown(x->conn.socket());
+            }
+        }
+        s.clear();
+    }
+    x->wend.signal();
+}
+
 class ClientImpl {
   public:
     ClientImpl(const char* ip, int port, bool use_ssl)
@@ -398,6 +741,20 @@ class ClientImpl {
 
     void call(const Json& req, Json& res);
 
+    fastream& buffer(const char* api) {
+        _fs.resize(sizeof(Header));
+        _fs.append(api).append('\0');
+        return _fs;
+    }
+
+    fastream& buffer(uint32 method) {
+        _fs.resize(sizeof(Header));
+        _fs.append('\0').append(hton32(method));
+        return _fs;
+    }
+
+    bool call();
+
     void close() {
         _tcp_cli.disconnect();
     }
@@ -407,6 +764,10 @@ class ClientImpl {
     fastream _fs;
 
     bool connect();
+
+    // send the request in _fs, and receive the body of the response into it
+    //   - @flags: flags of the request, it is set to flags of the response.
+    bool request(uint16* flags);
 };
 
 Client::Client(const char* ip, int port, bool use_ssl) {
@@ -425,6 +786,18 @@ void Client::call(const Json& req, Json& res) {
     return ((ClientImpl*)_p)->call(req, res);
 }
 
+fastream& Client::buffer(const char* api) {
+    return ((ClientImpl*)_p)->buffer(api);
+}
+
+fastream& Client::buffer(uint32 method) {
+    return ((ClientImpl*)_p)->buffer(method);
+}
+
+bool Client::call() {
+    return ((ClientImpl*)_p)->call();
+}
+
 void Client::close() {
     return ((ClientImpl*)_p)->close();
 }
@@ -439,20 +812,44 @@ bool ClientImpl::connect() {
 }
 
 void ClientImpl::call(const Json& req, Json& res) {
+    uint16 flags = 0;
+    _fs.resize(sizeof(Header));
+    req.str(_fs);
+    RPCLOG << "rpc send req: " << req;
+    if (!this->request(&flags)) return;
+
+    res = json::parse(_fs.c_str(), _fs.size());
+    if (res.is_null()) {
+        ELOG << "rpc json parse error: " << _fs;
+        _tcp_cli.disconnect();
+        return;
+    }
+    RPCLOG << "rpc recv res: " << res;
+}
+
+bool ClientImpl::call() {
+    uint16 flags = kBinary;
+    RPCLOG << "rpc send binary req: " << method_of(_fs.data() + sizeof(Header));
+    if (!this->request(&flags)) return false;
+
+    if (flags & kError) {
+        ELOG << "rpc error: " << _fs;
+        return false;
+    }
+    RPCLOG << "rpc recv binary res, len: " << _fs.size();
+    return true;
+}
+
+bool ClientImpl::request(uint16* flags) {
     int r = 0, len = 0;
     Header header;
-    if (!_tcp_cli.connected() && !this->connect()) return;
+    if (!_tcp_cli.connected() && !this->connect()) return false;
 
     // send request
     do {
-        _fs.resize(sizeof(Header));
-        req.str(_fs);
-        set_header((void*)_fs.data(), (uint32)(_fs.size() - sizeof(Header)));
-
+        set_header((void*)_fs.data(), (uint32)(_fs.size() - sizeof(Header)), *flags);
         r = _tcp_cli.send(_fs.data(), (int)_fs.size(), FLG_rpc_send_timeout);
         if (unlikely(r <= 0)) goto send_err;
-
-        RPCLOG << "rpc send req: " << req;
     } while (0);
 
     // wait for response
@@ -470,10 +867,8 @@ void ClientImpl::call(const Json& req, Json& res) {
         if (unlikely(r == 0)) goto recv_zero_err;
         if (unlikely(r < 0)) goto recv_err;
 
-        res = json::parse(_fs.c_str(), _fs.size());
-        if (res.is_null()) goto json_parse_err;
-        RPCLOG << "rpc recv res: " << res;
-        return;
+        *flags = ntoh16(header.flags);
+        return true;
     } while (0);
 
   magic_err:
@@ -491,11 +886,306 @@ void ClientImpl::call(const Json& req, Json& res) {
   send_err:
     ELOG << "rpc send error: " << _tcp_cli.strerror();
     goto err_end;
-  json_parse_err:
-    ELOG << "rpc json parse error: " << _fs;
-    goto err_end;
   err_end:
     _tcp_cli.disconnect();
+    return false;
+}
+
+// A call in flight of MuxClient. It is allocated on heap, as the stack of the
+// waiting coroutine may be used by other coroutines.
+struct MuxCall {
+    MuxCall() : flags(0), ok(false) {}
+    co::Event ev;
+    fastream buf; // body of the response
+    uint16 flags; // flags of the response
+    bool ok;
+};
+
+class MuxClientImpl {
+  public:
+    MuxClientImpl(const char* ip, int port, bool use_ssl)
+        : _tcp_cli(ip, port, use_ssl), _id(0), _state(0), _stop(false), _down(false) {
+    }
+
+    ~MuxClientImpl() { this->close(); }
+
+    bool call(fastream& s, bool bin);
+
+    void close();
+
+  private:
+    // make the connection and read responses, until the connection is broken
+    void run();
+
+    // send requests queued by the callers
+    void write();
+
+    // wake up the caller waiting for the response with the @id
+    void done(uint32 id, uint16 flags, const char* p, size_t n);
+
+    // fail calls in flight, the connection is gone
+    void fail();
+
+    tcp::Client _tcp_cli;
+    ::Mutex _m;
+    co::hash_map<uint32, MuxCall*> _calls;
+    fastream _wbuf;  // requests to be sent
+    co::Event _wev;  // requests are queued, or the connection is going down
+    co::Event _wend; // the writer exits
+    co::Event _end;  // the connection is gone
+    uint32 _id;
+    int _state;      // 0: no connection, 1: connecting or connected
+    bool _stop;      // close() was called
+    bool _down;      // the connection is going down
+};
+
+bool MuxClientImpl::call(fastream& s, bool bin) {
+    uint32 id;
+    bool start = false;
+    MuxCall* c = co::make<MuxCall>();
+    {
+        ::MutexGuard g(_m);
+        if (_stop) {
+            co::del(c);
+            ELOG << "rpc client was closed";
+            return false;
+        }
+        id = ++_id;
+        set_header(s.data(), (uint32)(s.size() - kIdHeaderLen), kId | (bin ? kBinary : 0));
+        set_id(s.data(), id);
+        _calls[id] = c;
+        _wbuf.append(s.data(), s.size());
+        if (_state == 0) {
+            _state = 1;
+            _down = false;
+            start = true;
+        }
+    }
+
+    if (start) {
+        auto sched = co::scheduler();
+        if (!sched) sched = co::next_scheduler();
+        sched->go(&MuxClientImpl::run, this);
+    }
+    _wev.signal();
+
+    if (!c->ev.wait(FLG_rpc_recv_timeout)) {
+        bool timeout;
+        {
+            ::MutexGuard g(_m);
+            timeout = _calls.erase(id) > 0;
+        }
+        if (timeout) {
+            co::del(c);
+            ELOG << "rpc recv error: timeout";
+            return false;
+        }
+        c->ev.wait(); // the response is being delivered
+    }
+
+    const bool ok = c->ok;
+    if (ok) {
+        s.swap(c->buf);
+        if (c->flags & kError) {
+            ELOG << "rpc error: " << s;
+            co::del(c);
+            return false;
+        }
+    }
+    co::del(c);
+    return ok;
+}
+
+void MuxClientImpl::done(uint32 id, uint16 flags, const char* p, size_t n) {
+    MuxCall* c;
+    {
+        ::MutexGuard g(_m);
+        auto it = _calls.find(id);
+        if (it == _calls.end()) return; // timed out
+        c = it->second;
+        _calls.erase(it);
+    }
+    c->buf.append(p, n);
+    c->flags = flags;
+    c->ok = true;
+    c->ev.signal();
+}
+
+void MuxClientImpl::fail() {
+    ::MutexGuard g(_m);
+    for (auto it = _calls.begin(); it != _calls.end(); ++it) it->second->ev.signal();
+    _calls.clear();
+    _wbuf.clear();
+    _state = 0;
+    _end.signal();
+}
+
+void MuxClientImpl::write() {
+    int r;
+    fastream s(4096);
+    for (;;) {
+        _wev.wait();
+        for (;;) {
+            {
+                ::MutexGuard g(_m);
+                if (_down || _stop) goto end;
+                s.swap(_wbuf);
+            }
+            if (s.empty()) break;
+
+            r = _tcp_cli.send(s.data(), (int)s.size(), FLG_rpc_send_timeout);
+            s.clear();
+            if (unlikely(r <= 0)) {
+                ELOG << "rpc send error: " << _tcp_cli.strerror();
+                goto end;
+            }
+        }
+    }
+
+  end:
+    {
+        ::MutexGuard g(_m);
+        _down = true;
+    }
+    // the server closes the connection then, and the reader will see it
+    co::shutdown(_tcp_cli.socket(), 'w');
+    _wend.signal();
+}
+
+void MuxClientImpl::run() {
+    int r;
+    uint16 flags;
+    uint32 len, id;
+    size_t pos = 0;
+    fastream b(8192);
+
+    if (!_tcp_cli.connect(FLG_rpc_conn_timeout)) {
+        ELOG << "rpc connect error: " << _tcp_cli.strerror();
+        this->fail();
+        return;
+    }
+    co::scheduler()->go(&MuxClientImpl::write, this);
+
+    for (;;) {
+        // responses in the buffer
+        while (b.size() - pos >= kIdHeaderLen) {
+            const Header* h = (const Header*)(b.data() + pos);
+            if (unlikely(h->magic != kMagic)) {
+                ELOG << "rpc recv error: bad magic number: " << h->magic;
+                goto end;
+            }
+            flags = ntoh16(h->flags);
+            if (unlikely(!(flags & kId))) {
+                ELOG << "rpc recv error: no request id, the server may not support it";
+                goto end;
+            }
+            len = ntoh32(h->len);
+            if (unlikely(len > (uint32)FLG_rpc_max_msg_size)) {
+                ELOG << "rpc recv error: body too long: " << len;
+                goto end;
+            }
+            if (b.size() - pos < kIdHeaderLen + len) {
+                b.reserve(pos + kIdHeaderLen + len);
+                break;
+            }
+            memcpy(&id, b.data() + pos + sizeof(Header), sizeof(id));
+            this->done(id, flags, b.data() + pos + kIdHeaderLen, len);
+            pos += kIdHeaderLen + len;
+        }
+
+        if (pos > 0) {
+            const size_t n = b.size() - pos;
+            if (n > 0) memmove((char*)b.data(), b.data() + pos, n);
+            b.resize(n);
+            pos = 0;
+        }
+        if (b.capacity() - b.size() < 1024) b.reserve(b.size() + 8192);
+
+        // wake up periodically to see if the writer is down
+        r = _tcp_cli.recv((char*)b.data() + b.size(), (int)(b.capacity() - b.size()), 1000);
+        if (r == 0) {
+            ::MutexGuard g(_m);
+            if (!_down && !_stop) ELOG << "rpc server close the connection..";
+            goto end;
+        }
+        if (r < 0) {
+            if (!co::timeout()) {
+                ELOG << "rpc recv error: " << _tcp_cli.strerror();
+                goto end;
+            }
+            ::MutexGuard g(_m);
+            if (_down || _stop) goto end;
+            continue;
+        }
+        b.resize(b.size() + r);
+    }
+
+  end:
+    {
+        ::MutexGuard g(_m);
+        _down = true;
+    }
+    _wev.signal();
+    _wend.wait();
+    _tcp_cli.disconnect();
+    this->fail();
+}
+
+void MuxClientImpl::close() {
+    {
+        ::MutexGuard g(_m);
+        _stop = true;
+    }
+    _wev.signal();
+    for (;;) {
+        {
+            ::MutexGuard g(_m);
+            if (_state == 0) break;
+        }
+        _end.wait(100);
+    }
+}
+
+MuxClient::MuxClient(const char* ip, int port, bool use_ssl) {
+    _p = co::make<MuxClientImpl>(ip, port, use_ssl);
+}
+
+MuxClient::~MuxClient() {
+    co::del((MuxClientImpl*)_p);
+}
+
+void MuxClient::begin(fastream& s, const char* api) {
+    s.resize(kIdHeaderLen);
+    s.append(api).append('\0');
+}
+
+void MuxClient::begin(fastream& s, uint32 method) {
+    s.resize(kIdHeaderLen);
+    s.append('\0').append(hton32(method));
+}
+
+bool MuxClient::call(fastream& s, bool bin) {
+    return ((MuxClientImpl*)_p)->call(s, bin);
+}
+
+bool MuxClient::call(const Json& req, Json& res) {
+    fastream s(256);
+    s.resize(kIdHeaderLen);
+    req.str(s);
+    RPCLOG << "rpc send req: " << req;
+    if (!((MuxClientImpl*)_p)->call(s, false)) return false;
+
+    res = json::parse(s.data(), s.size());
+    if (res.is_null()) {
+        ELOG << "rpc json parse error: " << s;
+        return false;
+    }
+    RPCLOG << "rpc recv res: " << res;
+    return true;
+}
+
+void MuxClient::close() {
+    ((MuxClientImpl*)_p)->close();
 }
 
 } // rpc
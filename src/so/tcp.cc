@@ -7,6 +7,10 @@
 #include "co/str.h"
 #include "co/time.h"
 
+#ifdef __linux__
+#include <linux/filter.h>
+#endif
+
 DEF_int32(ssl_handshake_timeout, 3000, ">>#2 ssl handshake timeout in ms");
 
 namespace tcp {
@@ -167,8 +171,8 @@ const char* Connection::strerror() const {
 class ServerImpl {
   public:
     ServerImpl()
-        : _started(false), _count(0), _fd((sock_t)-1), _connfd((sock_t)-1),
-          _ssl_ctx(0), _status(0) {
+        : _started(false), _reuseport(false), _steer(false), _count(0), 
+          _fd((sock_t)-1), _connfd((sock_t)-1), _ssl_ctx(0), _status(0), _nloops(0) {
     }
 
     ~ServerImpl() {
@@ -184,6 +188,16 @@ class ServerImpl {
         _exit_cb = std::move(cb);
     }
 
+    void reuse_port(bool steer) {
+      #ifdef __linux__
+        _reuseport = true;
+        _steer = steer;
+      #else
+        (void) steer;
+        WLOG << "SO_REUSEPORT mode is not supported on this platform";
+      #endif
+    }
+
     void start(const char* ip, int port, const char* key, const char* ca);
     void exit();
     bool started() const { return _started; }
@@ -201,6 +215,9 @@ class ServerImpl {
   private:
     void loop();
     void stop();
+    sock_t listen(bool reuseport);
+    void listen_all();
+    void accept_loop(sock_t fd);
     void on_tcp_connection(sock_t sock);
     void on_ssl_connection(sock_t sock);
 
@@ -208,6 +225,8 @@ class ServerImpl {
     fastring _ip;
     uint16 _port;
     bool _started;
+    bool _reuseport; // a listening socket with SO_REUSEPORT for each scheduler
+    bool _steer;     // steer connections to schedulers by CPU
     uint32 _count; // refcount
     sock_t _fd;
     sock_t _connfd;
@@ -216,6 +235,8 @@ class ServerImpl {
     std::function<void(sock_t)> _on_sock;
     void* _ssl_ctx;
     int _status;
+    uint32 _nloops; // accept loops running in the SO_REUSEPORT mode
+    co::vector<sock_t> _fds; // listening sockets in the SO_REUSEPORT mode
     int _addrlen;
     union {
         struct sockaddr_in  v4;
@@ -243,14 +264,16 @@ void ServerImpl::start(const char* ip, int port, const char* key, const char* ca
         CHECK_EQ(r, 1) << "ssl check private key error: " << ssl::strerror();
 
         _on_sock = std::bind(&ServerImpl::on_ssl_connection, this, std::placeholders::_1);
-        this->ref();
-        atomic_store(&_started, true, mo_relaxed);
-        go(&ServerImpl::loop, this);
     } else {
         _on_sock = std::bind(&ServerImpl::on_tcp_connection, this, std::placeholders::_1);
-        this->ref();
-        atomic_store(&_started, true, mo_relaxed);
+    }
+
+    this->ref();
+    atomic_store(&_started, true, mo_relaxed);
+    if (!_reuseport) {
         go(&ServerImpl::loop, this);
+    } else {
+        this->listen_all();
     }
 }
 
@@ -268,8 +291,59 @@ void ServerImpl::exit() {
 
 void ServerImpl::stop() {
     const char* ip = (_ip == "0.0.0.0" || _ip == "::") ? "127.0.0.1" : _ip.c_str();
-    tcp::Client c(ip, _port);
-    c.connect(-1);
+    if (!_reuseport) {
+        tcp::Client c(ip, _port);
+        c.connect(-1);
+        return;
+    }
+
+    // In the SO_REUSEPORT mode, a connection wakes up one of the listeners, 
+    // which then closes its socket and leaves the group. Connect again until 
+    // all the accept loops are stopped.
+    while (atomic_load(&_nloops) > 0) {
+        const uint32 n = atomic_load(&_nloops);
+        tcp::Client c(ip, _port);
+        c.connect(-1);
+        for (int i = 0; i < 100 && atomic_load(&_nloops) == n; ++i) co::sleep(1);
+    }
+}
+
+// create a socket listening on _ip:_port
+sock_t ServerImpl::listen(bool reuseport) {
+    fastring port = str::from(_port);
+    struct addrinfo* info = 0;
+    int r = getaddrinfo(_ip.c_str(), port.c_str(), NULL, &info);
+    CHECK_EQ(r, 0) << "invalid ip address: " << _ip << ':' << _port;
+    CHECK(info != NULL);
+
+    sock_t fd = co::tcp_socket(info->ai_family);
+    CHECK_NE(fd, (sock_t)-1) << "create socket error: " << co::strerror();
+    co::set_reuseaddr(fd);
+
+  #ifdef SO_REUSEPORT
+    if (reuseport) {
+        const int v = 1;
+        r = co::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &v, sizeof(v));
+        CHECK_EQ(r, 0) << "set SO_REUSEPORT error: " << co::strerror();
+    }
+  #else
+    (void) reuseport;
+  #endif
+
+    // turn off IPV6_V6ONLY
+    if (info->ai_family == AF_INET6) {
+        int on = 0;
+        co::setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(on));
+    }
+
+    r = co::bind(fd, info->ai_addr, (int)info->ai_addrlen);
+    CHECK_EQ(r, 0) << "bind " << _ip << ':' << _port << " failed: " << co::strerror();
+
+    r = co::listen(fd, 64 * 1024);
+    CHECK_EQ(r, 0) << "listen error: " << co::strerror();
+
+    freeaddrinfo(info);
+    return fd;
 }
 
 /**
@@ -279,32 +353,7 @@ void ServerImpl::stop() {
  *     the connection callback to handle the connection. 
  */
 void ServerImpl::loop() {
-    do {
-        fastring port = str::from(_port);
-        struct addrinfo* info = 0;
-        int r = getaddrinfo(_ip.c_str(), port.c_str(), NULL, &info);
-        CHECK_EQ(r, 0) << "invalid ip address: " << _ip << ':' << _port;
-        CHECK(info != NULL);
-
-        _fd = co::tcp_socket(info->ai_family);
-        CHECK_NE(_fd, (sock_t)-1) << "create socket error: " << co::strerror();
-        co::set_reuseaddr(_fd);
-
-        // turn off IPV6_V6ONLY
-        if (info->ai_family == AF_INET6) {
-            int on = 0;
-            co::setsockopt(_fd, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(on));
-        }
-
-        r = co::bind(_fd, info->ai_addr, (int)info->ai_addrlen);
-        CHECK_EQ(r, 0) << "bind " << _ip << ':' << _port << " failed: " << co::strerror();
-
-        r = co::listen(_fd, 64 * 1024);
-        CHECK_EQ(r, 0) << "listen error: " << co::strerror();
-
-        freeaddrinfo(info);
-    } while (0);
-
+    _fd = this->listen(false);
     LOG << "server start: " << _ip << ':' << _port;
     while (true) {
         _addrlen = sizeof(_addr);
@@ -333,6 +382,74 @@ void ServerImpl::loop() {
     this->unref();
 }
 
+/**
+ * start the server in the SO_REUSEPORT mode 
+ *   - Sockets are created in order of the schedulers, as the kernel indexes 
+ *     sockets in the reuseport group in the order they are bound, which is used 
+ *     by the steering program. 
+ */
+void ServerImpl::listen_all() {
+    auto& scheds = co::schedulers();
+    for (size_t i = 0; i < scheds.size(); ++i) _fds.push_back(this->listen(true));
+
+  #if defined(SO_ATTACH_REUSEPORT_CBPF) && defined(SKF_AD_CPU)
+    if (_steer) {
+        // return cpu % n, the index of the socket in the group
+        struct sock_filter code[] = {
+            { BPF_LD | BPF_W | BPF_ABS, 0, 0, (uint32)(SKF_AD_OFF + SKF_AD_CPU) },
+            { BPF_ALU | BPF_MOD | BPF_K, 0, 0, (uint32)scheds.size() },
+            { BPF_RET | BPF_A, 0, 0, 0 },
+        };
+        struct sock_fprog prog = { (unsigned short)(sizeof(code) / sizeof(code[0])), code };
+        if (co::setsockopt(_fds[0], SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) != 0) {
+            WLOG << "server " << _ip << ':' << _port << " attach steering program failed: " << co::strerror();
+        }
+    }
+  #endif
+
+    LOG << "server start: " << _ip << ':' << _port << ", listeners: " << _fds.size();
+    atomic_store(&_nloops, (uint32)_fds.size());
+    for (size_t i = 0; i < scheds.size(); ++i) {
+        scheds[i]->go(&ServerImpl::accept_loop, this, _fds[i]);
+    }
+}
+
+// accept loop of a scheduler in the SO_REUSEPORT mode
+void ServerImpl::accept_loop(sock_t fd) {
+    union {
+        struct sockaddr_in  v4;
+        struct sockaddr_in6 v6;
+    } addr;
+    auto s = co::scheduler();
+    while (true) {
+        int addrlen = sizeof(addr);
+        sock_t connfd = co::accept(fd, &addr, &addrlen);
+
+        if (unlikely(atomic_load(&_status) == 1)) {
+            if (connfd != (sock_t)-1) co::reset_tcp_socket(connfd);
+            break;
+        }
+
+        if (unlikely(connfd == (sock_t)-1)) {
+            WLOG << "server " << _ip << ':' << _port << " accept error: " << co::strerror();
+            continue;
+        }
+
+        const uint32 n = this->ref() - 1;
+        DLOG << "server " << _ip << ':' << _port
+             << " accept connection: " << co::to_string(&addr, addrlen)
+             << ", connfd: " << connfd << ", conn num: " << n;
+        s->go(&_on_sock, connfd);
+    }
+
+    co::close(fd);
+    if (atomic_dec(&_nloops) == 0) {
+        LOG << "server stopped: " << _ip << ':' << _port;
+        atomic_store(&_status, 2);
+        this->unref();
+    }
+}
+
 void ServerImpl::on_tcp_connection(sock_t fd) {
     co::set_tcp_keepalive(fd);
     co::set_tcp_nodelay(fd);
@@ -390,6 +507,11 @@ Server& Server::on_exit(std::function<void()>&& cb) {
     return *this;
 }
 
+Server& Server::reuse_port(bool steer) {
+    ((ServerImpl*)_p)->reuse_port(steer);
+    return *this;
+}
+
 uint32 Server::conn_num() const {
     return ((ServerImpl*)_p)->conn_num();
 }
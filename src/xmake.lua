@@ -66,6 +66,9 @@ target("libco")
         if not is_plat("android") then
             add_syslinks("pthread", { public = true })
             add_syslinks("dl")
+            if is_plat("linux") then
+                add_syslinks("rt")
+            end
         end
         add_files("co/context/context.S")
     end
@@ -0,0 +1,63 @@
+#include "co/co.h"
+#include "co/cout.h"
+#include "co/time.h"
+
+DEF_int32(p, 32, "number of producers");
+DEF_int32(c, 4, "number of consumers");
+DEF_int32(n, 100000, "messages per producer");
+DEF_int32(cap, 1024, "capacity of the channel");
+
+// Producers and consumers are spread over all schedulers, and they share the
+// same channel. Each consumer stops when it receives a -1.
+void mpmc() {
+    co::Chan<int> ch(FLG_cap);
+    co::WaitGroup wp(FLG_p);
+    co::WaitGroup wc(FLG_c);
+    int64 sum = 0;
+
+    Timer t;
+    for (int i = 0; i < FLG_c; ++i) {
+        go([ch, wc, &sum]() {
+            int64 s = 0;
+            int v;
+            while (true) {
+                ch >> v;
+                if (v < 0) break;
+                s += v;
+            }
+            atomic_add(&sum, s);
+            wc.done();
+        });
+    }
+
+    for (int i = 0; i < FLG_p; ++i) {
+        go([ch, wp]() {
+            for (int k = 0; k < FLG_n; ++k) ch << (k & 1023);
+            wp.done();
+        });
+    }
+
+    wp.wait();
+    go([ch]() {
+        for (int i = 0; i < FLG_c; ++i) ch << -1;
+    });
+    wc.wait();
+
+    const int64 us = t.us();
+    const int64 n = (int64)FLG_p * FLG_n;
+    int64 expected = 0;
+    for (int k = 0; k < FLG_n; ++k) expected += (k & 1023);
+    expected *= FLG_p;
+
+    COUT << "schedulers: " << co::scheduler_num() << ", producers: " << FLG_p
+         << ", consumers: " << FLG_c << ", cap: " << FLG_cap;
+    COUT << "messages: " << n << ", time: " << us << " us, "
+         << (int64)(n * 1000000.0 / us) << " msgs/s, sum "
+         << (sum == expected ? "ok" : "mismatch");
+}
+
+int main(int argc, char** argv) {
+    flag::init(argc, argv);
+    mpmc();
+    return 0;
+}
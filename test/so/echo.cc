@@ -5,6 +5,8 @@ DEF_int32(port, 9988, "port");
 DEF_int32(c, 0, "client num");
 DEF_int32(l, 4096, "message length");
 DEF_int32(t, 60, "test time in seconds");
+DEF_bool(reuseport, false, "accept connections in every scheduler with SO_REUSEPORT");
+DEF_bool(steer, false, "steer connections to schedulers by CPU in the reuseport mode");
 
 void conn_cb(tcp::Connection conn) {
     fastream buf(FLG_l);
@@ -65,7 +67,9 @@ int main(int argc, char** argv) {
     flag::init(argc, argv);
 
     if (FLG_c <= 0) {
-        tcp::Server().on_connection(conn_cb).start(
+        tcp::Server s;
+        if (FLG_reuseport) s.reuse_port(FLG_steer);
+        s.on_connection(conn_cb).start(
             FLG_ip.c_str(), FLG_port 
         );
         while (true) sleep::sec(102400);
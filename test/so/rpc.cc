@@ -9,6 +9,8 @@ DEF_int32(conn, 1, "conn num");
 DEF_string(serv_ip, "127.0.0.1", "server ip");
 DEF_int32(serv_port, 7788, "server port");
 DEF_bool(ping, false, "test rpc ping");
+DEF_bool(bin, false, "call HelloWorld.hi in the binary encoding");
+DEF_bool(mux, false, "share a rpc::MuxClient among the client coroutines");
 DEF_string(key, "", "private key file");
 DEF_string(ca, "", "certificate file");
 DEF_bool(ssl, false, "use ssl if true");
@@ -33,6 +35,12 @@ class HelloWorldImpl : public HelloWorld {
             { "error", "not supported"}
         };
     }
+
+    virtual void hi(const HiReq& req, HiRes& res) {
+        res.msg = "hi " + req.name;
+        for (size_t i = 0; i < req.nums.size(); ++i) res.sum += req.nums[i];
+        res.req = req;
+    }
 };
 
 class HelloAgainImpl : public HelloAgain {
@@ -79,6 +87,44 @@ void test_rpc_client() {
     c.close();
 }
 
+// coroutines share one connection
+std::unique_ptr<rpc::MuxClient> mux;
+
+void test_mux_client() {
+    int ok = 0;
+    for (int i = 0; i < FLG_n; ++i) {
+        if (FLG_bin) {
+            xx::HiReq req;
+            xx::HiRes res;
+            req.name = "mux";
+            req.nums = { i };
+            if (mux->call("HelloWorld.hi", req, res) && res.sum == i) ++ok;
+        } else {
+            Json req, res;
+            req.add_member("api", "HelloWorld.hello");
+            if (mux->call(req, res)) ++ok;
+        }
+    }
+    LOG << "mux client done, " << ok << " of " << FLG_n << " calls ok";
+}
+
+// call a typed method in the binary encoding, by id
+void test_bin_client() {
+    rpc::Client c(*proto);
+
+    for (int i = 0; i < FLG_n; ++i) {
+        xx::HiReq req;
+        xx::HiRes res;
+        req.name = "coost";
+        req.nums = { 1, 2, i };
+        if (c.call(xx::HelloWorld::Id::hi, req, res)) {
+            LOG << "HelloWorld.hi: " << res.msg << ", sum: " << res.sum;
+        }
+    }
+
+    c.close();
+}
+
 co::Pool pool(
     []() { return (void*) new rpc::Client(*proto); },
     [](void* p) { delete (rpc::Client*) p; }
@@ -111,8 +157,13 @@ int main(int argc, char** argv) {
             go(test_ping);
             go(test_ping);
         } else {
+            if (FLG_mux) mux.reset(new rpc::MuxClient(FLG_serv_ip.c_str(), FLG_serv_port, FLG_ssl));
             for (int i = 0; i < FLG_conn; ++i) {
-                go(test_rpc_client);
+                if (FLG_mux) {
+                    go(test_mux_client);
+                } else {
+                    go(FLG_bin ? test_bin_client : test_rpc_client);
+                }
             }
         }
     }
@@ -11,10 +11,8 @@ class HelloAgain : public rpc::Service {
     typedef std::function<void(Json&, Json&)> Fun;
 
     HelloAgain() {
-        using std::placeholders::_1;
-        using std::placeholders::_2;
-        _methods["HelloAgain.hello"] = std::bind(&HelloAgain::hello, this, _1, _2);
-        _methods["HelloAgain.again"] = std::bind(&HelloAgain::again, this, _1, _2);
+        _methods["HelloAgain.hello"] = [this](Json& req, Json& res) { this->hello(req, res); };
+        _methods["HelloAgain.again"] = [this](Json& req, Json& res) { this->again(req, res); };
     }
 
     virtual ~HelloAgain() {}
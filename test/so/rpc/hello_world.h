@@ -6,15 +6,105 @@
 
 namespace xx {
 
+struct HiReq {
+    fastring name;
+    co::vector<int32> nums;
+
+    void encode(rpc::Writer& w) const {
+        w.put(1, this->name);
+        w.put(2, this->nums);
+    }
+
+    bool decode(rpc::Reader& r) {
+        uint32 id, t;
+        while (r.next(&id, &t)) {
+            switch (id) {
+              case 1:
+                if (!r.get(t, this->name)) return false;
+                break;
+              case 2:
+                if (!r.get(t, this->nums)) return false;
+                break;
+              default:
+                if (!r.skip(t)) return false;
+            }
+        }
+        return r.ok();
+    }
+
+    void to_json(Json& j) const {
+        rpc::xx::to_json(j, "name", this->name);
+        rpc::xx::to_json(j, "nums", this->nums);
+    }
+
+    bool from_json(const Json& j) {
+        return rpc::xx::from_json(j, "name", this->name) &&
+            rpc::xx::from_json(j, "nums", this->nums);
+    }
+};
+
+struct HiRes {
+    HiRes() : sum(0) {}
+
+    fastring msg;
+    int64 sum;
+    HiReq req;
+
+    void encode(rpc::Writer& w) const {
+        w.put(1, this->msg);
+        w.put(2, this->sum);
+        w.put(3, this->req);
+    }
+
+    bool decode(rpc::Reader& r) {
+        uint32 id, t;
+        while (r.next(&id, &t)) {
+            switch (id) {
+              case 1:
+                if (!r.get(t, this->msg)) return false;
+                break;
+              case 2:
+                if (!r.get(t, this->sum)) return false;
+                break;
+              case 3:
+                if (!r.get(t, this->req)) return false;
+                break;
+              default:
+                if (!r.skip(t)) return false;
+            }
+        }
+        return r.ok();
+    }
+
+    void to_json(Json& j) const {
+        rpc::xx::to_json(j, "msg", this->msg);
+        rpc::xx::to_json(j, "sum", this->sum);
+        rpc::xx::to_json(j, "req", this->req);
+    }
+
+    bool from_json(const Json& j) {
+        return rpc::xx::from_json(j, "msg", this->msg) &&
+            rpc::xx::from_json(j, "sum", this->sum) &&
+            rpc::xx::from_json(j, "req", this->req);
+    }
+};
+
 class HelloWorld : public rpc::Service {
   public:
     typedef std::function<void(Json&, Json&)> Fun;
 
+    // ids of methods, see rpc::method_id()
+    struct Id {
+        enum : uint32 {
+            hi = 2333263320u,
+        };
+    };
+
     HelloWorld() {
-        using std::placeholders::_1;
-        using std::placeholders::_2;
-        _methods["HelloWorld.hello"] = std::bind(&HelloWorld::hello, this, _1, _2);
-        _methods["HelloWorld.world"] = std::bind(&HelloWorld::world, this, _1, _2);
+        _methods["HelloWorld.hello"] = [this](Json& req, Json& res) { this->hello(req, res); };
+        _methods["HelloWorld.world"] = [this](Json& req, Json& res) { this->world(req, res); };
+        _methods["HelloWorld.hi"] = [this](Json& req, Json& res) { this->json_hi(req, res); };
+        _bin_methods["HelloWorld.hi"] = [this](rpc::Reader& req, rpc::Writer& res) { return this->bin_hi(req, res); };
     }
 
     virtual ~HelloWorld() {}
@@ -27,12 +117,39 @@ class HelloWorld : public rpc::Service {
         return _methods;
     }
 
+    virtual const co::map<const char*, BinFun>* bin_methods() const {
+        return &_bin_methods;
+    }
+
     virtual void hello(Json& req, Json& res) = 0;
 
     virtual void world(Json& req, Json& res) = 0;
 
+    virtual void hi(const HiReq& req, HiRes& res) = 0;
+
   private:
+    void json_hi(Json& req, Json& res) {
+        HiReq a;
+        HiRes b;
+        if (!a.from_json(req)) {
+            res.add_member("error", "bad req");
+            return;
+        }
+        this->hi(a, b);
+        b.to_json(res);
+    }
+
+    bool bin_hi(rpc::Reader& req, rpc::Writer& res) {
+        HiReq a;
+        HiRes b;
+        if (!a.decode(req)) return false;
+        this->hi(a, b);
+        b.encode(res);
+        return true;
+    }
+
     co::map<const char*, Fun> _methods;
+    co::map<const char*, BinFun> _bin_methods;
 };
 
 } // xx
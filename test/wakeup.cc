@@ -0,0 +1,50 @@
+#include "co/co.h"
+#include "co/cout.h"
+#include "co/time.h"
+
+DEF_int32(c, 16, "number of coroutine pairs");
+DEF_int32(n, 100000, "round trips per pair");
+
+// Each pair of coroutines runs in two different schedulers (if there are more
+// than one), and they wake up each other with co::Event. Every wakeup goes
+// through the ready queue of the target scheduler.
+void ping_pong() {
+    const int sn = co::scheduler_num();
+    auto& s = co::schedulers();
+    co::WaitGroup wg(2 * FLG_c);
+
+    Timer t;
+    for (int i = 0; i < FLG_c; ++i) {
+        co::Event a, b;
+        s[i % sn]->go([a, b, wg]() {
+            for (int k = 0; k < FLG_n; ++k) {
+                b.signal();
+                a.wait();
+            }
+            wg.done();
+        });
+        s[(i + 1) % sn]->go([a, b, wg]() {
+            for (int k = 0; k < FLG_n; ++k) {
+                b.wait();
+                a.signal();
+            }
+            wg.done();
+        });
+    }
+
+    wg.wait();
+    const int64 us = t.us();
+    const double n = 2.0 * FLG_c * FLG_n;
+    COUT << "schedulers: " << sn << ", pairs: " << FLG_c << ", wakeups: " << (int64)n
+         << ", time: " << us << " us, " << (int64)(n * 1000000 / us) << " wakeups/s";
+
+    uint64 issued, suppressed;
+    co::wakeup_stats(&issued, &suppressed);
+    COUT << "scheduler wakeups issued: " << issued << ", suppressed: " << suppressed;
+}
+
+int main(int argc, char** argv) {
+    flag::init(argc, argv);
+    ping_pong();
+    return 0;
+}
@@ -0,0 +1,98 @@
+#include "co/all.h"
+#include <thread>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+DEF_int32(n, 1000000, "number of blocks allocated by each producer");
+DEF_int32(p, 1, "number of producer threads");
+DEF_int32(s, 32, "size of a block");
+DEF_int32(b, 256, "number of blocks in a batch passed to the consumer");
+DEF_int32(q, 64, "max number of batches waiting for the consumer");
+DEF_bool(sys, false, "use the system allocator");
+
+// Producers allocate blocks and pass them to a consumer thread in batches, the
+// consumer frees them. Each block is freed by a thread other than the one that
+// allocated it. Producers wait if the consumer falls behind, so the memory used
+// shows how well the memory freed by the consumer is reused.
+struct Queue {
+    Queue() : done(0) {}
+    ::Mutex m;
+    ::SyncEvent ev;
+    co::array<co::array<void*>*> q;
+    int done;
+};
+
+void producer(Queue* q) {
+    const size_t s = (size_t)FLG_s;
+    auto v = co::make<co::array<void*>>(FLG_b);
+    for (int i = 0; i < FLG_n; ++i) {
+        void* p = FLG_sys ? ::malloc(s) : co::alloc(s);
+        *(int*)p = i;
+        v->push_back(p);
+        if ((int)v->size() == FLG_b || i + 1 == FLG_n) {
+            for (;;) {
+                {
+                    ::MutexGuard g(q->m);
+                    if ((int)q->q.size() < FLG_q) {
+                        q->q.push_back(v);
+                        if (i + 1 == FLG_n) ++q->done;
+                        break;
+                    }
+                }
+                q->ev.signal();
+                std::this_thread::yield();
+            }
+            q->ev.signal();
+            v = co::make<co::array<void*>>(FLG_b);
+        }
+    }
+    co::del(v);
+}
+
+void consumer(Queue* q) {
+    const size_t s = (size_t)FLG_s;
+    co::array<co::array<void*>*> x;
+    int done = 0;
+    while (done < FLG_p) {
+        q->ev.wait(8);
+        {
+            ::MutexGuard g(q->m);
+            x.swap(q->q);
+            done = q->done;
+        }
+        for (size_t i = 0; i < x.size(); ++i) {
+            auto& v = *x[i];
+            for (size_t k = 0; k < v.size(); ++k) {
+                FLG_sys ? ::free(v[k]) : co::free(v[k], s);
+            }
+            co::del(x[i]);
+        }
+        x.clear();
+    }
+}
+
+int main(int argc, char** argv) {
+    flag::init(argc, argv);
+
+    Queue q;
+    Timer t;
+    Thread c(consumer, &q);
+    co::vector<Thread*> v;
+    for (int i = 0; i < FLG_p; ++i) v.push_back(co::make<Thread>(producer, &q));
+    for (size_t i = 0; i < v.size(); ++i) co::del(v[i]);
+    c.join();
+
+    const int64 us = t.us();
+    const int64 n = (int64)FLG_p * FLG_n;
+    COUT << (FLG_sys ? "::malloc" : "co::alloc") << ", producers: " << FLG_p
+         << ", size: " << FLG_s << ", batch: " << FLG_b;
+    COUT << "blocks: " << n << ", time: " << us << " us, "
+         << (int64)(n * 1000000.0 / us) << " blocks/s";
+  #ifndef _WIN32
+    struct rusage r;
+    if (getrusage(RUSAGE_SELF, &r) == 0) COUT << "max rss: " << r.ru_maxrss << " KB";
+  #endif
+    return 0;
+}
@@ -1,9 +1,38 @@
 #include "co/unitest.h"
 #include "co/co.h"
 #include "co/thread.h"
+#include "co/time.h"
+#include "co/fs.h"
+#include "co/str.h"
+#include "../src/co/scheduler.h"
+#include <memory>
+#ifdef __linux__
+#include <sched.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+DEC_bool(co_steal);
+DEC_bool(co_dedicated_stack);
+DEC_string(co_sched_cpus);
+DEC_bool(co_epoll_persistent);
 
 namespace test {
 
+#ifdef __linux__
+// number of memory mappings of the process
+static int map_count() {
+    int n = 0;
+    FILE* f = fopen("/proc/self/maps", "r");
+    if (f) {
+        int c;
+        while ((c = fgetc(f)) != EOF) if (c == '\n') ++n;
+        fclose(f);
+    }
+    return n;
+}
+#endif
+
 DEF_test(co) {
     int v = 0;
 
@@ -93,6 +122,194 @@ DEF_test(co) {
         wg.wait();
         EXPECT_EQ(v, 23);
         v = 0;
+
+        // multiple producers and consumers on a small buffer
+        co::Chan<int> ch2(3);
+        wg.add(16);
+        for (int i = 0; i < 8; ++i) {
+            go([wg, ch2]() {
+                for (int k = 1; k <= 1000; ++k) ch2 << k;
+                wg.done();
+            });
+        }
+        for (int i = 0; i < 8; ++i) {
+            go([wg, ch2, &v]() {
+                int x, s = 0;
+                for (int k = 0; k < 1000; ++k) { ch2 >> x; s += x; }
+                atomic_add(&v, s);
+                wg.done();
+            });
+        }
+        wg.wait();
+        EXPECT_EQ(v, 8 * 500500);
+        v = 0;
+
+        // read timeout
+        co::Chan<int> ch3(1, 10);
+        wg.add(1);
+        go([wg, ch3, &v]() {
+            int x = 0;
+            ch3 >> x;
+            v = co::timeout() ? 1 : 0;
+            wg.done();
+        });
+        wg.wait();
+        EXPECT_EQ(v, 1);
+        v = 0;
+
+        // move-only and non-trivially-copyable elements
+        co::Chan<std::unique_ptr<int>> ch4(2);
+        co::Chan<fastring> ch5(4);
+        wg.add(2);
+        go([wg, ch4, ch5]() {
+            for (int i = 1; i <= 100; ++i) ch4 << std::unique_ptr<int>(new int(i));
+            for (int i = 0; i < 100; ++i) ch5 << fastring(32, 'x');
+            wg.done();
+        });
+        go([wg, ch4, ch5, &v]() {
+            std::unique_ptr<int> p;
+            fastring s;
+            int k = 0;
+            for (int i = 0; i < 100; ++i) { ch4 >> p; k += *p; }
+            for (int i = 0; i < 100; ++i) { ch5 >> s; if (s.size() == 32) ++k; }
+            v = k;
+            wg.done();
+        });
+        wg.wait();
+        EXPECT_EQ(v, 5050 + 100);
+        v = 0;
+
+        // try_send, try_recv and close
+        co::Chan<fastring> ch6(1);
+        wg.add(1);
+        go([wg, ch6, &v]() {
+            fastring s("hello");
+            fastring x;
+            if (ch6.try_recv(x)) return;
+            if (!ch6.try_send(std::move(s))) return;
+            if (ch6.try_send(fastring("again"))) return;
+            if (!ch6.try_recv(x) || x != "hello") return;
+            ch6 << fastring("world");
+            ch6.close();
+            if (ch6.send(fastring("closed")) || co::timeout()) return;
+            if (!ch6.recv(x) || x != "world") return;
+            if (ch6.recv(x) || co::timeout()) return;
+            v = 1;
+            wg.done();
+        });
+        wg.wait();
+        EXPECT_EQ(v, 1);
+        EXPECT(ch6.is_closed());
+        v = 0;
+
+        // close() wakes up the waiting readers
+        co::Chan<fastring> ch7;
+        wg.add(2);
+        go([wg, ch7, &v]() {
+            fastring x;
+            if (!ch7.recv(x) && !co::timeout()) atomic_inc(&v);
+            wg.done();
+        });
+        go([wg, ch7]() {
+            co::sleep(10);
+            ch7.close();
+            wg.done();
+        });
+        wg.wait();
+        EXPECT_EQ(v, 1);
+
+        // read with a timeout
+        co::Chan<int> ch8;
+        wg.add(1);
+        go([wg, ch8, &v]() {
+            int x;
+            v = (!ch8.recv(x, 10) && co::timeout()) ? 2 : 0;
+            wg.done();
+        });
+        wg.wait();
+        EXPECT_EQ(v, 2);
+        v = 0;
+    }
+
+    DEF_case(select) {
+        co::Chan<int> ch1, ch2;
+        co::Chan<fastring> ch3(4);
+        co::Event ev;
+        co::WaitGroup wg;
+
+        // a case is ready already
+        wg.add(1);
+        go([wg, ch1, ch2, ev, &v]() {
+            int x = 0, y = 0;
+            ch2 << 3;
+            co::Select s;
+            s.recv(ch1, x).recv(ch2, y).event(ev);
+            v = (s.select(0) == 1 && y == 3) ? 1 : 0;
+            wg.done();
+        });
+        wg.wait();
+        EXPECT_EQ(v, 1);
+
+        // wait on channels, an event and a timeout at once
+        wg.add(4);
+        go([wg, ch1, ch2, ch3, ev, &v]() {
+            int x = 0, y = 0;
+            fastring z;
+            co::Select s;
+            s.recv(ch1, x).recv(ch2, y).recv(ch3, z).event(ev);
+            int r = 0;
+            if (s.select() == 2 && z == "hello") ++r;
+            if (s.select() == 0 && x == 7) ++r;
+            if (s.select() == 3) ++r;
+            if (s.select(10) == -1) ++r;
+            v = r;
+            wg.done();
+        });
+        go([wg, ch3]() { co::sleep(10); ch3 << fastring("hello"); wg.done(); });
+        go([wg, ch1]() { co::sleep(30); ch1 << 7; wg.done(); });
+        go([wg, ev]() { co::sleep(50); ev.signal(); wg.done(); });
+        wg.wait();
+        EXPECT_EQ(v, 4);
+
+        // a closed and empty channel is selected with ok = false
+        ch1.close();
+        wg.add(1);
+        go([wg, ch1, ch2, &v]() {
+            int x = 0, y = 0;
+            bool ok = true;
+            co::Select s;
+            s.recv(ch2, y).recv(ch1, x, &ok);
+            v = (s.select() == 1 && !ok) ? 5 : 0;
+            wg.done();
+        });
+        wg.wait();
+        EXPECT_EQ(v, 5);
+
+        // many writers on a few channels, and one reader selecting on all of them
+        co::Chan<int> c[3] = { co::Chan<int>(2), co::Chan<int>(2), co::Chan<int>(2) };
+        v = 0;
+        wg.add(7);
+        for (int i = 0; i < 6; ++i) {
+            go([wg, c, i]() {
+                for (int k = 1; k <= 1000; ++k) c[i % 3] << k;
+                wg.done();
+            });
+        }
+        go([wg, c, &v]() {
+            int x[3] = { 0 };
+            int sum = 0;
+            co::Select s;
+            s.recv(c[0], x[0]).recv(c[1], x[1]).recv(c[2], x[2]);
+            for (int k = 0; k < 6000; ++k) {
+                const int r = s.select();
+                if (r >= 0) sum += x[r];
+            }
+            v = sum;
+            wg.done();
+        });
+        wg.wait();
+        EXPECT_EQ(v, 6 * 500500);
+        v = 0;
     }
 
     DEF_case(mutex) {
@@ -167,6 +384,487 @@ DEF_test(co) {
 
         p.clear();
     }
+
+    DEF_case(timer) {
+        co::Mutex m;
+        co::vector<int> vi;
+        co::WaitGroup wg;
+        wg.add(4);
+
+        for (int i = 3; i > 0; --i) {
+            go([wg, m, i, &vi]() {
+                co::sleep(i * 10);
+                co::MutexGuard g(m);
+                vi.push_back(i);
+                wg.done();
+            });
+        }
+
+        int64 t = 0;
+        bool r = true;
+        go([wg, &t, &r]() {
+            co::Event ev;
+            Timer timer;
+            r = ev.wait(300);
+            t = timer.ms();
+            wg.done();
+        });
+
+        wg.wait();
+        EXPECT_EQ(vi.size(), 3);
+        if (vi.size() == 3) {
+            EXPECT_EQ(vi[0], 1);
+            EXPECT_EQ(vi[1], 2);
+            EXPECT_EQ(vi[2], 3);
+        }
+        EXPECT_EQ(r, false);
+        EXPECT_GE(t, 299); // timers are in milliseconds, it may be 1ms earlier
+    }
+
+    // TimerWheel is tested directly, the schedulers use it only if co_timer_wheel
+    // is true when they are created.
+    DEF_case(timer_wheel) {
+        const int64 t = (1 << 20) + 1; // the first tick, 255 ticks before a cascade
+        co::TimerWheel w(t);
+        co::TimerNode a[4];
+        co::array<co::Coroutine*> res;
+        for (int i = 0; i < 4; ++i) {
+            a[i].slot = 0;
+            a[i].co = (co::Coroutine*)&a[i];
+        }
+
+        // add and del in level 0
+        a[0].expire = t + 10;
+        a[1].expire = t + 10;
+        w.add(&a[0]);
+        w.add(&a[1]);
+        EXPECT_EQ(w.size(), 2);
+        EXPECT_EQ(w.next_timeout(t), 10);
+        w.del(&a[1]);
+        EXPECT_EQ(w.size(), 1);
+        EXPECT_EQ(a[1].slot, 0);
+        w.expire(t + 9, res);
+        EXPECT(res.empty());
+        w.expire(t + 10, res);
+        EXPECT_EQ(res.size(), 1);
+        if (res.size() == 1) EXPECT(res[0] == a[0].co);
+        EXPECT_EQ(w.size(), 0);
+        EXPECT_EQ(w.next_timeout(t + 10), (uint32)-1);
+        res.clear();
+
+        // a timer already expired goes to the current tick
+        a[0].expire = t;
+        w.add(&a[0]);
+        EXPECT_EQ(w.next_timeout(t + 11), 0);
+        w.expire(t + 11, res);
+        EXPECT_EQ(res.size(), 1);
+        res.clear();
+
+        // timers in the higher levels are cascaded down
+        const int64 now_ms = t + 11;
+        a[0].expire = now_ms + 300;     // level 1
+        a[1].expire = now_ms + 20000;   // level 2
+        a[2].expire = now_ms + 5;       // level 0
+        a[3].expire = now_ms + (1 << 21); // level 3
+        for (int i = 0; i < 4; ++i) w.add(&a[i]);
+        EXPECT_EQ(w.size(), 4);
+        EXPECT_EQ(w.next_timeout(now_ms), 5);
+
+        w.expire(now_ms + 5, res);
+        EXPECT_EQ(res.size(), 1);
+        if (res.size() == 1) EXPECT(res[0] == a[2].co);
+        res.clear();
+
+        // wake up at the next cascade, a timer in level 1 may be moved to level 0
+        EXPECT_EQ(w.next_timeout(now_ms + 5), (uint32)(t + 255 - (now_ms + 5)));
+        w.expire(now_ms + 299, res);
+        EXPECT(res.empty());
+        EXPECT_EQ(w.next_timeout(now_ms + 299), 1);
+        w.expire(now_ms + 300, res);
+        EXPECT_EQ(res.size(), 1);
+        if (res.size() == 1) EXPECT(res[0] == a[0].co);
+        res.clear();
+
+        // delete a timer in a higher level
+        w.del(&a[1]);
+        EXPECT_EQ(w.size(), 1);
+        w.expire(now_ms + 20000, res);
+        EXPECT(res.empty());
+
+        w.expire(now_ms + (1 << 21) - 1, res);
+        EXPECT(res.empty());
+        w.expire(now_ms + (1 << 21), res);
+        EXPECT_EQ(res.size(), 1);
+        if (res.size() == 1) EXPECT(res[0] == a[3].co);
+        EXPECT_EQ(w.size(), 0);
+    }
+
+    DEF_case(steal) {
+        const int n = co::scheduler_num();
+        if (n > 1) {
+            FLG_co_steal = true;
+            SyncEvent started;
+            SyncEvent blocked;
+            co::WaitGroup done(1);
+            co::schedulers()[0]->go([&started, &blocked, done]() {
+                started.signal();
+                blocked.wait(); // block scheduler 0
+                done.done();
+            });
+            started.wait();
+
+            co::WaitGroup wg;
+            wg.add(8 * n);
+            for (int i = 0; i < 8 * n; ++i) {
+                go([wg, &v]() {
+                    if (co::scheduler_id() != 0) atomic_inc(&v);
+                    wg.done();
+                });
+            }
+
+            wg.wait();
+            EXPECT_EQ(v, 8 * n);
+            blocked.signal();
+            done.wait(); // the events must outlive the blocking coroutine
+            FLG_co_steal = false;
+            v = 0;
+        }
+    }
+
+  #ifdef __linux__
+    DEF_case(free_stacks) {
+        // stacks of the pooled coroutines are freed with the scheduler
+        if (FLG_co_dedicated_stack) {
+            const int m = map_count();
+            auto s = new co::SchedulerImpl(99, 1, 64 * 1024);
+            s->start();
+            co::WaitGroup wg(64);
+            for (int i = 0; i < 64; ++i) {
+                s->go([wg]() { co::sleep(10); wg.done(); });
+            }
+            wg.wait();
+            sleep::ms(10); // let the coroutines go back to the pool
+            delete s;
+            EXPECT_LT(map_count() - m, 32); // 2 mappings for each stack if leaked
+        }
+    }
+  #endif
+
+    DEF_case(async) {
+        // tasks run in the pool threads, and return values are moved out
+        co::WaitGroup wg(1);
+        int id = 0;
+        std::unique_ptr<int> x;
+        go([wg, &id, &x]() {
+            id = co::async_run([]() { return co::scheduler_id(); });
+            x = co::async_run([]() { return std::unique_ptr<int>(new int(7)); });
+            wg.done();
+        });
+        wg.wait();
+        EXPECT_EQ(id, -1);
+        EXPECT(x && *x == 7);
+
+        // other coroutines in the same scheduler keep running
+        co::AsyncPool p(2);
+        co::vector<int> vi;
+        co::Mutex m;
+        wg.add(2);
+        co::schedulers()[0]->go([wg, &p, &vi, m]() {
+            p.run([]() { ::usleep(100 * 1000); });
+            co::MutexGuard g(m);
+            vi.push_back(1);
+            wg.done();
+        });
+        co::schedulers()[0]->go([wg, &vi, m]() {
+            co::MutexGuard g(m);
+            vi.push_back(2);
+            wg.done();
+        });
+        wg.wait();
+        EXPECT_EQ(vi.size(), 2);
+        if (vi.size() == 2) EXPECT_EQ(vi[0], 2);
+
+        // called from a non-coroutine thread
+        EXPECT_EQ(p.run([]() { return 3; }), 3);
+
+        wg.add(8);
+        for (int i = 0; i < 8; ++i) {
+            go([wg, &p]() {
+                p.run([]() { ::usleep(10 * 1000); });
+                wg.done();
+            });
+        }
+        wg.wait();
+        auto st = p.stats();
+        EXPECT_EQ(st.threads, 2);
+        EXPECT_EQ(st.busy, 0);
+        EXPECT_EQ(st.queued, 0);
+        EXPECT_EQ(st.done, 10);
+        EXPECT_GE(st.max_queued, 2);
+        EXPECT_GE(st.run_us, 180 * 1000);
+
+        // arguments are copied into the task, and survive other coroutines using 
+        // the shared stack while the caller waits
+        wg.add(9);
+        fastring r;
+        int bad = 0;
+        co::schedulers()[0]->go([wg, &r]() {
+            fastring s("hello");
+            int n = 3;
+            r = co::async_run([](const fastring& s, int n) {
+                ::usleep(50 * 1000);
+                return s + str::from(n);
+            }, s, n);
+            wg.done();
+        });
+        for (int i = 0; i < 8; ++i) {
+            co::schedulers()[0]->go([wg, &bad]() {
+                char buf[4096];
+                memset(buf, 'x', sizeof(buf));
+                co::sleep(10);
+                if (buf[sizeof(buf) - 1] != 'x') atomic_inc(&bad);
+                wg.done();
+            });
+        }
+        wg.wait();
+        EXPECT_EQ(r, "hello3");
+        EXPECT_EQ(bad, 0);
+
+        // move-only arguments are moved into f
+        wg.add(1);
+        int u = 0;
+        go([wg, &u]() {
+            std::unique_ptr<int> p(new int(5));
+            u = co::async_run([](std::unique_ptr<int> p, int n) { return *p + n; }, std::move(p), 2);
+            wg.done();
+        });
+        wg.wait();
+        EXPECT_EQ(u, 7);
+
+        // with dedicated stacks, the task may refer to the caller's stack
+        if (FLG_co_dedicated_stack) {
+            wg.add(9);
+            bool ok = false;
+            co::schedulers()[0]->go([wg, &ok]() {
+                char buf[64] = "hello";
+                int n = 0;
+                co::async_run([&]() {
+                    ::usleep(50 * 1000);
+                    n = (int)strlen(buf);
+                    memcpy(buf, "world", 6);
+                });
+                ok = n == 5 && strcmp(buf, "world") == 0;
+                wg.done();
+            });
+            for (int i = 0; i < 8; ++i) {
+                co::schedulers()[0]->go([wg, &bad]() {
+                    char buf[4096];
+                    memset(buf, 'x', sizeof(buf));
+                    co::sleep(10);
+                    if (buf[sizeof(buf) - 1] != 'x') atomic_inc(&bad);
+                    wg.done();
+                });
+            }
+            wg.wait();
+            EXPECT(ok);
+            EXPECT_EQ(bad, 0);
+        }
+    }
+
+    DEF_case(sched_stats) {
+        auto v0 = co::sched_stats();
+        EXPECT_EQ(v0.size(), co::scheduler_num());
+
+        // more than 8 coroutines alive, so they have to share the stacks
+        co::WaitGroup wg(9);
+        co::Event ev;
+        uint32 ncos = 0, ntimers = 0;
+        for (int i = 0; i < 9; ++i) {
+            co::schedulers()[0]->go([wg, ev]() {
+                ev.wait(60 * 1000); // alive with a timer when the stats is taken
+                wg.done();
+            });
+        }
+        co::schedulers()[0]->go([&ncos, &ntimers, ev]() {
+            co::sleep(1);
+            co::sleep(1);
+            auto v = co::sched_stats();
+            ncos = v[0].coroutines;
+            ntimers = v[0].timers;
+            ev.signal();
+        });
+        wg.wait();
+
+        auto v = co::sched_stats();
+        EXPECT_GE(ncos, 10);
+        EXPECT_GE(ntimers, 9);
+        EXPECT_EQ(v[0].id, 0);
+        EXPECT_GE(v[0].switches, v0[0].switches + 5);
+        EXPECT_GT(v[0].polls, v0[0].polls);
+        EXPECT_GE(v[0].max_ready, 1);
+        EXPECT_GE(v[0].wait_us + v[0].run_us, v0[0].wait_us + v0[0].run_us + 1000);
+        if (!FLG_co_dedicated_stack) EXPECT_GT(v[0].stack_saved, v0[0].stack_saved);
+    }
+
+    DEF_case(priority) {
+        // both are woken up in the same round, the low priority one is resumed later
+        auto s = co::schedulers()[0];
+        co::WaitGroup wg(2);
+        co::Event ev;
+        fastring order;
+        int p0 = -1, p1 = -1;
+        s->go([&, wg, ev]() {
+            p0 = co::priority();
+            co::set_priority(co::prio_low);
+            p1 = co::priority();
+            ev.wait();
+            order.append('l');
+            wg.done();
+        });
+        s->go([&, wg, ev]() {
+            ev.wait();
+            order.append('n');
+            wg.done();
+        });
+        s->go([ev]() {
+            co::sleep(10);
+            ev.signal();
+        });
+        wg.wait();
+        EXPECT_EQ(p0, (int)co::prio_normal);
+        EXPECT_EQ(p1, (int)co::prio_low);
+        EXPECT_EQ(order, "nl");
+    }
+
+    DEF_case(maybe_yield) {
+        // the spinning coroutine yields to the sleeping one on the same scheduler
+        auto s = co::schedulers()[0];
+        co::WaitGroup wg(2);
+        bool done = false;
+        int64 ms = 0;
+        s->go([&, wg]() {
+            const int64 t = now::ms();
+            while (!atomic_load(&done) && now::ms() - t < 3000) co::maybe_yield();
+            ms = now::ms() - t;
+            wg.done();
+        });
+        s->go([&, wg]() {
+            co::sleep(1);
+            atomic_store(&done, true);
+            wg.done();
+        });
+        wg.wait();
+        EXPECT_LT(ms, 1000);
+    }
+
+  #ifdef __linux__
+    DEF_case(sock_ctx_registered) {
+        auto& ctx = co::get_sock_ctx(60000);
+        ctx.del_event();
+        ctx.set_registered(0);
+        ctx.set_registered(3);
+        ctx.set_registered(70);
+        EXPECT(ctx.is_registered(0));
+        EXPECT(ctx.is_registered(3));
+        EXPECT(!ctx.is_registered(1));
+        EXPECT(!ctx.is_registered(70)); // not tracked, always registered again
+        ctx.del_event();
+        EXPECT(!ctx.is_registered());
+        EXPECT(!ctx.is_registered(0));
+    }
+
+    DEF_case(sock_in_two_scheds) {
+        // a socket waited on in two schedulers in turn
+        auto& s = co::schedulers();
+        int fds[2];
+        if (s.size() >= 2 && socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0) {
+            co::set_nonblock(fds[0]);
+            int ok = 0;
+            for (int i = 0; i < 8; ++i) {
+                co::WaitGroup wg(1);
+                s[i & 1]->go([&ok, &fds, wg]() {
+                    char c;
+                    if (co::recv(fds[0], &c, 1, 1000) == 1) ++ok;
+                    wg.done();
+                });
+                sleep::ms(10); // let it wait on the socket
+                EXPECT_EQ(::write(fds[1], "x", 1), 1);
+                wg.wait();
+            }
+            EXPECT_EQ(ok, 8);
+
+            // registered to both of them once, not again on every switch
+            if (FLG_co_epoll_persistent) {
+                auto& ctx = co::get_sock_ctx(fds[0]);
+                EXPECT(ctx.is_registered(((co::SchedulerImpl*)s[0])->id()));
+                EXPECT(ctx.is_registered(((co::SchedulerImpl*)s[1])->id()));
+            }
+            co::close(fds[0]);
+            ::close(fds[1]);
+        }
+    }
+
+    DEF_case(sched_cpus) {
+        // run with -co_sched_cpus=0, all the schedulers are pinned to CPU 0
+        if (FLG_co_sched_cpus == "0") {
+            auto& s = co::schedulers();
+            int bad = 0;
+            co::WaitGroup wg((uint32)s.size());
+            for (size_t i = 0; i < s.size(); ++i) {
+                s[i]->go([wg, &bad]() {
+                    cpu_set_t set;
+                    CPU_ZERO(&set);
+                    const int r = sched_getaffinity(0, sizeof(set), &set);
+                    if (r != 0 || CPU_COUNT(&set) != 1 || !CPU_ISSET(0, &set)) atomic_inc(&bad);
+                    wg.done();
+                });
+            }
+            wg.wait();
+            EXPECT_EQ(bad, 0);
+        }
+    }
+  #endif
+
+    DEF_case(prof) {
+        if (!co::prof::start(1000)) return; // not supported
+
+        co::WaitGroup wg(1);
+        uint64 x = 0;
+        go([wg, &x]() {
+            // keep the scheduler busy for 200ms, samples are taken on CPU time
+            const int64 t = now::ms();
+            while (now::ms() - t < 200) {
+                for (int i = 0; i < 1000; ++i) x = x * 31 + i;
+            }
+            wg.done();
+        });
+        wg.wait();
+        co::prof::stop();
+
+        fastring s = co::prof::folded();
+        EXPECT(!s.empty());
+        EXPECT_NE(s.find("go@"), s.npos);
+        EXPECT(co::prof::dump("co.prof.folded"));
+        EXPECT_GT(fs::fsize("co.prof.folded"), 0);
+        fs::remove("co.prof.folded");
+
+        // restart while timers of the last run may still fire
+        co::WaitGroup wg2(1);
+        go([wg2, &x]() {
+            const int64 t = now::ms();
+            while (now::ms() - t < 200) {
+                for (int i = 0; i < 1000; ++i) x = x * 31 + i;
+            }
+            wg2.done();
+        });
+        for (int i = 0; i < 100; ++i) {
+            EXPECT(co::prof::start(10000));
+            sleep::ms(1);
+            co::prof::stop();
+        }
+        wg2.wait();
+        co::prof::folded();
+    }
 }
 
 } // test
@@ -0,0 +1,401 @@
+#ifndef _WIN32
+#include "co/unitest.h"
+#include "co/co.h"
+#include "co/fs.h"
+#include "co/str.h"
+#include "co/time.h"
+
+DEC_string(co_dns_servers);
+DEC_string(co_dns_resolv_conf);
+DEC_string(co_dns_hosts);
+DEC_bool(hook_dns);
+
+namespace test {
+
+// a DNS server on 127.0.0.1 for tests
+//   - "a.test" has an A record 1.2.3.4 and no AAAA record.
+//   - "x.example" has A records 5.6.7.8 and 5.6.7.9, it is found by searching
+//     the domain "example" in resolv.conf.
+//   - "1.2.3.4" has a PTR record "a.test".
+//   - "slow.test" is never answered.
+//   - "big.test" has A records 9.9.9.1 and 9.9.9.2, the answer over UDP is
+//     truncated, and the full answer is sent over TCP.
+//   - other names do not exist.
+class DnsStub {
+  public:
+    DnsStub() : _n(0), _ntcp(0), _stop(false) {
+        _fd = co::udp_socket();
+        struct sockaddr_in a;
+        co::init_ip_addr(&a, "127.0.0.1", 0);
+        co::bind(_fd, &a, sizeof(a));
+        int len = sizeof(a);
+        getsockname(_fd, (sockaddr*)&a, (socklen_t*)&len);
+        _port = ntohs(a.sin_port);
+
+        _tcp = co::tcp_socket();
+        co::bind(_tcp, &a, sizeof(a));
+        co::listen(_tcp, 64);
+    }
+
+    void run();
+
+    void run_tcp();
+
+    void stop() {
+        _stop = true;
+        _done.wait();
+
+        // wake up the coroutine blocking on accept
+        int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in a;
+        co::init_ip_addr(&a, "127.0.0.1", _port);
+        ::connect(fd, (sockaddr*)&a, sizeof(a));
+        _tcp_done.wait();
+        ::close(fd);
+        co::close(_fd);
+        co::close(_tcp);
+    }
+
+    int port() const { return _port; }
+
+    // number of queries received
+    int n() const { return atomic_load(&_n); }
+
+    // number of queries received over TCP
+    int ntcp() const { return atomic_load(&_ntcp); }
+
+  private:
+    // build the response to the query @q in @r, return its size, or 0 if the
+    // query is not answered
+    static int answer(const char* q, int n, char* r, bool tcp);
+
+    sock_t _fd;
+    sock_t _tcp;
+    int _port;
+    int _n;
+    int _ntcp;
+    bool _stop;
+    co::Event _done;
+    co::Event _tcp_done;
+};
+
+int DnsStub::answer(const char* q, int n, char* r, bool tcp) {
+    // the name in the question
+    fastring name;
+    int i = 12;
+    while (i < n && q[i] != 0) {
+        if (!name.empty()) name.append('.');
+        name.append(q + i + 1, q[i]);
+        i += q[i] + 1;
+    }
+    i += 5;
+    const int qtype = ((uint8)q[i - 4] << 8) | (uint8)q[i - 3];
+    if (name == "slow.test") return 0;
+
+    const char* ips[2] = { 0, 0 };
+    int rcode = 3;
+    bool tc = false;
+    const bool ptr = name == "4.3.2.1.in-addr.arpa" && qtype == 12;
+    if (ptr) {
+        rcode = 0;
+    } else if (name == "a.test") {
+        rcode = 0;
+        if (qtype == 1) ips[0] = "1.2.3.4";
+    } else if (name == "x.example") {
+        rcode = 0;
+        if (qtype == 1) { ips[0] = "5.6.7.8"; ips[1] = "5.6.7.9"; }
+    } else if (name == "big.test") {
+        rcode = 0;
+        tc = !tcp;
+        if (qtype == 1 && tcp) { ips[0] = "9.9.9.1"; ips[1] = "9.9.9.2"; }
+    }
+
+    memcpy(r, q, i);
+    r[2] = (char)(tc ? 0x83 : 0x81);
+    r[3] = (char)(0x80 | rcode);
+    const int an = ptr ? 1 : !!ips[0] + !!ips[1];
+    r[6] = 0;
+    r[7] = (char)an;
+    char* p = r + i;
+    if (ptr) {
+        const char rr[] = { (char)0xc0, 12, 0, 12, 0, 1, 0, 0, 0, 60, 0, 8, 1, 'a', 4, 't', 'e', 's', 't', 0 };
+        memcpy(p, rr, sizeof(rr));
+        p += sizeof(rr);
+    }
+    for (int k = 0; !ptr && k < an; ++k) {
+        const char rr[] = { (char)0xc0, 12, 0, 1, 0, 1, 0, 0, 0, 60, 0, 4 };
+        memcpy(p, rr, sizeof(rr));
+        p += sizeof(rr);
+        inet_pton(AF_INET, ips[k], p);
+        p += 4;
+    }
+    return (int)(p - r);
+}
+
+void DnsStub::run() {
+    char q[512], r[512];
+    while (!_stop) {
+        struct sockaddr_in from;
+        int len = sizeof(from);
+        const int n = co::recvfrom(_fd, q, sizeof(q), &from, &len, 10);
+        if (n <= 12) continue;
+        atomic_inc(&_n);
+        const int m = answer(q, n, r, false);
+        if (m > 0) co::sendto(_fd, r, m, &from, len);
+    }
+    _done.signal();
+}
+
+void DnsStub::run_tcp() {
+    char q[514], r[514];
+    while (true) {
+        sock_t fd = co::accept(_tcp, 0, 0);
+        if (fd == (sock_t)-1) break;
+        if (_stop) { co::close(fd); break; }
+
+        // messages are prefixed with a 2-byte length
+        while (co::recvn(fd, q, 2, 1000) == 2) {
+            const int n = ((uint8)q[0] << 8) | (uint8)q[1];
+            if (n <= 12 || n > 512 || co::recvn(fd, q + 2, n, 1000) != n) break;
+            atomic_inc(&_ntcp);
+            const int m = answer(q + 2, n, r + 2, true);
+            if (m == 0) break;
+            r[0] = (char)(m >> 8);
+            r[1] = (char)m;
+            if (co::send(fd, r, m + 2, 1000) != m + 2) break;
+        }
+        co::close(fd);
+    }
+    _tcp_done.signal();
+}
+
+DEF_test(dns) {
+    fastring hosts = FLG_co_dns_hosts;
+    fastring conf = FLG_co_dns_resolv_conf;
+    fastring servers = FLG_co_dns_servers;
+    {
+        fs::file f("dns_hosts.txt", 'w');
+        f.write("127.0.0.1 localhost\n10.0.0.1\tmyhost  myalias # comment\n::1 myhost\n");
+        fs::file g("dns_resolv.txt", 'w');
+        g.write("search example\noptions timeout:1 attempts:1\n");
+    }
+
+    DnsStub* stub = new DnsStub();
+    go(&DnsStub::run, stub);
+    go(&DnsStub::run_tcp, stub);
+    const bool hook_dns = FLG_hook_dns;
+    FLG_hook_dns = true;
+    FLG_co_dns_hosts = "dns_hosts.txt";
+    FLG_co_dns_resolv_conf = "dns_resolv.txt";
+    FLG_co_dns_servers = "127.0.0.1:" + str::from(stub->port());
+    co::dns::clear_cache();
+
+    // run f in a coroutine and wait for it
+    auto run = [](std::function<void()>&& f) {
+        co::WaitGroup wg(1);
+        go([&f, wg]() { f(); wg.done(); });
+        wg.wait();
+    };
+
+    int r = 0;
+    co::vector<co::dns::addr_t> v;
+    char ip[64];
+    auto s = [&](size_t i) -> const char* {
+        return inet_ntop(v[i].family, &v[i].v6, ip, sizeof(ip));
+    };
+
+    DEF_case(literal) {
+        run([&]() { r = co::dns::resolve("192.168.0.1", AF_UNSPEC, v); });
+        EXPECT_EQ(r, 0);
+        EXPECT_EQ(v.size(), 1);
+        EXPECT_EQ(fastring(s(0)), "192.168.0.1");
+        v.clear();
+
+        run([&]() { r = co::dns::resolve("::1", AF_INET, v); });
+        EXPECT_EQ(r, EAI_NONAME);
+    }
+
+    DEF_case(hosts) {
+        run([&]() { r = co::dns::resolve("MyAlias", AF_INET, v); });
+        EXPECT_EQ(r, 0);
+        EXPECT_EQ(v.size(), 1);
+        EXPECT_EQ(fastring(s(0)), "10.0.0.1");
+        v.clear();
+
+        run([&]() { r = co::dns::resolve("myhost", AF_UNSPEC, v); });
+        EXPECT_EQ(r, 0);
+        EXPECT_EQ(v.size(), 2);
+        EXPECT_EQ(v[0].family, AF_INET);
+        EXPECT_EQ(fastring(s(1)), "::1");
+        v.clear();
+        EXPECT_EQ(stub->n(), 0);
+    }
+
+    DEF_case(query) {
+        run([&]() { r = co::dns::resolve("a.test", AF_UNSPEC, v); });
+        EXPECT_EQ(r, 0);
+        EXPECT_EQ(v.size(), 1);
+        EXPECT_EQ(fastring(s(0)), "1.2.3.4");
+        EXPECT_EQ(stub->n(), 2); // A and AAAA
+        v.clear();
+
+        // no AAAA record
+        run([&]() { r = co::dns::resolve("a.test", AF_INET6, v); });
+        EXPECT_EQ(r, EAI_NONAME);
+        EXPECT_EQ(stub->n(), 2);
+
+        // answered from the cache
+        run([&]() { r = co::dns::resolve("A.test.", AF_INET, v); });
+        EXPECT_EQ(r, 0);
+        EXPECT_EQ(v.size(), 1);
+        EXPECT_EQ(stub->n(), 2);
+        v.clear();
+
+        // search domains
+        run([&]() { r = co::dns::resolve("x", AF_INET, v); });
+        EXPECT_EQ(r, 0);
+        EXPECT_EQ(v.size(), 2);
+        if (v.size() == 2) EXPECT_EQ(fastring(s(1)), "5.6.7.9");
+        v.clear();
+
+        // "nx.test" and "nx.test.example" are tried, failures are cached too
+        int n = stub->n();
+        run([&]() { r = co::dns::resolve("nx.test", AF_INET, v); });
+        EXPECT_EQ(r, EAI_NONAME);
+        EXPECT_EQ(stub->n(), n + 2);
+        run([&]() { r = co::dns::resolve("nx.test", AF_INET, v); });
+        EXPECT_EQ(r, EAI_NONAME);
+        EXPECT_EQ(stub->n(), n + 2);
+    }
+
+    DEF_case(truncated) {
+        int n = stub->ntcp();
+        run([&]() { r = co::dns::resolve("big.test", AF_INET, v); });
+        EXPECT_EQ(r, 0);
+        EXPECT_EQ(v.size(), 2);
+        if (v.size() == 2) EXPECT_EQ(fastring(s(1)), "9.9.9.2");
+        EXPECT_EQ(stub->ntcp(), n + 1);
+        v.clear();
+    }
+
+    DEF_case(timeout) {
+        int64 t = now::ms();
+        run([&]() { r = co::dns::resolve("slow.test", AF_INET, v); });
+        t = now::ms() - t;
+        EXPECT_EQ(r, EAI_AGAIN);
+        EXPECT_GE(t, 900);
+    }
+
+    DEF_case(hook) {
+        struct hostent* h = 0;
+        run([&]() { h = ::gethostbyname("a.test"); });
+        EXPECT(h != NULL);
+        if (h) {
+            EXPECT_EQ(h->h_addrtype, AF_INET);
+            EXPECT_EQ(fastring(inet_ntop(AF_INET, h->h_addr_list[0], ip, sizeof(ip))), "1.2.3.4");
+            EXPECT(h->h_addr_list[1] == NULL);
+        }
+
+        char buf[16];
+        struct hostent ent, *res = 0;
+        int err = 0;
+        run([&]() { r = ::gethostbyname_r("myhost", &ent, buf, sizeof(buf), &res, &err); });
+        EXPECT_EQ(r, ERANGE);
+    }
+
+    DEF_case(getaddrinfo) {
+        struct addrinfo hints, *ai = 0;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_CANONNAME;
+        run([&]() { r = ::getaddrinfo("x", "80", &hints, &ai); });
+        EXPECT_EQ(r, 0);
+        int n = 0;
+        for (auto p = ai; p; p = p->ai_next, ++n) {
+            EXPECT_EQ(p->ai_family, AF_INET);
+            EXPECT_EQ(p->ai_socktype, (int)SOCK_STREAM);
+            EXPECT_EQ(ntohs(((struct sockaddr_in*)p->ai_addr)->sin_port), 80);
+        }
+        EXPECT_EQ(n, 2);
+        if (ai) {
+            EXPECT_EQ(fastring(ai->ai_canonname), "x");
+            auto x = (struct sockaddr_in*)ai->ai_addr;
+            EXPECT_EQ(fastring(inet_ntop(AF_INET, &x->sin_addr, ip, sizeof(ip))), "5.6.7.8");
+        }
+        ::freeaddrinfo(ai);
+
+        // numeric hosts go to libc
+        ai = 0;
+        run([&]() { r = ::getaddrinfo("127.0.0.1", "http", &hints, &ai); });
+        EXPECT_EQ(r, 0);
+        if (ai) EXPECT_EQ(ntohs(((struct sockaddr_in*)ai->ai_addr)->sin_port), 80);
+        ::freeaddrinfo(ai);
+
+        // names not found by co::dns are passed to libc
+        ai = 0;
+        run([&]() { r = ::getaddrinfo("nx.test", 0, 0, &ai); });
+        EXPECT_NE(r, 0);
+        EXPECT(ai == NULL);
+    }
+
+    DEF_case(getnameinfo) {
+        struct sockaddr_in a;
+        co::init_ip_addr(&a, "1.2.3.4", 80);
+        char host[64], serv[16];
+        run([&]() { r = ::getnameinfo((sockaddr*)&a, sizeof(a), host, sizeof(host), serv, sizeof(serv), NI_NUMERICSERV); });
+        EXPECT_EQ(r, 0);
+        EXPECT_EQ(fastring(host), "a.test");
+        EXPECT_EQ(fastring(serv), "80");
+
+        co::init_ip_addr(&a, "10.0.0.1", 80);
+        run([&]() { r = ::getnameinfo((sockaddr*)&a, sizeof(a), host, sizeof(host), 0, 0, 0); });
+        EXPECT_EQ(r, 0);
+        EXPECT_EQ(fastring(host), "myhost");
+
+        co::init_ip_addr(&a, "10.0.0.2", 80);
+        run([&]() { r = ::getnameinfo((sockaddr*)&a, sizeof(a), host, sizeof(host), 0, 0, 0); });
+        EXPECT_EQ(r, 0);
+        EXPECT_EQ(fastring(host), "10.0.0.2");
+        run([&]() { r = ::getnameinfo((sockaddr*)&a, sizeof(a), host, sizeof(host), 0, 0, NI_NAMEREQD); });
+        EXPECT_NE(r, 0);
+    }
+
+    DEF_case(hook_dns_off) {
+        // libc resolves names in the pool of co::async_run(), not in the scheduler
+        FLG_hook_dns = false;
+        const uint64 done = co::async_pool().stats().done;
+        struct addrinfo* ai = 0;
+        run([&]() { r = ::getaddrinfo("localhost", "80", 0, &ai); });
+        if (r == 0) ::freeaddrinfo(ai);
+        EXPECT_EQ(co::async_pool().stats().done, done + 1);
+
+        // numeric hosts need no lookup, they are passed to libc directly
+        ai = 0;
+        run([&]() { r = ::getaddrinfo("127.0.0.1", "80", 0, &ai); });
+        EXPECT_EQ(r, 0);
+        if (r == 0) ::freeaddrinfo(ai);
+        EXPECT_EQ(co::async_pool().stats().done, done + 1);
+
+        struct sockaddr_in a;
+        co::init_ip_addr(&a, "127.0.0.1", 80);
+        char host[64];
+        run([&]() { r = ::getnameinfo((sockaddr*)&a, sizeof(a), host, sizeof(host), 0, 0, 0); });
+        EXPECT_EQ(co::async_pool().stats().done, done + 2);
+        FLG_hook_dns = true;
+    }
+
+    stub->stop();
+    delete stub;
+    FLG_co_dns_hosts = hosts;
+    FLG_co_dns_resolv_conf = conf;
+    FLG_co_dns_servers = servers;
+    FLG_hook_dns = hook_dns;
+    co::dns::clear_cache();
+    fs::remove("dns_hosts.txt");
+    fs::remove("dns_resolv.txt");
+}
+
+} // namespace test
+
+#endif
@@ -0,0 +1,61 @@
+#include "co/unitest.h"
+#include "co/mem.h"
+#include "../src/so/http.h"
+
+namespace test {
+
+// parse the request in @s, return the status of parse_http_req()
+static int parse_req(fastring& s, http::http_req_t* req) {
+    const size_t pos = s.find("\r\n\r\n");
+    s[pos + 2] = '\0'; // make header null-terminated
+    return http::parse_http_req(&s, pos + 2, req);
+}
+
+DEF_test(http) {
+    DEF_case(header_hash) {
+        EXPECT_EQ(http::header_hash("Content-Length", 14), http::header_hash("content-LENGTH", 14));
+        EXPECT_NE(http::header_hash("Host", 4), http::header_hash("Hosts", 5));
+        // x-v5fged is not a known header, but has the hash of Content-Length
+        EXPECT_EQ(http::header_hash("x-v5fged", 8), http::header_hash("Content-Length", 14));
+    }
+
+    DEF_case(header) {
+        fastring s(
+            "GET /x HTTP/1.1\r\n"
+            "host: a.com\r\n"
+            "X-V5FGED: collide\r\n"
+            "Content-Length: 3\r\n"
+            "CONTENT-LENGTH: 9\r\n"
+            "X-Foo: bar\r\n"
+            "\r\nabc"
+        );
+        auto req = (http::http_req_t*) co::zalloc(sizeof(http::http_req_t));
+        EXPECT_EQ(parse_req(s, req), 0);
+
+        // mixed-case lookups
+        EXPECT_EQ(fastring(req->header("HOST")), "a.com");
+        EXPECT_EQ(fastring(req->header("Host")), "a.com");
+        EXPECT_EQ(fastring(req->header(http::kHost)), "a.com");
+        EXPECT_EQ(fastring(req->header("x-FOO")), "bar");
+
+        // the first one wins if a known header appears more than once
+        EXPECT_EQ(fastring(req->header(http::kContentLength)), "3");
+        EXPECT_EQ(fastring(req->header("content-length")), "3");
+        EXPECT_EQ(req->body_size, 3u);
+
+        // absent known and other headers
+        EXPECT_EQ(fastring(req->header(http::kConnection)), "");
+        EXPECT_EQ(fastring(req->header("Transfer-Encoding")), "");
+        EXPECT_EQ(fastring(req->header("X-Bar")), "");
+
+        // a header with the hash of a known one is found only by its own name
+        EXPECT_EQ(fastring(req->header("x-v5fged")), "collide");
+        EXPECT_EQ(fastring(req->header("X-V5FGEE")), "");
+
+        req->url.~fastring();
+        co::free(req->arr, req->arr_cap << 2);
+        co::free(req, sizeof(*req));
+    }
+}
+
+} // namespace test
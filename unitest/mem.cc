@@ -1,5 +1,7 @@
 #include "co/unitest.h"
 #include "co/mem.h"
+#include <thread>
+#include <vector>
 
 #ifdef _WIN32
 #ifndef WIN32_LEAN_AND_MEAN
@@ -73,6 +75,49 @@ inline uint32 _pow2_align(uint32 n) {
 
 #endif
 
+// size of small blocks and large blocks in co::alloc
+static const size_t SB = (size_t)1 << 15;
+static const size_t LB = (size_t)1 << (sizeof(void*) == 8 ? 21 : 20);
+
+inline size_t block_of(void* p, size_t bs) {
+    return (size_t)p & ~(bs - 1);
+}
+
+// free memory in another thread
+inline void xfree(const std::vector<void*>& v, size_t n) {
+    std::thread([&v, n]() { for (auto& p : v) co::free(p, n); }).join();
+}
+
+// Allocations of @n bytes in a block of size @bs, made by a new thread, so that 
+// the thread allocator is not used by anyone else. The first block is filled up,
+// and a second one is started.
+struct Filled {
+    Filled(size_t n, size_t bs) : n(n), bs(bs) {
+        void* p = co::alloc(n);
+        while (block_of(p, bs) == block_of(this->first(p), bs)) {
+            v.push_back(p);
+            p = co::alloc(n);
+        }
+        w.push_back(p);
+    }
+
+    void* first(void* p) { return v.empty() ? p : v[0]; }
+
+    // fill up the second block, return the first allocation outside of it
+    void* fill() {
+        for (;;) {
+            void* p = co::alloc(n);
+            if (block_of(p, bs) != block_of(w[0], bs)) return p;
+            w.push_back(p);
+        }
+    }
+
+    size_t n;
+    size_t bs;
+    std::vector<void*> v; // allocations in the first block
+    std::vector<void*> w; // allocations in the second block
+};
+
 } // mem
 
 DEF_test(mem) {
@@ -178,6 +223,84 @@ DEF_test(mem) {
         co::free(p, 256 * 1024);
     }
 
+    // a block emptied by other threads is moved to the front of the list when the 
+    // owner drains it, and it becomes the current block again
+    DEF_case(remote_free) {
+        for (int k = 0; k < 2; ++k) {
+            const size_t n = k == 0 ? 1024 : 128 * 1024;
+            const size_t bs = k == 0 ? mem::SB : mem::LB;
+            void* p[3] = { 0, 0, 0 };
+            std::vector<void*> v;
+            std::thread([&]() {
+                mem::Filled f(n, bs);
+                v = f.v;
+                mem::xfree(f.v, n);
+                p[0] = f.fill();
+                p[1] = co::alloc(n);
+                p[2] = co::alloc(n);
+            }).join();
+
+            EXPECT_GT(v.size(), 3);
+            if (v.size() > 3) {
+                EXPECT_EQ(p[0], v[0]);
+                EXPECT_EQ(p[1], v[1]);
+                EXPECT_EQ(p[2], v[2]);
+            }
+        }
+    }
+
+    // the current bit is moved down when the top allocations are freed remotely
+    DEF_case(remote_free_top) {
+        for (int k = 0; k < 2; ++k) {
+            const size_t n = k == 0 ? 1024 : 128 * 1024;
+            const size_t bs = k == 0 ? mem::SB : mem::LB;
+            void* p[2] = { 0, 0 };
+            std::vector<void*> v;
+            std::thread([&]() {
+                mem::Filled f(n, bs);
+                v = f.v;
+                if (v.size() > 3) {
+                    mem::xfree(std::vector<void*>(v.end() - 3, v.end()), n);
+                    p[0] = f.fill();
+                    p[1] = co::alloc(n);
+                }
+            }).join();
+
+            EXPECT_GT(v.size(), 3);
+            if (v.size() > 3) {
+                EXPECT_EQ(p[0], v[v.size() - 3]);
+                EXPECT_EQ(p[1], v[v.size() - 2]);
+            }
+        }
+    }
+
+    // A block in the remote-free list is not released by the owner, though all 
+    // memory allocated by the owner has been freed locally. It is drained later.
+    DEF_case(remote_free_marked) {
+        for (int k = 0; k < 2; ++k) {
+            const size_t n = k == 0 ? 1024 : 128 * 1024;
+            const size_t bs = k == 0 ? mem::SB : mem::LB;
+            void* p[2] = { 0, 0 };
+            std::vector<void*> v;
+            std::thread([&]() {
+                mem::Filled f(n, bs);
+                v = f.v;
+                if (v.size() > 3) {
+                    mem::xfree(std::vector<void*>(v.begin(), v.begin() + 1), n);
+                    for (size_t i = v.size() - 1; i > 0; --i) co::free(v[i], n);
+                    p[0] = f.fill();
+                    p[1] = co::alloc(n);
+                }
+            }).join();
+
+            EXPECT_GT(v.size(), 3);
+            if (v.size() > 3) {
+                EXPECT_EQ(p[0], v[0]);
+                EXPECT_EQ(p[1], v[1]);
+            }
+        }
+    }
+
     DEF_case(unique_ptr) {
         co::unique_ptr<int> p;
         EXPECT(p == NULL);
@@ -0,0 +1,428 @@
+#include "co/unitest.h"
+#include "co/rpc.h"
+#include "co/co.h"
+#include "co/time.h"
+
+DEC_int32(rpc_recv_timeout);
+DEC_uint32(rpc_max_inflight);
+
+namespace test {
+
+// messages in the form generated by gen
+struct Item {
+    Item() : id(0) {}
+
+    int64 id;
+    fastring name;
+
+    void encode(rpc::Writer& w) const {
+        w.put(1, this->id);
+        w.put(2, this->name);
+    }
+
+    bool decode(rpc::Reader& r) {
+        uint32 id, t;
+        while (r.next(&id, &t)) {
+            switch (id) {
+              case 1:
+                if (!r.get(t, this->id)) return false;
+                break;
+              case 2:
+                if (!r.get(t, this->name)) return false;
+                break;
+              default:
+                if (!r.skip(t)) return false;
+            }
+        }
+        return r.ok();
+    }
+
+    void to_json(Json& j) const {
+        rpc::xx::to_json(j, "id", this->id);
+        rpc::xx::to_json(j, "name", this->name);
+    }
+
+    bool from_json(const Json& j) {
+        return rpc::xx::from_json(j, "id", this->id) &&
+            rpc::xx::from_json(j, "name", this->name);
+    }
+};
+
+struct Order {
+    Order() : ok(false), n(0), u(0), price(0) {}
+
+    bool ok;
+    int32 n;
+    uint64 u;
+    double price;
+    co::vector<int32> nums;
+    co::vector<Item> items;
+
+    void encode(rpc::Writer& w) const {
+        w.put(1, this->ok);
+        w.put(2, this->n);
+        w.put(3, this->u);
+        w.put(4, this->price);
+        w.put(5, this->nums);
+        w.put(6, this->items);
+    }
+
+    bool decode(rpc::Reader& r) {
+        uint32 id, t;
+        while (r.next(&id, &t)) {
+            switch (id) {
+              case 1:
+                if (!r.get(t, this->ok)) return false;
+                break;
+              case 2:
+                if (!r.get(t, this->n)) return false;
+                break;
+              case 3:
+                if (!r.get(t, this->u)) return false;
+                break;
+              case 4:
+                if (!r.get(t, this->price)) return false;
+                break;
+              case 5:
+                if (!r.get(t, this->nums)) return false;
+                break;
+              case 6:
+                if (!r.get(t, this->items)) return false;
+                break;
+              default:
+                if (!r.skip(t)) return false;
+            }
+        }
+        return r.ok();
+    }
+
+    void to_json(Json& j) const {
+        rpc::xx::to_json(j, "ok", this->ok);
+        rpc::xx::to_json(j, "n", this->n);
+        rpc::xx::to_json(j, "u", this->u);
+        rpc::xx::to_json(j, "price", this->price);
+        rpc::xx::to_json(j, "nums", this->nums);
+        rpc::xx::to_json(j, "items", this->items);
+    }
+
+    bool from_json(const Json& j) {
+        return rpc::xx::from_json(j, "ok", this->ok) &&
+            rpc::xx::from_json(j, "n", this->n) &&
+            rpc::xx::from_json(j, "u", this->u) &&
+            rpc::xx::from_json(j, "price", this->price) &&
+            rpc::xx::from_json(j, "nums", this->nums) &&
+            rpc::xx::from_json(j, "items", this->items);
+    }
+};
+
+// Test.sleep sleeps for req.ms milliseconds, then echoes req.tag and the tag of
+// the server, tests of MuxClient use it to control the order of responses. It 
+// also records the max number of calls running at the same time.
+class SleepService : public rpc::Service {
+  public:
+    SleepService(int tag) : _tag(tag), _n(0), _peak(0) {
+        _methods["Test.sleep"] = [this](Json& req, Json& res) { this->sleep(req, res); };
+    }
+
+    virtual ~SleepService() {}
+
+    virtual const char* name() const {
+        return "Test";
+    }
+
+    virtual const co::map<const char*, Fun>& methods() const {
+        return _methods;
+    }
+
+    void sleep(Json& req, Json& res) {
+        const int ms = req.get("ms").as_int();
+        const int n = atomic_inc(&_n);
+        for (int x; n > (x = atomic_load(&_peak)) && !atomic_bool_cas(&_peak, x, n););
+        if (ms > 0) co::sleep(ms);
+        atomic_dec(&_n);
+        res.add_member("tag", req.get("tag").as_string());
+        res.add_member("srv", _tag);
+    }
+
+    int peak() const { return atomic_load(&_peak); }
+    void reset_peak() { atomic_store(&_peak, 0); }
+
+  private:
+    int _tag;
+    int _n;
+    int _peak;
+    co::map<const char*, Fun> _methods;
+};
+
+static const int kPort = 19898;
+
+// call Test.sleep, return the tag of the server, -1 if the call failed, or -2 if
+// the response belongs to another call
+static int sleep_call(rpc::MuxClient& c, int ms, const char* tag) {
+    Json req, res;
+    req.add_member("api", "Test.sleep");
+    req.add_member("ms", ms);
+    req.add_member("tag", tag);
+    if (!c.call(req, res)) return -1;
+    if (res.get("tag").as_string() != tag) return -2;
+    return res.get("srv").as_int();
+}
+
+// run @f in a coroutine, and wait for it
+template<typename F>
+static void run_in_co(F&& f) {
+    co::WaitGroup wg;
+    wg.add();
+    go([wg, &f]() { f(); wg.done(); });
+    wg.wait();
+}
+
+DEF_test(rpc) {
+    DEF_case(varint) {
+        fastream s;
+        rpc::Writer w(s);
+        w.put(1, (uint32)1);
+        EXPECT_EQ(s.size(), 2);
+        EXPECT_EQ(s[0], (char)0x08);
+        EXPECT_EQ(s[1], (char)0x01);
+
+        s.clear();
+        w.put(2, (uint32)300);
+        EXPECT_EQ(s.size(), 3);
+        EXPECT_EQ(s[1], (char)0xac);
+        EXPECT_EQ(s[2], (char)0x02);
+
+        // zigzag
+        s.clear();
+        w.put(1, (int32)-1);
+        EXPECT_EQ(s.size(), 2);
+        EXPECT_EQ(s[1], (char)0x01);
+
+        // default values are omitted
+        s.clear();
+        w.put(1, (int32)0);
+        w.put(2, false);
+        w.put(3, 0.0);
+        w.put(4, fastring());
+        EXPECT_EQ(s.size(), 0);
+
+        uint64 v;
+        const char b[] = { (char)0xff, (char)0xff };
+        rpc::Reader r(b, 2);
+        EXPECT(!r.varint(&v));
+    }
+
+    DEF_case(message) {
+        Order o;
+        o.ok = true;
+        o.n = -7;
+        o.u = 1ULL << 60;
+        o.price = 3.25;
+        o.nums = { 0, -1, 1000000 };
+        o.items.resize(2);
+        o.items[0].id = -9;
+        o.items[0].name = "hello";
+        o.items[1].name.append(200, 'x');
+
+        fastream s;
+        rpc::Writer w(s);
+        o.encode(w);
+
+        Order x;
+        rpc::Reader r(s.data(), s.size());
+        EXPECT(x.decode(r));
+        EXPECT_EQ(x.ok, true);
+        EXPECT_EQ(x.n, -7);
+        EXPECT_EQ(x.u, 1ULL << 60);
+        EXPECT_EQ(x.price, 3.25);
+        EXPECT_EQ(x.nums.size(), 3);
+        EXPECT_EQ(x.nums[0], 0);
+        EXPECT_EQ(x.nums[1], -1);
+        EXPECT_EQ(x.nums[2], 1000000);
+        EXPECT_EQ(x.items.size(), 2);
+        EXPECT_EQ(x.items[0].id, -9);
+        EXPECT_EQ(x.items[0].name, "hello");
+        EXPECT_EQ(x.items[1].id, 0);
+        EXPECT_EQ(x.items[1].name.size(), 200);
+
+        // truncated
+        Order y;
+        rpc::Reader t(s.data(), s.size() - 1);
+        EXPECT(!y.decode(t));
+    }
+
+    DEF_case(unknown) {
+        // a newer peer sends fields this side does not know
+        Order o;
+        o.u = 3;
+        o.price = 1.5;
+        o.items.resize(1);
+        o.items[0].name = "x";
+        fastream s;
+        rpc::Writer w(s);
+        o.encode(w);
+
+        Item x;
+        rpc::Reader r(s.data(), s.size());
+        EXPECT(x.decode(r));
+        EXPECT_EQ(x.id, 0);
+        EXPECT_EQ(x.name, "");
+
+        // mismatched wire type
+        s.clear();
+        w.put(2, (uint32)1);
+        rpc::Reader e(s.data(), s.size());
+        EXPECT(!x.decode(e));
+    }
+
+    DEF_case(json) {
+        Order o;
+        o.n = 3;
+        o.price = 2.5;
+        o.nums = { 1, 2 };
+        o.items.resize(1);
+        o.items[0].id = 8;
+        o.items[0].name = "x";
+
+        Json j = json::object();
+        o.to_json(j);
+        EXPECT_EQ(j.str(), R"({"ok":false,"n":3,"u":0,"price":2.5,"nums":[1,2],"items":[{"id":8,"name":"x"}]})");
+
+        Order x;
+        EXPECT(x.from_json(j));
+        EXPECT_EQ(x.n, 3);
+        EXPECT_EQ(x.price, 2.5);
+        EXPECT_EQ(x.nums.size(), 2);
+        EXPECT_EQ(x.items[0].name, "x");
+
+        // missing fields keep default values, bad types are errors
+        Order y;
+        EXPECT(y.from_json(json::parse(R"({"api":"x","n":5})")));
+        EXPECT_EQ(y.n, 5);
+        EXPECT(y.nums.empty());
+        EXPECT(!y.from_json(json::parse(R"({"n":"5"})")));
+        EXPECT(!y.from_json(json::parse(R"({"items":[1]})")));
+    }
+
+    DEF_case(method_id) {
+        // ids are generated into code by gen, they must not change
+        EXPECT_EQ(rpc::method_id("HelloWorld.hi"), 2333263320u);
+        EXPECT_NE(rpc::method_id("HelloWorld.hi"), rpc::method_id("HelloWorld.hello"));
+    }
+
+    DEF_case(mux) {
+        const int32 recv_timeout = FLG_rpc_recv_timeout;
+        const uint32 max_inflight = FLG_rpc_max_inflight;
+        FLG_rpc_max_inflight = 8; // the server may respond out of order
+
+        rpc::Server s1;
+        s1.add_service(std::make_shared<SleepService>(1));
+        s1.start("127.0.0.1", kPort);
+        sleep::ms(50);
+
+        rpc::MuxClient c("127.0.0.1", kPort);
+        co::WaitGroup wg;
+        int r = 0;
+
+        // the later call with a shorter sleep gets its response first
+        {
+            int seq = 0, order[2] = { 0, 0 }, srv[2] = { 0, 0 };
+            wg.add(2);
+            go([&, wg]() { srv[0] = sleep_call(c, 200, "a"); order[0] = atomic_inc(&seq); wg.done(); });
+            sleep::ms(20);
+            go([&, wg]() { srv[1] = sleep_call(c, 10, "b"); order[1] = atomic_inc(&seq); wg.done(); });
+            wg.wait();
+            EXPECT_EQ(srv[0], 1);
+            EXPECT_EQ(srv[1], 1);
+            EXPECT_EQ(order[0], 2);
+            EXPECT_EQ(order[1], 1);
+        }
+
+        // the call times out, its late response is dropped
+        FLG_rpc_recv_timeout = 100;
+        run_in_co([&]() { r = sleep_call(c, 300, "a"); });
+        EXPECT_EQ(r, -1);
+        FLG_rpc_recv_timeout = recv_timeout;
+        sleep::ms(300);
+        run_in_co([&]() { r = sleep_call(c, 0, "b"); });
+        EXPECT_EQ(r, 1);
+
+        // the server restarts, the connection to the old one is reset after a 
+        // while, and the client connects to the new one
+        s1.exit();
+        rpc::Server s2;
+        s2.add_service(std::make_shared<SleepService>(2));
+        s2.start("127.0.0.1", kPort);
+
+        FLG_rpc_recv_timeout = 500;
+        r = 0;
+        for (int i = 0; i < 50 && r != 2; ++i) {
+            run_in_co([&]() { r = sleep_call(c, 0, "c"); });
+            EXPECT_NE(r, -2);
+            if (r < 0) sleep::ms(100);
+        }
+        EXPECT_EQ(r, 2);
+        FLG_rpc_recv_timeout = recv_timeout;
+
+        // close() with calls in flight, they return, and later calls fail
+        {
+            int srv[2] = { 0, 0 };
+            wg.add(2);
+            for (int i = 0; i < 2; ++i) {
+                go([&, wg, i]() { srv[i] = sleep_call(c, 300, "d"); wg.done(); });
+            }
+            sleep::ms(50);
+            c.close();
+            wg.wait();
+            for (int i = 0; i < 2; ++i) EXPECT(srv[i] == 2 || srv[i] == -1);
+            run_in_co([&]() { r = sleep_call(c, 0, "e"); });
+            EXPECT_EQ(r, -1);
+        }
+
+        s2.exit();
+        FLG_rpc_max_inflight = max_inflight;
+    }
+
+    DEF_case(serve) {
+        const uint32 max_inflight = FLG_rpc_max_inflight;
+        auto srv = std::make_shared<SleepService>(1);
+        rpc::Server s;
+        s.add_service(srv);
+        s.start("127.0.0.1", kPort);
+        sleep::ms(50);
+
+        // 6 calls of 100ms, @max of them are processed at the same time
+        auto run = [&srv](uint32 max, int64* t) {
+            FLG_rpc_max_inflight = max; // the server reads it on the first request
+            rpc::MuxClient c("127.0.0.1", kPort);
+            run_in_co([&]() { sleep_call(c, 0, "x"); });
+            srv->reset_peak();
+
+            int ok = 0;
+            co::WaitGroup wg;
+            wg.add(6);
+            const int64 beg = now::ms();
+            for (int i = 0; i < 6; ++i) {
+                go([&, wg]() { if (sleep_call(c, 100, "y") == 1) atomic_inc(&ok); wg.done(); });
+            }
+            wg.wait();
+            *t = now::ms() - beg;
+            c.close();
+            return ok;
+        };
+
+        int64 t = 0;
+        EXPECT_EQ(run(8, &t), 6);
+        EXPECT_EQ(srv->peak(), 6);
+        EXPECT_LT(t, 300);
+
+        EXPECT_EQ(run(2, &t), 6);
+        EXPECT_EQ(srv->peak(), 2);
+        EXPECT_GE(t, 250);
+
+        s.exit();
+        FLG_rpc_max_inflight = max_inflight;
+    }
+}
+
+} // namespace test
@@ -0,0 +1,65 @@
+#include "co/unitest.h"
+#include "co/tcp.h"
+#include "co/co.h"
+#include "co/time.h"
+#include <string.h>
+
+namespace test {
+
+static const int kTcpPort = 19897;
+
+// run @f in a coroutine, and wait for it
+template<typename F>
+static void run_in_co(F&& f) {
+    co::WaitGroup wg;
+    wg.add();
+    go([wg, &f]() { f(); wg.done(); });
+    wg.wait();
+}
+
+DEF_test(tcp) {
+    DEF_case(reuse_port_exit) {
+        int nconn = 0;
+        tcp::Server s;
+        s.reuse_port();
+        s.on_connection([&nconn](tcp::Connection c) {
+            atomic_inc(&nconn);
+            char buf[4];
+            if (c.recvn(buf, 4) == 4) c.send(buf, 4);
+        });
+        s.start("127.0.0.1", kTcpPort);
+        sleep::ms(50);
+
+        int ok = 0;
+        co::WaitGroup wg;
+        wg.add(8);
+        for (int i = 0; i < 8; ++i) {
+            go([&ok, wg]() {
+                tcp::Client c("127.0.0.1", kTcpPort);
+                char buf[4] = { 0 };
+                if (c.connect(1000) && c.send("ping", 4) == 4 && 
+                    c.recvn(buf, 4, 1000) == 4 && memcmp(buf, "ping", 4) == 0) {
+                    atomic_inc(&ok);
+                }
+                wg.done();
+            });
+        }
+        wg.wait();
+        EXPECT_EQ(ok, 8);
+        EXPECT_EQ(atomic_load(&nconn), 8);
+
+        // all the listening sockets are closed when exit() returns
+        const int64 beg = now::ms();
+        s.exit();
+        EXPECT_LT(now::ms() - beg, 3000);
+
+        bool connected = true;
+        run_in_co([&connected]() {
+            tcp::Client c("127.0.0.1", kTcpPort);
+            connected = c.connect(100);
+        });
+        EXPECT(!connected);
+    }
+}
+
+} // namespace test